@@ -16,8 +16,49 @@ struct PushConstant
   int maxSamples;  // For RTX
   int materialId;  // For raster
   int instanceId;
+  int interopFlags;  // For RTX, see INTEROP_XXX
+  int convergenceSlot;  // For RTX, where the change of the accumulation is added, -1: not measured
+  float convergenceScale;  // For RTX, fixed point scale of the change, the sum over the image fits 32 bits
+  int interopSet;       // For RTX, interop buffer set written in zero-copy
+  float adaptiveThreshold;  // For RTX, relative error under which a pixel is not sampled anymore, 0: every pixel
+  int   sampler;            // For RTX, see SAMPLER_XXX
 };
 
+// #OPTIX_D
+// Zero-copy: the ray generation shader writes directly into the buffers shared with the denoiser
+#define INTEROP_WRITE_COLOR 1     // Write the accumulated color
+#define INTEROP_WRITE_GUIDES 2    // Write albedo and normal
+#define INTEROP_HALF 4            // Buffers are 16-bit floats (HALF3/HALF4)
+#define INTEROP_RGB 8             // Buffers have 3 channels (FLOAT3/HALF3)
+#define INTEROP_WRITE_FLOW 16     // Write the motion vectors (temporal denoiser), always FLOAT2
+#define INTEROP_GUIDES_HALF 32    // Albedo and normal are 16-bit floats
+#define INTEROP_GUIDES_RGB 64     // Albedo and normal have 3 channels
+#define INTEROP_AOVS 128          // Accumulate the light-path AOVs
+#define INTEROP_WRITE_AOVS 256    // Write the accumulated AOVs, same format as the color
+#define INTEROP_TRACE_GUIDES 512  // Trace the G-Buffer ray (albedo, normal, motion), otherwise the guides are kept
+#define MAX_INTEROP_SETS 3        // Ring of interop buffers, Vulkan writes one set while the denoiser reads another
+
+// Light-path AOVs, denoised with the color in the same invocation. Their sum is the color.
+#define AOV_DIFFUSE 0
+#define AOV_SPECULAR 1
+#define AOV_EMISSION 2
+#define NB_AOVS 3
+
+// #OPTIX_D
+// Adaptive denoising: the ray generation shader measures how much the accumulated image is changing
+#define CONVERGENCE_STRIDE 4      // One pixel out of 4x4 is measured
+#define CONVERGENCE_SCALE 4096.0  // Largest fixed point scale of the relative change, accumulated with atomics
+
+// Adaptive sampling: converged pixels are skipped, see pc.adaptiveThreshold
+#define ADAPTIVE_MIN_FRAMES 16  // Frames accumulated before the error of a pixel is trusted
+#define ADAPTIVE_REFRESH 8      // All pixels are sampled every N frames, catching wrongly converged ones
+
+// #OPTIX_D
+// Sample generators of the path tracer, see sampler.glsl
+#define SAMPLER_WHITE_NOISE 0
+#define SAMPLER_SOBOL 1       // Owen-scrambled Sobol
+#define SAMPLER_BLUE_NOISE 2  // Blue-noise mask rotated at each sample
+#define BLUE_NOISE_SIZE 64
 
 #define MAX_NB_LIGHTS 1
 #define GRID_SIZE 16
@@ -28,6 +69,7 @@ struct FrameInfo
   mat4  view;
   mat4  projInv;
   mat4  viewInv;
+  mat4  prevViewProj;  // Camera of the previous frame, for motion vectors
   vec4  clearColor;
   vec3  camPos;
   float envRotation;
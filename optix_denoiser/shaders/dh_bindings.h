@@ -23,7 +23,16 @@ START_BINDING(RtxBindings)
 eTlas = 0,
 eOutImage = 1,
 eOutAlbedo = 2,
-eOutNormal = 3
+eOutNormal = 3,
+eOutColorBuffer = 4,
+eOutAlbedoBuffer = 5,
+eOutNormalBuffer = 6,
+eOutFlowBuffer = 7,
+eConvergence = 8,
+eOutMoments = 9,
+eOutAovs = 10,
+eOutAovBuffer = 11,
+eBlueNoise = 12
 END_BINDING();
 
 START_BINDING(DeferredBindings)
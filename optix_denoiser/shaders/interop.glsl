@@ -0,0 +1,20 @@
+// Writing pixels to the linear buffers shared with the OptiX denoiser (Cuda)
+// The buffers are declared twice in the shader, as float and float16_t arrays,
+// and the pixel is stored using the format used by the denoiser.
+// Note: requires GL_EXT_shader_16bit_storage
+
+#ifndef INTEROP_GLSL
+#define INTEROP_GLSL
+
+// clang-format off
+#define STORE_PIXEL(buf, bufh, linear, value, nbChannels, useHalf)                                                     \
+  for(int c = 0; c < nbChannels; c++)                                                                                  \
+  {                                                                                                                    \
+    if(useHalf)                                                                                                        \
+      bufh[(linear) * (nbChannels) + c] = float16_t(value[c]);                                                         \
+    else                                                                                                               \
+      buf[(linear) * (nbChannels) + c] = value[c];                                                                     \
+  }
+// clang-format on
+
+#endif  // INTEROP_GLSL
@@ -9,30 +9,43 @@ precision highp float;
 struct HitPayload
 {
   uint  seed;
+  uint  sampleIndex;  // Sample of the pixel and dimension drawn next, see sampler.glsl
+  uint  dim;
   float hitT;
   vec3  contrib;
   vec3  weight;
   vec3  rayOrigin;
   vec3  rayDirection;
+  // #OPTIX_D
+  // Light-path AOVs, set by the closest hit
+  vec3  emission;  // Emission of the surface hit
+  vec3  diffuse;   // Part of contrib coming from the diffuse lobe (direct lighting)
+  int   lobe;      // AOV_DIFFUSE or AOV_SPECULAR, lobe sampled for the next bounce
 };
 
 HitPayload initPayload()
 {
   HitPayload p;
   p.seed         = 0U;
+  p.sampleIndex  = 0U;
+  p.dim          = 0U;
   p.hitT         = 0.F;
   p.contrib      = vec3(0.F);
   p.weight       = vec3(1.F);
   p.rayOrigin    = vec3(0.F);
   p.rayDirection = vec3(0.F, 0.F, -1.F);
+  p.emission     = vec3(0.F);
+  p.diffuse      = vec3(0.F);
+  p.lobe         = 0;
   return p;
 }
 
 // #OPTIX_D
 struct GbufferPayload
 {
-  uint packAlbedo;
-  uint packNormal;
+  uint  packAlbedo;
+  uint  packNormal;
+  float hitT;  // For motion vectors
 };
 
 #endif  // PAYLOAD_H
\ No newline at end of file
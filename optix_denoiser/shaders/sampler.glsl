@@ -0,0 +1,92 @@
+// #OPTIX_D
+// Sample generators of the path tracer, selected with pc.sampler (see SAMPLER_XXX).
+// nextSample() returns the next dimension of a sample of the pixel, in [0..1): the ray generation and the closest hit
+// draw their dimensions in the same order for all samples, which matters for the low-discrepancy generators.
+// - White noise: rand() of the seed, hashed from the pixel and the frame
+// - Sobol: 4D Sobol points with Owen scrambling and shuffling per pixel (Burley, "Practical Hash-based Owen
+//   Scrambling", 2020), padded with an independent shuffle for each group of 4 dimensions
+// - Blue noise: a BLUE_NOISE_SIZE^2 mask tiled on the image, offset for each dimension, rotated from one sample to the
+//   next by the golden ratio (Cranley-Patterson rotation): blue noise in space, low discrepancy in time
+// Note: requires pc (PushConstant), gBlueNoise and nvvkhl/shaders/random.h
+
+#ifndef SAMPLER_GLSL
+#define SAMPLER_GLSL
+
+// clang-format off
+// Direction numbers of the 4 first dimensions of Sobol (Joe-Kuo)
+const uint sobolDirections[4 * 32] = {
+  0x80000000u, 0x40000000u, 0x20000000u, 0x10000000u, 0x08000000u, 0x04000000u, 0x02000000u, 0x01000000u,
+  0x00800000u, 0x00400000u, 0x00200000u, 0x00100000u, 0x00080000u, 0x00040000u, 0x00020000u, 0x00010000u,
+  0x00008000u, 0x00004000u, 0x00002000u, 0x00001000u, 0x00000800u, 0x00000400u, 0x00000200u, 0x00000100u,
+  0x00000080u, 0x00000040u, 0x00000020u, 0x00000010u, 0x00000008u, 0x00000004u, 0x00000002u, 0x00000001u,
+  0x80000000u, 0xc0000000u, 0xa0000000u, 0xf0000000u, 0x88000000u, 0xcc000000u, 0xaa000000u, 0xff000000u,
+  0x80800000u, 0xc0c00000u, 0xa0a00000u, 0xf0f00000u, 0x88880000u, 0xcccc0000u, 0xaaaa0000u, 0xffff0000u,
+  0x80008000u, 0xc000c000u, 0xa000a000u, 0xf000f000u, 0x88008800u, 0xcc00cc00u, 0xaa00aa00u, 0xff00ff00u,
+  0x80808080u, 0xc0c0c0c0u, 0xa0a0a0a0u, 0xf0f0f0f0u, 0x88888888u, 0xccccccccu, 0xaaaaaaaau, 0xffffffffu,
+  0x80000000u, 0xc0000000u, 0x60000000u, 0x90000000u, 0xe8000000u, 0x5c000000u, 0x8e000000u, 0xc5000000u,
+  0x68800000u, 0x9cc00000u, 0xee600000u, 0x55900000u, 0x80680000u, 0xc09c0000u, 0x60ee0000u, 0x90550000u,
+  0xe8808000u, 0x5cc0c000u, 0x8e606000u, 0xc5909000u, 0x6868e800u, 0x9c9c5c00u, 0xeeee8e00u, 0x5555c500u,
+  0x8000e880u, 0xc0005cc0u, 0x60008e60u, 0x9000c590u, 0xe8006868u, 0x5c009c9cu, 0x8e00eeeeu, 0xc5005555u,
+  0x80000000u, 0xc0000000u, 0x20000000u, 0x50000000u, 0xf8000000u, 0x74000000u, 0xa2000000u, 0x93000000u,
+  0xd8800000u, 0x25400000u, 0x59e00000u, 0xe6d00000u, 0x78080000u, 0xb40c0000u, 0x82020000u, 0xc3050000u,
+  0x208f8000u, 0x51474000u, 0xfbea2000u, 0x75d93000u, 0xa0858800u, 0x914e5400u, 0xdbe79e00u, 0x25db6d00u,
+  0x58800080u, 0xe54000c0u, 0x79e00020u, 0xb6d00050u, 0x800800f8u, 0xc00c0074u, 0x200200a2u, 0x50050093u
+};
+// clang-format on
+
+uint sobol(uint index, uint dim)
+{
+  uint x = 0;
+  for(uint i = index; i != 0; i &= i - 1)
+    x ^= sobolDirections[dim * 32 + uint(findLSB(i))];
+  return x;
+}
+
+uint laineKarrasPermutation(uint x, uint seed)
+{
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+uint nestedUniformScramble(uint x, uint seed)
+{
+  return bitfieldReverse(laineKarrasPermutation(bitfieldReverse(x), seed));
+}
+
+float sobolOwen(uint index, uint dim)
+{
+  const uint group_seed = xxhash32(uvec3(gl_LaunchIDEXT.xy, dim / 4));  // Same for all the samples of the pixel
+  const uint shuffled   = nestedUniformScramble(index, group_seed);
+  const uint x          = nestedUniformScramble(sobol(shuffled, dim % 4), xxhash32(uvec3(group_seed, dim % 4, 0x9e3779b9u)));
+  return float(x >> 8) * (1.0 / 16777216.0);  // 24 bits, strictly under 1
+}
+
+float blueNoise(uint index, uint dim)
+{
+  // R2 sequence: well spread offsets of the mask from one dimension to the next
+  const uvec2 offset   = uvec2(fract(vec2(dim) * vec2(0.7548776662, 0.5698402910)) * float(BLUE_NOISE_SIZE));
+  const uvec2 texel    = (gl_LaunchIDEXT.xy + offset) % uint(BLUE_NOISE_SIZE);
+  const float value    = gBlueNoise[texel.y * BLUE_NOISE_SIZE + texel.x];
+  const uint  rotation = index * 0x9e3779b9u;  // Golden ratio in 0.32 fixed point, exact for any index
+  return fract(value + float(rotation >> 8) * (1.0 / 16777216.0));
+}
+
+// Next dimension of the sample 'index' of the pixel, 'seed' is only used by the white noise
+float nextSample(inout uint seed, inout uint dim, uint index)
+{
+  float value;
+  if(pc.sampler == SAMPLER_SOBOL)
+    value = sobolOwen(index, dim);
+  else if(pc.sampler == SAMPLER_BLUE_NOISE)
+    value = blueNoise(index, dim);
+  else
+    value = rand(seed);
+  dim++;
+  return value;
+}
+
+#endif  // SAMPLER_GLSL
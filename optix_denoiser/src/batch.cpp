@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+#include "batch.hpp"
+
+bool parseBatchArgs(int argc, char** argv, BatchConfig& config)
+{
+  for(int i = 1; i + 1 < argc; i++)
+  {
+    std::string arg = argv[i];
+    if(arg == "-batch_in")
+      config.inputDir = argv[++i];
+    else if(arg == "-batch_out")
+      config.outputDir = argv[++i];
+    else if(arg == "-batch_queue")
+      config.queueSize = std::max(1, std::atoi(argv[++i]));
+  }
+  if(config.outputDir.empty())
+    config.outputDir = config.inputDir;
+  return !config.inputDir.empty();
+}
+
+#ifdef NVP_SUPPORTS_OPTIX7
+
+#include "nvh/nvprint.hpp"
+#include "nvvk/context_vk.hpp"
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+#include "bounded_queue.hpp"
+#include "denoiser.hpp"
+
+namespace fs = std::filesystem;
+
+// An image in flight, with its pinned host memory (RGB floats), re-used from one image to the next
+struct BatchFrame
+{
+  std::string           name;
+  int                   width    = 0;
+  int                   height   = 0;
+  std::array<float*, 4> pixels   = {};  // Color, albedo, normal, denoised
+  size_t                capacity = 0;   // Bytes of each of the buffers
+  cudaEvent_t           done     = {};  // Denoised result downloaded
+
+  void reserve(size_t bytes)
+  {
+    if(bytes <= capacity)
+      return;
+    for(auto& p : pixels)
+    {
+      if(p != nullptr)
+        CUDA_CHECK(cudaFreeHost(p));
+      CUDA_CHECK(cudaHostAlloc((void**)&p, bytes, cudaHostAllocPortable));
+    }
+    capacity = bytes;
+  }
+};
+
+//--------------------------------------------------------------------------------------------------
+// Loading the three images of a frame into its pinned buffers; all must exist and have the same size.
+// The normals are decoded from [0..1] to [-1..1] (see batch.hpp).
+//
+static bool loadFrame(const fs::path& colorFile, BatchFrame& frame)
+{
+  const std::string                color = colorFile.string();
+  const std::string                base  = color.substr(0, color.size() - std::string("_color.hdr").size());
+  const std::array<std::string, 3> files = {color, base + "_albedo.hdr", base + "_normal.hdr"};
+
+  frame.name = fs::path(base).filename().string();
+  for(size_t i = 0; i < files.size(); i++)
+  {
+    int    w = 0, h = 0, comp = 0;
+    float* data = stbi_loadf(files[i].c_str(), &w, &h, &comp, 3);
+    if(data == nullptr || (i > 0 && (w != frame.width || h != frame.height)))
+    {
+      LOGW("Batch: skipping %s, cannot read %s\n", frame.name.c_str(), files[i].c_str());
+      stbi_image_free(data);
+      return false;
+    }
+    const size_t nb_values = static_cast<size_t>(w) * h * 3;
+    if(i == 0)
+    {
+      frame.width  = w;
+      frame.height = h;
+      try
+      {
+        frame.reserve(nb_values * sizeof(float));
+      }
+      catch(const std::runtime_error& e)
+      {
+        LOGW("Batch: skipping %s, %s\n", frame.name.c_str(), e.what());
+        stbi_image_free(data);
+        return false;
+      }
+    }
+    if(i == 2)
+    {
+      for(size_t v = 0; v < nb_values; v++)
+        frame.pixels[i][v] = data[v] * 2.F - 1.F;
+    }
+    else
+    {
+      memcpy(frame.pixels[i], data, nb_values * sizeof(float));
+    }
+    stbi_image_free(data);
+  }
+  return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Reader thread -> (load queue) -> upload, denoise, download -> (write queue) -> writer thread.
+// The frames come from a pool, bounding the memory: the reader waits for a frame to be written
+// before loading a new one.
+//
+int runBatchDenoise(nvvk::Context& context, const BatchConfig& config)
+{
+  std::vector<fs::path> color_files;
+  std::error_code       ec;
+  for(fs::directory_iterator it(config.inputDir, ec), end; !ec && it != end; it.increment(ec))
+  {
+    const std::string name = it->path().filename().string();
+    if(name.size() > 10 && name.compare(name.size() - 10, 10, "_color.hdr") == 0)
+      color_files.push_back(it->path());
+  }
+  if(ec)
+  {
+    LOGE("Batch: cannot read the directory %s: %s\n", config.inputDir.c_str(), ec.message().c_str());
+    return 1;
+  }
+  if(color_files.empty())
+  {
+    LOGE("Batch: no *_color.hdr image in %s\n", config.inputDir.c_str());
+    return 1;
+  }
+  std::sort(color_files.begin(), color_files.end());
+  fs::create_directories(config.outputDir, ec);
+  if(ec)
+  {
+    LOGE("Batch: cannot create the directory %s: %s\n", config.outputDir.c_str(), ec.message().c_str());
+    return 1;
+  }
+  LOGI("Batch: %zu images to denoise in %s\n", color_files.size(), config.inputDir.c_str());
+
+  // The interop buffers are filled from the host, FLOAT3 is the layout of the images read
+  DenoiserOptix denoiser;
+  try
+  {
+    denoiser.initOffline(context);
+  }
+  catch(const std::runtime_error& e)
+  {
+    LOGE("Batch: cannot create the denoiser: %s\n", e.what());
+    return 1;
+  }
+
+  // Two frames are on the GPU (one uploading while the previous is denoised), the others in the queues
+  const size_t            queue_size = static_cast<size_t>(config.queueSize);
+  std::vector<BatchFrame> frames(2 * queue_size + 2);
+  for(auto& f : frames)
+    CUDA_CHECK(cudaEventCreateWithFlags(&f.done, cudaEventDisableTiming));
+  BoundedQueue<BatchFrame*> free_queue(frames.size());
+  BoundedQueue<BatchFrame*> load_queue(queue_size);
+  BoundedQueue<BatchFrame*> write_queue(queue_size);
+  for(auto& f : frames)
+    free_queue.push(&f);
+
+  std::atomic<bool> failed = false;  // Denoising failed: the reader stops
+  std::thread       reader([&] {
+    for(const auto& file : color_files)
+    {
+      BatchFrame* frame = nullptr;
+      free_queue.pop(frame);
+      if(failed)
+        break;
+      if(loadFrame(file, *frame))
+        load_queue.push(frame);
+      else
+        free_queue.push(frame);
+    }
+    load_queue.close();
+  });
+
+  int         nb_written = 0;
+  std::thread writer([&] {
+    BatchFrame* frame = nullptr;
+    while(write_queue.pop(frame))
+    {
+      const std::string out = (fs::path(config.outputDir) / (frame->name + "_denoised.hdr")).string();
+      if(stbi_write_hdr(out.c_str(), frame->width, frame->height, 3, frame->pixels[3]) != 0)
+        nb_written++;
+      else
+        LOGE("Batch: cannot write %s\n", out.c_str());
+      free_queue.push(frame);
+    }
+  });
+
+  // Denoising, the result of a frame is handed to the writer once the next one is enqueued
+  uint64_t                fence_value = 0;  // See initOffline
+  VkExtent2D              size{};
+  std::deque<BatchFrame*> in_flight;
+  BatchFrame*             frame = nullptr;
+  try
+  {
+    while(load_queue.pop(frame))
+    {
+      const VkExtent2D frame_size{static_cast<uint32_t>(frame->width), static_cast<uint32_t>(frame->height)};
+      if(frame_size.width != size.width || frame_size.height != size.height)
+      {
+        size = frame_size;
+        denoiser.allocateBuffers(size);  // Waits for the frames in flight
+      }
+
+      denoiser.uploadInputs({frame->pixels[0], frame->pixels[1], frame->pixels[2]});
+      denoiser.denoiseImageBuffer(fence_value);
+      denoiser.downloadOutput(frame->pixels[3]);
+      CUDA_CHECK(cudaEventRecord(frame->done, denoiser.getCudaStream()));
+      denoiser.nextSet();
+
+      in_flight.push_back(frame);
+      if(in_flight.size() > 1)
+      {
+        CUDA_CHECK(cudaEventSynchronize(in_flight.front()->done));
+        write_queue.push(in_flight.front());
+        in_flight.pop_front();
+      }
+    }
+    for(BatchFrame* f : in_flight)
+    {
+      CUDA_CHECK(cudaEventSynchronize(f->done));
+      write_queue.push(f);
+    }
+  }
+  catch(const std::runtime_error& e)
+  {
+    LOGE("Batch: denoising failed: %s\n", e.what());
+    failed = true;
+    while(load_queue.pop(frame))  // Letting the reader end
+      free_queue.push(frame);
+  }
+  write_queue.close();
+
+  reader.join();
+  writer.join();
+
+  for(auto& f : frames)
+  {
+    for(auto& p : f.pixels)
+    {
+      if(p != nullptr)
+        CUDA_CHECK(cudaFreeHost(p));
+    }
+    CUDA_CHECK(cudaEventDestroy(f.done));
+  }
+  denoiser.destroy();
+
+  LOGI("Batch: %d of %zu images written to %s\n", nb_written, color_files.size(), config.outputDir.c_str());
+  return failed || nb_written != static_cast<int>(color_files.size()) ? 1 : 0;
+}
+
+#else
+
+int runBatchDenoise(nvvk::Context& /*context*/, const BatchConfig& /*config*/)
+{
+  return 1;  // OptiX is not supported
+}
+
+#endif  // NVP_SUPPORTS_OPTIX7
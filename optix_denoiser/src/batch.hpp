@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////
+// Batch denoising of image sequences rendered by other tools, without the
+// renderer: no window, no ray tracing, only the denoiser and its interop buffers.
+// For each "<name>_color.hdr" of the input directory, "<name>_albedo.hdr" and
+// "<name>_normal.hdr" are the guides, and "<name>_denoised.hdr" is written to
+// the output directory.
+//
+// Radiance files cannot store negative values: the normals are encoded as
+// n * 0.5 + 0.5, in [0..1], and decoded to [-1..1] for the denoiser (as the
+// shader copying the G-Buffer normal does, cpy_to_buffer.comp).
+//
+// The images are streamed through bounded queues: a thread reads the files,
+// the main thread uploads and denoises them, and a thread writes the results,
+// so disk I/O overlaps with the work of the GPU.
+//
+// Command line (see main()):
+//   -batch_in <dir>     enables the batch mode, directory of the input images
+//   -batch_out <dir>    directory of the denoised images, the input directory by default
+//   -batch_queue <N>    images in flight between the stages (default 4)
+//////////////////////////////////////////////////////////////////////////
+
+#include <string>
+
+namespace nvvk {
+class Context;
+}
+
+struct BatchConfig
+{
+  std::string inputDir;  // Empty: no batch
+  std::string outputDir;
+  int         queueSize = 4;
+};
+
+// Reading the batch arguments; returns false if the batch mode is not requested
+bool parseBatchArgs(int argc, char** argv, BatchConfig& config);
+
+// Denoising all the images of the input directory; returns non-zero if one could not be denoised and written,
+// or if there is none
+int runBatchDenoise(nvvk::Context& context, const BatchConfig& config);
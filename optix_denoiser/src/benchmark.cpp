@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "benchmark.hpp"
+
+// Same order as the "Format" combo of the UI
+static constexpr std::array<const char*, 4> s_formatNames = {"RGBA32F", "RGBA16F", "RGB32F", "RGB16F"};
+
+//--------------------------------------------------------------------------------------------------
+// "1,10,100" -> {1, 10, 100}, invalid entries are skipped
+//
+static std::vector<int> parseIntList(const std::string& list)
+{
+  std::vector<int>  values;
+  std::stringstream ss(list);
+  std::string       item;
+  while(std::getline(ss, item, ','))
+  {
+    try
+    {
+      values.push_back(std::stoi(item));
+    }
+    catch(const std::exception&)
+    {
+    }
+  }
+  return values;
+}
+
+std::vector<BenchmarkRun> makeBenchmarkRuns(const BenchmarkConfig& config)
+{
+  std::vector<BenchmarkRun> runs;
+  for(const auto& scene : config.scenes)
+  {
+    for(int height : parseIntList(config.resolutions))
+    {
+      if(height <= 0)
+        continue;
+      VkExtent2D resolution{static_cast<uint32_t>(height * 16 / 9), static_cast<uint32_t>(height)};
+      for(int format : parseIntList(config.formats))
+      {
+        if(format < 0 || format >= static_cast<int>(s_formatNames.size()))
+          continue;
+        for(int interval : parseIntList(config.intervals))
+        {
+          if(interval <= 0)
+            continue;
+          BenchmarkRun run;
+          run.scene      = scene;
+          run.resolution = resolution;
+          run.format     = format;
+          run.interval   = interval;
+          runs.push_back(run);
+        }
+      }
+    }
+  }
+  return runs;
+}
+
+//--------------------------------------------------------------------------------------------------
+// The report is small and flat, it is written by hand
+//
+bool writeBenchmarkReport(const std::string& filename, const BenchmarkConfig& config, const std::vector<BenchmarkRun>& runs)
+{
+  std::ofstream out(filename);
+  if(!out.is_open())
+    return false;
+
+  auto quote = [](const std::string& s) {
+    std::string r = "\"";
+    for(char c : s)
+    {
+      if(c == '"' || c == '\\')
+        r += '\\';
+      r += c;
+    }
+    return r + "\"";
+  };
+
+  out << "{\n";
+  out << "  \"hdr\": " << quote(std::filesystem::path(config.hdr).filename().string()) << ",\n";
+  out << "  \"frames_per_run\": " << config.framesPerRun << ",\n";
+  out << "  \"runs\": [\n";
+  for(size_t i = 0; i < runs.size(); i++)
+  {
+    const BenchmarkRun& r = runs[i];
+    out << "    {";
+    out << "\"scene\": " << quote(std::filesystem::path(r.scene).filename().string()) << ", ";
+    out << "\"width\": " << r.resolution.width << ", \"height\": " << r.resolution.height << ", ";
+    out << "\"format\": " << quote(s_formatNames[r.format]) << ", ";
+    out << "\"denoise_interval\": " << r.interval << ", ";
+    out << "\"time_to_first_denoised_ms\": " << r.timeToFirstDenoisedMs << ", ";
+    out << "\"ms_per_frame\": " << r.msPerFrame << ", ";
+    out << "\"denoiser_ms\": " << r.denoiserMs << ", ";
+    out << "\"peak_vram_mb\": " << r.peakVramMb;
+    out << "}" << (i + 1 < runs.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n";
+  out << "}\n";
+  return true;
+}
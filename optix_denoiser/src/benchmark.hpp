@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////
+// Benchmark sweep: every scene is rendered at every resolution, with every
+// interop pixel format and every denoise interval, for a fixed number of frames.
+// The measures of each run are written to a JSON report.
+//
+// Command line (see main()):
+//   -benchmark_json <file>          enables the sweep and writes the report
+//   -benchmark_frames <N>           frames rendered by each run
+//   -benchmark_resolutions <list>   heights of the 16:9 resolutions, ex: "1080,1440,2160,4320"
+//   -benchmark_formats <list>       interop pixel formats, see denoiserPixelFormat(), ex: "0,1,2,3"
+//   -benchmark_intervals <list>     denoise every N frames, ex: "1,10,100"
+//////////////////////////////////////////////////////////////////////////
+
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+struct BenchmarkConfig
+{
+  std::string              jsonFile;      // Empty: no benchmark
+  std::vector<std::string> scenes;        // glTF files
+  std::string              hdr;           // Environment used by all runs
+  int                      framesPerRun = 200;
+  std::string              resolutions  = "1080,1440,2160,4320";
+  std::string              formats      = "0,1,2,3";
+  std::string              intervals    = "1,10,100";
+};
+
+struct BenchmarkRun
+{
+  // Configuration
+  std::string scene;
+  VkExtent2D  resolution{};
+  int         format   = 0;
+  int         interval = 1;
+
+  // Results, negative when not measured
+  double timeToFirstDenoisedMs = -1.0;  // From the first frame of the run to the first denoised image
+  double msPerFrame            = -1.0;  // Steady state: second half of the run
+  double denoiserMs            = -1.0;  // Intensity + invoke, average of the denoised frames
+  double peakVramMb            = -1.0;  // Vulkan heaps + memory allocated by the denoiser with CUDA
+};
+
+// All the combinations of the configuration
+std::vector<BenchmarkRun> makeBenchmarkRuns(const BenchmarkConfig& config);
+
+// Writing all runs to the JSON report
+bool writeBenchmarkReport(const std::string& filename, const BenchmarkConfig& config, const std::vector<BenchmarkRun>& runs);
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "blue_noise.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// The energy of a pixel is the sum of a Gaussian of its distance to all the points of the pattern: the tightest
+// cluster is the point with the highest energy, the largest void the empty pixel with the lowest.
+// 1. A random pattern of 10% of the pixels is relaxed, moving its tightest cluster to the largest void until stable
+// 2. Its points are ranked by removing the tightest cluster, one by one
+// 3. The other pixels are ranked by filling the largest void, one by one
+// The value of a pixel is its rank, normalized.
+//
+std::vector<float> makeBlueNoise(uint32_t size, uint32_t seed)
+{
+  const int   n      = static_cast<int>(size * size);
+  const int   w      = static_cast<int>(size);
+  const float sigma  = 1.5F;
+  const int   radius = std::min(w / 2 - 1, 8);  // Beyond, the Gaussian is under 1e-6
+
+  // Gaussian of the toroidal distance, indexed by the offset between two pixels
+  std::vector<float> kernel(n);
+  for(int y = 0; y < w; y++)
+  {
+    for(int x = 0; x < w; x++)
+    {
+      const int dx      = std::min(x, w - x);
+      const int dy      = std::min(y, w - y);
+      kernel[y * w + x] = std::exp(-static_cast<float>(dx * dx + dy * dy) / (2.F * sigma * sigma));
+    }
+  }
+
+  std::vector<uint8_t> pattern(n, 0);
+  std::vector<float>   energy(n, 0.F);
+  auto                 toggle = [&](int p) {
+    pattern[p]       = pattern[p] == 0 ? 1 : 0;
+    const float sign = pattern[p] != 0 ? 1.F : -1.F;
+    const int   px = p % w, py = p / w;
+    for(int dy = -radius; dy <= radius; dy++)
+    {
+      const int y = (py + dy + w) % w;
+      for(int dx = -radius; dx <= radius; dx++)
+        energy[y * w + (px + dx + w) % w] += sign * kernel[((dy + w) % w) * w + (dx + w) % w];
+    }
+  };
+  auto tightestCluster = [&] {
+    int best = -1;
+    for(int p = 0; p < n; p++)
+    {
+      if(pattern[p] != 0 && (best < 0 || energy[p] > energy[best]))
+        best = p;
+    }
+    return best;
+  };
+  auto largestVoid = [&] {
+    int best = -1;
+    for(int p = 0; p < n; p++)
+    {
+      if(pattern[p] == 0 && (best < 0 || energy[p] < energy[best]))
+        best = p;
+    }
+    return best;
+  };
+
+  // 1. Initial pattern, relaxed (bounded, in case it cycles)
+  std::mt19937 rng(seed);
+  const int    nb_points = std::max(n / 10, 1);
+  for(int count = 0; count < nb_points;)
+  {
+    const int p = static_cast<int>(rng() % static_cast<uint32_t>(n));
+    if(pattern[p] == 0)
+    {
+      toggle(p);
+      count++;
+    }
+  }
+  for(int i = 0; i < n; i++)
+  {
+    const int cluster = tightestCluster();
+    toggle(cluster);
+    const int hole = largestVoid();
+    toggle(hole);
+    if(hole == cluster)
+      break;
+  }
+  const std::vector<uint8_t> initial_pattern = pattern;
+  const std::vector<float>   initial_energy  = energy;
+
+  // 2. Ranking the points of the initial pattern
+  std::vector<int> rank(n, 0);
+  for(int r = nb_points - 1; r >= 0; r--)
+  {
+    const int cluster = tightestCluster();
+    toggle(cluster);
+    rank[cluster] = r;
+  }
+
+  // 3. Ranking the other pixels
+  pattern = initial_pattern;
+  energy  = initial_energy;
+  for(int r = nb_points; r < n; r++)
+  {
+    const int hole = largestVoid();
+    toggle(hole);
+    rank[hole] = r;
+  }
+
+  std::vector<float> values(n);
+  for(int p = 0; p < n; p++)
+    values[p] = (static_cast<float>(rank[p]) + 0.5F) / static_cast<float>(n);
+  return values;
+}
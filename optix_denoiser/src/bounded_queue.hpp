@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+// Blocking queue of bounded size: push waits while full, pop waits while empty and returns false once closed
+template <typename T>
+class BoundedQueue
+{
+public:
+  explicit BoundedQueue(size_t capacity)
+      : m_capacity(capacity)
+  {
+  }
+
+  void push(T value)
+  {
+    std::unique_lock lock(m_mutex);
+    m_notFull.wait(lock, [&] { return m_items.size() < m_capacity; });
+    m_items.push_back(std::move(value));
+    m_notEmpty.notify_one();
+  }
+
+  bool pop(T& value)
+  {
+    std::unique_lock lock(m_mutex);
+    m_notEmpty.wait(lock, [&] { return !m_items.empty() || m_closed; });
+    if(m_items.empty())
+      return false;
+    value = std::move(m_items.front());
+    m_items.pop_front();
+    m_notFull.notify_one();
+    return true;
+  }
+
+  // Not waiting: false if the queue is empty
+  bool tryPop(T& value)
+  {
+    std::lock_guard lock(m_mutex);
+    if(m_items.empty())
+      return false;
+    value = std::move(m_items.front());
+    m_items.pop_front();
+    m_notFull.notify_one();
+    return true;
+  }
+
+  void close()
+  {
+    std::lock_guard lock(m_mutex);
+    m_closed = true;
+    m_notEmpty.notify_all();
+  }
+
+private:
+  std::mutex              m_mutex;
+  std::condition_variable m_notFull;
+  std::condition_variable m_notEmpty;
+  std::deque<T>           m_items;
+  size_t                  m_capacity;
+  bool                    m_closed = false;
+};
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifdef NVP_SUPPORTS_OPTIX7
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/packing.hpp>
+
+#include "capture.hpp"
+#include "stb_image_write.h"
+
+//--------------------------------------------------------------------------------------------------
+// Ring of 'ringSize' host buffers, allocated on the first capture, and 'nbThreads' encoding threads
+//
+void FrameCapture::init(uint32_t ringSize, uint32_t nbThreads)
+{
+  CUDA_CHECK(cudaStreamCreateWithFlags(&m_stream, cudaStreamNonBlocking));
+
+  m_slots.resize(std::max(ringSize, 1U));
+  m_free = std::make_unique<BoundedQueue<Slot*>>(m_slots.size());
+  m_jobs = std::make_unique<BoundedQueue<Slot*>>(m_slots.size());
+  for(auto& slot : m_slots)
+  {
+    CUDA_CHECK(cudaEventCreateWithFlags(&slot.done, cudaEventDisableTiming));
+    m_free->push(&slot);
+  }
+
+  for(uint32_t t = 0; t < std::max(nbThreads, 1U); t++)
+  {
+    m_workers.emplace_back([this] {
+      Slot* slot = nullptr;
+      while(m_jobs->pop(slot))
+      {
+        try
+        {
+          CUDA_CHECK(cudaEventSynchronize(slot->done));
+          encode(*slot);
+          m_nbSaved++;
+        }
+        catch(const std::exception& e)
+        {
+          std::cout << e.what() << std::endl;
+        }
+        m_free->push(slot);
+      }
+    });
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//
+void FrameCapture::destroy()
+{
+  if(m_jobs == nullptr)
+    return;
+
+  m_jobs->close();
+  for(auto& w : m_workers)
+    w.join();
+  m_workers.clear();
+
+  for(auto& slot : m_slots)
+  {
+    if(slot.host != nullptr)
+      CUDA_CHECK(cudaFreeHost(slot.host));
+    CUDA_CHECK(cudaEventDestroy(slot.done));
+  }
+  m_slots.clear();
+  m_free.reset();
+  m_jobs.reset();
+
+  CUDA_CHECK(cudaStreamDestroy(m_stream));
+  m_stream = nullptr;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Enqueuing the copy of the denoised buffer and handing it to the workers. Waits only if no buffer
+// of the ring is free, which is counted as a stall.
+//
+void FrameCapture::capture(DenoiserOptix& denoiser, const std::string& filename, Format format)
+{
+  Slot* slot = nullptr;
+  if(!m_free->tryPop(slot))
+  {
+    m_nbStalls++;
+    m_free->pop(slot);
+  }
+
+  const size_t bytes = denoiser.getOutputBytes();
+  if(slot->capacity < bytes)
+  {
+    if(slot->host != nullptr)
+      CUDA_CHECK(cudaFreeHost(slot->host));
+    CUDA_CHECK(cudaHostAlloc(&slot->host, bytes, cudaHostAllocPortable));
+    slot->capacity = bytes;
+  }
+  slot->size       = denoiser.getOutputSize();
+  slot->format     = denoiser.getPixelFormat();
+  slot->fileFormat = format;
+  slot->filename   = filename;
+
+  denoiser.readbackOutput(slot->host, m_stream, slot->done);
+  m_jobs->push(slot);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Converting the pixels of the interop format (RGB or RGBA, 16 or 32-bit floats) and writing the file
+//
+void FrameCapture::encode(const Slot& slot)
+{
+  const bool   half        = slot.format == OPTIX_PIXEL_FORMAT_HALF3 || slot.format == OPTIX_PIXEL_FORMAT_HALF4;
+  const bool   rgba        = slot.format == OPTIX_PIXEL_FORMAT_FLOAT4 || slot.format == OPTIX_PIXEL_FORMAT_HALF4;
+  const size_t nb_channels = rgba ? 4 : 3;
+  const size_t nb_pixels   = static_cast<size_t>(slot.size.width) * slot.size.height;
+  const int    w           = static_cast<int>(slot.size.width);
+  const int    h           = static_cast<int>(slot.size.height);
+
+  auto value = [&](size_t pixel, size_t c) -> float {
+    size_t i = pixel * nb_channels + c;
+    return half ? glm::unpackHalf1x16(static_cast<const uint16_t*>(slot.host)[i]) : static_cast<const float*>(slot.host)[i];
+  };
+
+  int ok = 0;
+  if(slot.fileFormat == eHdr)
+  {
+    std::vector<float> rgb(nb_pixels * 3);
+    for(size_t p = 0; p < nb_pixels; p++)
+      for(size_t c = 0; c < 3; c++)
+        rgb[p * 3 + c] = value(p, c);
+    ok = stbi_write_hdr(slot.filename.c_str(), w, h, 3, rgb.data());
+  }
+  else
+  {
+    std::vector<uint8_t> rgba8(nb_pixels * 4, 255);
+    for(size_t p = 0; p < nb_pixels; p++)
+      for(size_t c = 0; c < 3; c++)
+        rgba8[p * 4 + c] = static_cast<uint8_t>(std::pow(std::clamp(value(p, c), 0.0F, 1.0F), 1.0F / 2.2F) * 255.0F + 0.5F);
+    ok = stbi_write_png(slot.filename.c_str(), w, h, 4, rgba8.data(), w * 4);
+  }
+  if(ok == 0)
+    std::cerr << "Cannot write " << slot.filename << "\n";
+}
+
+#endif  // NVP_SUPPORTS_OPTIX7
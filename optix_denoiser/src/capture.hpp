@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#ifdef NVP_SUPPORTS_OPTIX7
+
+//////////////////////////////////////////////////////////////////////////
+// Saving the denoised frames to disk without stalling the frame.
+// The interop output buffer is copied with CUDA, on a stream of its own,
+// into a ring of pinned host buffers. Worker threads wait for the copies
+// and encode the images (PNG or HDR), then give the buffers back to the ring.
+// The frame only waits when all the buffers of the ring are still in use.
+//////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.hpp"
+#include "denoiser.hpp"
+
+class FrameCapture
+{
+public:
+  enum Format
+  {
+    ePng,  // Clamped and gamma corrected, 8-bit
+    eHdr,  // Radiance RGBE, linear
+  };
+
+  void init(uint32_t ringSize, uint32_t nbThreads);
+  void destroy();  // Finishes the pending saves
+
+  // Reading back the result of the denoise just enqueued on the current set of the denoiser
+  void capture(DenoiserOptix& denoiser, const std::string& filename, Format format);
+
+  uint32_t getSavedCount() const { return m_nbSaved; }
+  uint32_t getStallCount() const { return m_nbStalls; }  // Captures which waited for a buffer of the ring
+
+private:
+  struct Slot
+  {
+    void*            host       = nullptr;  // Pinned memory
+    size_t           capacity   = 0;
+    cudaEvent_t      done       = {};  // Copy to 'host' completed
+    VkExtent2D       size       = {};
+    OptixPixelFormat format     = {};
+    Format           fileFormat = ePng;
+    std::string      filename;
+  };
+
+  void encode(const Slot& slot);
+
+  CUstream                             m_stream = {};
+  std::vector<Slot>                    m_slots;
+  std::unique_ptr<BoundedQueue<Slot*>> m_free;  // Buffers of the ring not in use
+  std::unique_ptr<BoundedQueue<Slot*>> m_jobs;  // Copies enqueued, to be encoded
+  std::vector<std::thread>             m_workers;
+  std::atomic<uint32_t>                m_nbSaved  = {};
+  uint32_t                             m_nbStalls = {};
+};
+
+#endif  // NVP_SUPPORTS_OPTIX7
@@ -0,0 +1,662 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "denoise_service.hpp"
+
+bool parseServiceArgs(int argc, char** argv, ServiceConfig& config)
+{
+  for(int i = 1; i + 1 < argc; i++)
+  {
+    std::string arg = argv[i];
+    if(arg == "-service")
+      config.socketPath = argv[++i];
+    else if(arg == "-service_port")
+      config.port = std::max(0, std::atoi(argv[++i]));
+    else if(arg == "-service_batch")
+      config.maxBatch = std::max(1, std::atoi(argv[++i]));
+    else if(arg == "-service_max_pixels")
+      config.maxPixels = std::max(1LL, std::atoll(argv[++i]));
+    else if(arg == "-service_timeout")
+      config.timeoutMs = std::max(0, std::atoi(argv[++i]));
+  }
+  return !config.socketPath.empty();
+}
+
+#if defined(NVP_SUPPORTS_OPTIX7) && !defined(WIN32)
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "nvh/nvprint.hpp"
+#include "nvvk/context_vk.hpp"
+
+#include "denoiser.hpp"
+#include "frame_codec.hpp"
+
+using ServiceClock = std::chrono::steady_clock;
+
+// A connected renderer, with what it attached (same node) or its pinned staging (remote)
+struct ServiceClient
+{
+  enum State
+  {
+    eReadHeader,   // Receiving a ServiceRequest
+    eReadPayload,  // Receiving the pixels of eServiceDenoiseFrame, raw or encoded
+    eWaitInputs,   // eServiceDenoiseShared, until the semaphore reaches waitValue
+    eQueued,       // Ready to be denoised in the next batch
+    eSendReply,    // Sending the ServiceReply, and the output of eServiceDenoiseFrame
+  };
+
+  int                      fd      = -1;
+  bool                     local   = false;  // Unix socket: can pass FDs
+  bool                     alive   = true;
+  bool                     closing = false;  // Dropped once the reply is sent
+  State                    state   = eReadHeader;
+  ServiceRequest           request;
+  std::vector<int>         handles;          // FDs received with the request
+  size_t                   transferred = 0;  // Bytes of the message in progress, received or sent
+  ServiceClock::time_point waitStart;
+  ServiceClock::time_point queuedAt;  // The oldest requests are batched first
+
+  VkExtent2D              size{};  // Of the attached block
+  cudaExternalMemory_t    memory    = nullptr;
+  float*                  block     = nullptr;  // Color, albedo, normal, output
+  cudaExternalSemaphore_t semaphore = nullptr;  // Waited and signaled on the denoiser stream
+  VkSemaphore             timeline  = VK_NULL_HANDLE;  // Same semaphore, read by the host (eWaitInputs)
+
+  float*               pixels   = nullptr;  // Pinned: color, albedo, normal, output of eServiceDenoiseFrame
+  size_t               capacity = 0;
+  std::vector<uint8_t> encoded;  // eServiceEncodingHalf: the payload received, then the output sent
+  ServiceReply         reply;
+  size_t               replyBytes = 0;  // Reply and output
+
+  void closeHandles()
+  {
+    for(int h : handles)
+      close(h);
+    handles.clear();
+  }
+
+  void detach(VkDevice device)  // The denoiser must be done with the block
+  {
+    if(semaphore != nullptr)
+      CUDA_CHECK(cudaDestroyExternalSemaphore(semaphore));
+    if(memory != nullptr)
+      CUDA_CHECK(cudaDestroyExternalMemory(memory));  // Also unmaps the block
+    vkDestroySemaphore(device, timeline, nullptr);
+    semaphore = nullptr;
+    memory    = nullptr;
+    block     = nullptr;
+    timeline  = VK_NULL_HANDLE;
+  }
+
+  void destroy(VkDevice device)
+  {
+    try
+    {
+      detach(device);
+      if(pixels != nullptr)
+        CUDA_CHECK(cudaFreeHost(pixels));
+    }
+    catch(const std::runtime_error& e)
+    {
+      LOGE("Service: %s\n", e.what());
+    }
+    pixels = nullptr;
+    closeHandles();
+    close(fd);
+  }
+};
+
+struct ServiceJob
+{
+  ServiceClient* client;
+  ServiceRequest request;
+};
+
+static size_t imageFloats(uint32_t width, uint32_t height)
+{
+  return static_cast<size_t>(width) * height * 3;
+}
+
+// Bytes following an eServiceDenoiseFrame request
+static size_t payloadBytes(const ServiceRequest& request)
+{
+  if(request.encoding == eServiceEncodingHalf)
+    return static_cast<size_t>(request.payloadBytes);
+  return 3 * imageFloats(request.width, request.height) * sizeof(float);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Receiving what is available without blocking, the FDs passed along are added to 'handles'.
+// Returns the bytes received, 0 if there is nothing to read yet, -1 if the connection is closed or broken.
+//
+static ssize_t receiveSome(int fd, void* data, size_t bytes, std::vector<int>& handles)
+{
+  alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))] = {};
+  iovec                 io{data, bytes};
+  msghdr                msg{};
+  msg.msg_iov        = &io;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t n          = recvmsg(fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  if(n < 0)
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+
+  for(cmsghdr* c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c))
+  {
+    if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS)
+    {
+      const int* fds = reinterpret_cast<const int*>(CMSG_DATA(c));
+      handles.insert(handles.end(), fds, fds + (c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    }
+  }
+  if(n == 0 || (msg.msg_flags & MSG_CTRUNC) != 0)
+    return -1;  // Closed, or more FDs than a request can carry
+  return n;
+}
+
+static ssize_t sendSome(int fd, const void* data, size_t bytes)
+{
+  ssize_t n = send(fd, data, bytes, MSG_DONTWAIT | MSG_NOSIGNAL);  // A client gone must not kill the service
+  if(n < 0)
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+  return n;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Importing the exported block and timeline semaphore of a client, replacing the previous ones.
+// The FDs are owned by CUDA and Vulkan on success, closed otherwise.
+//
+static bool attach(VkDevice device, ServiceClient& client)
+{
+  const ServiceRequest& request     = client.request;
+  const size_t          block_bytes = 4 * imageFloats(request.width, request.height) * sizeof(float);
+  if(!client.local || client.handles.size() != 2 || request.memoryBytes < block_bytes)
+    return false;
+
+  client.detach(device);
+  const int memory_fd    = client.handles[0];
+  const int semaphore_fd = client.handles[1];
+  int       host_fd      = dup(semaphore_fd);  // The host reads the value from Vulkan, see eWaitInputs
+  client.handles.clear();
+  try
+  {
+    VkSemaphoreTypeCreateInfo timeline_info{.sType         = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+                                            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE};
+    VkSemaphoreCreateInfo     sci{.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, .pNext = &timeline_info};
+    VkImportSemaphoreFdInfoKHR import_info{.sType      = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR,
+                                           .handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT,
+                                           .fd         = host_fd};
+    if(host_fd < 0 || vkCreateSemaphore(device, &sci, nullptr, &client.timeline) != VK_SUCCESS)
+      throw std::runtime_error("cannot create the host semaphore");
+    import_info.semaphore = client.timeline;
+    if(vkImportSemaphoreFdKHR(device, &import_info) != VK_SUCCESS)
+      throw std::runtime_error("cannot import the semaphore in Vulkan");
+    host_fd = -1;
+
+    cudaExternalMemoryHandleDesc mem_desc{};
+    mem_desc.type      = cudaExternalMemoryHandleTypeOpaqueFd;
+    mem_desc.handle.fd = memory_fd;
+    mem_desc.size      = request.memoryBytes;
+    CUDA_CHECK(cudaImportExternalMemory(&client.memory, &mem_desc));
+
+    cudaExternalMemoryBufferDesc buffer_desc{};
+    buffer_desc.size = block_bytes;
+    CUDA_CHECK(cudaExternalMemoryGetMappedBuffer(reinterpret_cast<void**>(&client.block), client.memory, &buffer_desc));
+
+    cudaExternalSemaphoreHandleDesc sem_desc{};
+    sem_desc.type      = cudaExternalSemaphoreHandleTypeTimelineSemaphoreFd;
+    sem_desc.handle.fd = semaphore_fd;
+    CUDA_CHECK(cudaImportExternalSemaphore(&client.semaphore, &sem_desc));
+  }
+  catch(const std::runtime_error& e)
+  {
+    LOGE("Service: cannot attach the client: %s\n", e.what());
+    if(host_fd >= 0)
+      close(host_fd);
+    if(client.memory == nullptr)
+      close(memory_fd);
+    if(client.semaphore == nullptr)
+      close(semaphore_fd);
+    client.detach(device);
+    return false;
+  }
+  client.size = {request.width, request.height};
+  return true;
+}
+
+static void setQueued(ServiceClient& client)
+{
+  client.state    = ServiceClient::eQueued;
+  client.queuedAt = ServiceClock::now();
+}
+
+static void queueReply(ServiceClient& client, int32_t status, size_t outputBytes)
+{
+  client.reply.status       = status;
+  client.reply.payloadBytes = outputBytes;
+  client.replyBytes         = sizeof(ServiceReply) + outputBytes;
+  client.transferred  = 0;
+  client.state        = ServiceClient::eSendReply;
+}
+
+//--------------------------------------------------------------------------------------------------
+// A complete request header: validating it, then reading its payload or waiting for its inputs.
+// Returns false if the client must be dropped.
+//
+static bool startRequest(VkDevice device, const ServiceConfig& config, ServiceClient& client)
+{
+  const ServiceRequest& request = client.request;
+  const bool valid = request.magic == kServiceMagic && request.width > 0 && request.height > 0 && request.width <= kServiceMaxSize
+                     && request.height <= kServiceMaxSize
+                     && static_cast<int64_t>(request.width) * request.height <= config.maxPixels;
+  if(!valid)
+  {
+    LOGW("Service: invalid request (type %u, %u x %u)\n", request.type, request.width, request.height);
+    return false;
+  }
+
+  if(request.type == eServiceAttach)
+  {
+    bool ok = attach(device, client);
+    queueReply(client, ok ? 0 : -1, 0);
+    client.closing = !ok;
+    return true;
+  }
+  client.closeHandles();  // Only expected with eServiceAttach
+
+  if(request.type == eServiceDenoiseShared)
+  {
+    if(client.block == nullptr || client.size.width != request.width || client.size.height != request.height)
+      return false;
+    client.state     = ServiceClient::eWaitInputs;
+    client.waitStart = ServiceClock::now();
+    return true;
+  }
+  if(request.type == eServiceDenoiseFrame)
+  {
+    const bool encoded = request.encoding == eServiceEncodingHalf;
+    if((!encoded && request.encoding != eServiceEncodingFloat3)
+       || (encoded && (request.payloadBytes == 0 || request.payloadBytes > maxEncodedFrameBytes(3, request.width, request.height))))
+    {
+      LOGW("Service: invalid frame payload (encoding %u, %llu bytes)\n", request.encoding,
+           static_cast<unsigned long long>(request.payloadBytes));
+      return false;
+    }
+    if(encoded)
+      client.encoded.resize(request.payloadBytes);
+
+    const size_t bytes = 4 * imageFloats(request.width, request.height) * sizeof(float);
+    if(bytes > client.capacity)
+    {
+      // The previous staging is not in use: the frames of a client are denoised and sent one at a time
+      float* pixels = nullptr;
+      CUDA_CHECK(cudaHostAlloc((void**)&pixels, bytes, cudaHostAllocPortable));
+      if(client.pixels != nullptr)
+        CUDA_CHECK(cudaFreeHost(client.pixels));
+      client.pixels   = pixels;
+      client.capacity = bytes;
+    }
+    client.state       = ServiceClient::eReadPayload;
+    client.transferred = 0;
+    return true;
+  }
+  return false;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Reading what the client has sent so far; returns false if the client must be dropped
+//
+static bool readClient(VkDevice device, const ServiceConfig& config, ServiceClient& client)
+{
+  while(client.state == ServiceClient::eReadHeader || client.state == ServiceClient::eReadPayload)
+  {
+    const bool header  = client.state == ServiceClient::eReadHeader;
+    const bool encoded = !header && client.request.encoding == eServiceEncodingHalf;
+    char*      data    = header  ? reinterpret_cast<char*>(&client.request) :
+                         encoded ? reinterpret_cast<char*>(client.encoded.data()) :
+                                   reinterpret_cast<char*>(client.pixels);
+    size_t     total   = header ? sizeof(ServiceRequest) : payloadBytes(client.request);
+    ssize_t    n       = receiveSome(client.fd, data + client.transferred, total - client.transferred, client.handles);
+    if(n < 0)
+      return false;
+    if(n == 0)
+      return true;  // The rest comes later
+    client.transferred += static_cast<size_t>(n);
+    if(client.transferred < total)
+      continue;
+
+    client.transferred = 0;
+    if(header)
+    {
+      if(!startRequest(device, config, client))
+        return false;
+    }
+    else if(encoded && !decodeFrame(client.encoded.data(), client.encoded.size(), 3, client.request.width,
+                                    client.request.height, client.pixels))
+    {
+      LOGW("Service: invalid encoded frame\n");
+      return false;
+    }
+    else
+    {
+      setQueued(client);
+    }
+  }
+  return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Sending what the socket accepts of the reply; returns false if the client must be dropped
+//
+static bool writeClient(ServiceClient& client)
+{
+  while(client.transferred < client.replyBytes)
+  {
+    const size_t n_out  = imageFloats(client.request.width, client.request.height);
+    const char*  output = client.request.encoding == eServiceEncodingHalf ?
+                              reinterpret_cast<const char*>(client.encoded.data()) :
+                              reinterpret_cast<const char*>(client.pixels + 3 * n_out);
+    const char*  data   = client.transferred < sizeof(ServiceReply) ?
+                              reinterpret_cast<const char*>(&client.reply) + client.transferred :
+                              output + (client.transferred - sizeof(ServiceReply));
+    const size_t bytes = client.transferred < sizeof(ServiceReply) ? sizeof(ServiceReply) - client.transferred :
+                                                                      client.replyBytes - client.transferred;
+    ssize_t n = sendSome(client.fd, data, bytes);
+    if(n < 0)
+      return false;
+    if(n == 0)
+      return true;  // Socket full, the rest is sent later
+    client.transferred += static_cast<size_t>(n);
+  }
+  client.state       = ServiceClient::eReadHeader;
+  client.transferred = 0;
+  return !client.closing;  // A refused attach ends the connection once answered
+}
+
+static int listenOn(int domain, const sockaddr* addr, socklen_t addrLen)
+{
+  int fd  = socket(domain, SOCK_STREAM, 0);
+  int yes = 1;
+  if(fd >= 0 && domain == AF_INET)
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  if(fd < 0 || bind(fd, addr, addrLen) != 0 || listen(fd, 16) != 0)
+  {
+    if(fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Enqueuing the denoise of a request on the denoiser stream
+//
+static void enqueueJob(DenoiserOptix& denoiser, uint64_t& fenceValue, const ServiceJob& job)
+{
+  const size_t n = imageFloats(job.request.width, job.request.height);
+  if(job.request.type == eServiceDenoiseShared)
+  {
+    // The semaphore is already at waitValue (eWaitInputs): the wait does not hold the stream
+    cudaExternalSemaphoreWaitParams wait_params{};
+    wait_params.params.fence.value = job.request.waitValue;
+    CUDA_CHECK(cudaWaitExternalSemaphoresAsync(&job.client->semaphore, &wait_params, 1, denoiser.getCudaStream()));
+    float* block = job.client->block;
+    denoiser.uploadInputs({block, block + n, block + 2 * n});  // Device to device
+    denoiser.denoiseImageBuffer(fenceValue);
+    denoiser.downloadOutput(block + 3 * n);
+    cudaExternalSemaphoreSignalParams signal_params{};
+    signal_params.params.fence.value = job.request.signalValue;
+    CUDA_CHECK(cudaSignalExternalSemaphoresAsync(&job.client->semaphore, &signal_params, 1, denoiser.getCudaStream()));
+  }
+  else
+  {
+    float* pixels = job.client->pixels;
+    denoiser.uploadInputs({pixels, pixels + n, pixels + 2 * n});
+    denoiser.denoiseImageBuffer(fenceValue);
+    denoiser.downloadOutput(pixels + 3 * n);
+  }
+  denoiser.nextSet();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Polling the sockets -> requests complete and with their inputs ready -> batch sorted by size ->
+// denoise on the single stream -> replies once the whole batch is done.
+//
+int runDenoiseService(nvvk::Context& context, const ServiceConfig& config)
+{
+  // Listening: Unix socket for the clients of this node, TCP for the others
+  std::vector<std::pair<int, bool>> listeners;  // FD, local
+  sockaddr_un                       unix_addr{};
+  unix_addr.sun_family = AF_UNIX;
+  if(config.socketPath.size() >= sizeof(unix_addr.sun_path))
+  {
+    LOGE("Service: socket path too long %s\n", config.socketPath.c_str());
+    return 1;
+  }
+  std::strncpy(unix_addr.sun_path, config.socketPath.c_str(), sizeof(unix_addr.sun_path) - 1);
+  unlink(config.socketPath.c_str());  // Left by a previous run
+  listeners.push_back({listenOn(AF_UNIX, reinterpret_cast<sockaddr*>(&unix_addr), sizeof(unix_addr)), true});
+  if(config.port > 0)
+  {
+    sockaddr_in tcp_addr{};
+    tcp_addr.sin_family      = AF_INET;
+    tcp_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    tcp_addr.sin_port        = htons(static_cast<uint16_t>(config.port));
+    listeners.push_back({listenOn(AF_INET, reinterpret_cast<sockaddr*>(&tcp_addr), sizeof(tcp_addr)), false});
+  }
+  for(const auto& [fd, local] : listeners)
+  {
+    if(fd < 0)
+    {
+      LOGE("Service: cannot listen on %s\n", local ? config.socketPath.c_str() : std::to_string(config.port).c_str());
+      for(const auto& l : listeners)
+        close(l.first);
+      return 1;
+    }
+  }
+
+  // FLOAT3 is the layout of the client images
+  const VkDevice device = context.m_device;
+  DenoiserOptix  denoiser;
+  denoiser.initOffline(context);
+  LOGI("Service: listening on %s, port %d\n", config.socketPath.c_str(), config.port);
+
+  std::vector<std::unique_ptr<ServiceClient>> clients;
+  std::vector<ServiceJob>                     jobs;
+  std::vector<pollfd>                         poll_fds;
+  uint64_t   fence_value = 0;  // See initOffline
+  VkExtent2D size{};
+  while(true)
+  {
+    // Reading the clients receiving a request, writing those sending a reply, checking the waiting ones often.
+    // Requests left out of the previous batch are denoised without waiting for the sockets.
+    bool waiting = false;
+    bool queued  = false;
+    poll_fds.clear();
+    for(const auto& [fd, local] : listeners)
+      poll_fds.push_back({fd, POLLIN, 0});
+    for(const auto& c : clients)
+    {
+      short events = 0;
+      if(c->state == ServiceClient::eReadHeader || c->state == ServiceClient::eReadPayload)
+        events = POLLIN;
+      else if(c->state == ServiceClient::eSendReply)
+        events = POLLOUT;
+      waiting = waiting || c->state == ServiceClient::eWaitInputs;
+      queued  = queued || c->state == ServiceClient::eQueued;
+      poll_fds.push_back({c->fd, events, 0});
+    }
+    if(poll(poll_fds.data(), poll_fds.size(), queued ? 0 : (waiting ? 1 : -1)) < 0 && errno != EINTR)
+    {
+      LOGE("Service: poll failed (%d)\n", errno);
+      break;
+    }
+
+    for(size_t i = 0; i < listeners.size(); i++)
+    {
+      if((poll_fds[i].revents & POLLIN) == 0)
+        continue;
+      int fd = accept(listeners[i].first, nullptr, nullptr);
+      if(fd < 0)
+        continue;
+      auto client   = std::make_unique<ServiceClient>();
+      client->fd    = fd;
+      client->local = listeners[i].second;
+      clients.push_back(std::move(client));
+    }
+
+    // Progress of each client, an error only drops the client concerned
+    const auto now = ServiceClock::now();
+    for(size_t i = listeners.size(); i < poll_fds.size(); i++)
+    {
+      ServiceClient& client  = *clients[i - listeners.size()];
+      const short    revents = poll_fds[i].revents;
+      try
+      {
+        if((revents & (POLLERR | POLLNVAL)) != 0)
+          client.alive = false;
+        else if((revents & POLLOUT) != 0)
+          client.alive = writeClient(client);
+        else if((revents & POLLIN) != 0)
+          client.alive = readClient(device, config, client);  // Also sees the end of the connection
+        else if((revents & POLLHUP) != 0)
+          client.alive = false;
+
+        if(client.alive && client.state == ServiceClient::eWaitInputs)
+        {
+          // Only denoised once the inputs are written: the GPU never waits for a client
+          uint64_t value = 0;
+          if(vkGetSemaphoreCounterValue(device, client.timeline, &value) != VK_SUCCESS)
+            client.alive = false;
+          else if(value >= client.request.waitValue)
+            setQueued(client);
+          else if(now - client.waitStart > std::chrono::milliseconds(config.timeoutMs))
+          {
+            LOGW("Service: dropping a client, its inputs are not ready after %d ms\n", config.timeoutMs);
+            client.alive = false;
+          }
+        }
+      }
+      catch(const std::runtime_error& e)
+      {
+        LOGE("Service: dropping a client: %s\n", e.what());
+        client.alive = false;
+      }
+    }
+
+    // Batch of the requests ready, the oldest first: a client is never starved by those connected before it
+    jobs.clear();
+    for(auto& c : clients)
+    {
+      if(c->alive && c->state == ServiceClient::eQueued)
+        jobs.push_back({c.get(), c->request});
+    }
+    std::sort(jobs.begin(), jobs.end(), [](const ServiceJob& a, const ServiceJob& b) { return a.client->queuedAt < b.client->queuedAt; });
+    jobs.resize(std::min(jobs.size(), static_cast<size_t>(config.maxBatch)));
+
+    // The same sizes back to back: the buffers are only re-allocated between groups
+    std::stable_sort(jobs.begin(), jobs.end(), [](const ServiceJob& a, const ServiceJob& b) {
+      return a.request.width != b.request.width ? a.request.width < b.request.width : a.request.height < b.request.height;
+    });
+    for(const ServiceJob& job : jobs)
+    {
+      try
+      {
+        if(job.request.width != size.width || job.request.height != size.height)
+        {
+          size = {job.request.width, job.request.height};
+          denoiser.allocateBuffers(size);  // Waits for the denoises in flight
+        }
+        enqueueJob(denoiser, fence_value, job);
+      }
+      catch(const std::runtime_error& e)
+      {
+        LOGE("Service: dropping a client, cannot denoise: %s\n", e.what());
+        job.client->alive = false;
+        size              = {};  // Allocated again by the next job
+      }
+    }
+    try
+    {
+      CUDA_CHECK(cudaStreamSynchronize(denoiser.getCudaStream()));
+    }
+    catch(const std::runtime_error& e)
+    {
+      LOGE("Service: the batch failed: %s\n", e.what());
+      for(const ServiceJob& job : jobs)
+        job.client->alive = false;
+    }
+
+    for(const ServiceJob& job : jobs)
+    {
+      ServiceClient& client = *job.client;
+      if(!client.alive)
+        continue;
+      size_t output_bytes = 0;
+      if(job.request.type == eServiceDenoiseFrame)
+      {
+        const size_t n = imageFloats(job.request.width, job.request.height);
+        output_bytes   = job.request.encoding == eServiceEncodingHalf ?
+                             encodeFrame(client.pixels + 3 * n, 1, job.request.width, job.request.height, client.encoded) :
+                             n * sizeof(float);
+      }
+      queueReply(client, 0, output_bytes);
+      client.alive = writeClient(client);  // What the socket takes now, the rest when it is writable
+    }
+
+    // Clients gone, the stream is idle
+    for(auto& c : clients)
+    {
+      if(!c->alive)
+        c->destroy(device);
+    }
+    clients.erase(std::remove_if(clients.begin(), clients.end(), [](const auto& c) { return !c->alive; }), clients.end());
+  }
+
+  for(auto& c : clients)
+    c->destroy(device);
+  for(const auto& l : listeners)
+    close(l.first);
+  denoiser.destroy();
+  return 1;
+}
+
+#else
+
+int runDenoiseService(nvvk::Context& /*context*/, const ServiceConfig& /*config*/)
+{
+  return 1;  // OptiX is not supported, or no Unix sockets
+}
+
+#endif  // NVP_SUPPORTS_OPTIX7
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////
+// Denoise service: one DenoiserOptix, without window and renderer, shared by
+// other renderers. Clients connect to a socket and send ServiceRequest messages.
+//
+// - Same node (Unix socket): the client exports a memory block and a timeline
+//   semaphore (opaque FDs, like createBufferCuda and createSemaphore) and passes
+//   them with eServiceAttach. Each eServiceDenoiseShared then waits for the
+//   semaphore to reach waitValue, denoises the block and signals signalValue.
+//   The pixels never leave the GPU. A request is only handed to the GPU once the
+//   host sees the semaphore at waitValue: a client which never signals is
+//   dropped after the timeout, it cannot stall the denoiser of the others.
+// - Other nodes (TCP): eServiceDenoiseFrame carries the pixels, and the reply
+//   carries the denoised image, in the encoding of the request: raw FLOAT3
+//   (36 bytes per pixel in, 12 out), or eServiceEncodingHalf, FP16 coded
+//   losslessly (see frame_codec.hpp) in payloadBytes, for the slower links.
+//   The service decodes and encodes the frames on the CPU.
+//
+// The sockets are never blocking: a slow client is read and written a piece at
+// a time, while the others are served. An error on a request (invalid, too
+// large, CUDA failure) drops its client only.
+//
+// All images are FLOAT3, with the guides (albedo, normal in [-1..1]). A shared
+// block holds color, albedo, normal and the output, one after the other, each
+// of width * height * 3 floats.
+//
+// The requests received from all the clients are batched: they are sorted by
+// size, so the denoiser re-allocates as little as possible, and denoised back
+// to back on the same OptiX context and stream.
+//
+// Command line (see main()):
+//   -service <path>           enables the service, Unix socket of the clients on this node
+//   -service_port <N>         also listens on this TCP port for remote clients (default 0: none)
+//   -service_batch <N>        most requests denoised in one batch (default 8)
+//   -service_max_pixels <N>   largest image accepted, width * height (default 3840 * 2160)
+//   -service_timeout <ms>     longest wait for the inputs of a shared request (default 2000)
+//////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <string>
+
+namespace nvvk {
+class Context;
+}
+
+struct ServiceConfig
+{
+  std::string socketPath;  // Empty: no service
+  int         port      = 0;
+  int         maxBatch  = 8;
+  int64_t     maxPixels = 3840 * 2160;  // Bounds the pinned and device memory a client can request
+  int         timeoutMs = 2000;
+};
+
+// Protocol, shared with the clients. Every request is answered with a ServiceReply.
+constexpr uint32_t kServiceMagic   = 0x4456534E;  // 'NSVD'
+constexpr uint32_t kServiceMaxSize = 16384;       // Largest width or height accepted
+
+enum ServiceRequestType : uint32_t
+{
+  eServiceAttach,         // Ancillary data (SCM_RIGHTS): memory FD, then timeline semaphore FD
+  eServiceDenoiseShared,  // Denoising the attached block
+  eServiceDenoiseFrame,   // Followed by color, albedo and normal; the reply is followed by the output
+};
+
+// Payload of eServiceDenoiseFrame and of its reply
+enum ServiceEncoding : uint32_t
+{
+  eServiceEncodingFloat3,  // The images one after the other, width * height * 3 floats each
+  eServiceEncodingHalf,    // encodeFrame of the images (frame_codec.hpp)
+};
+
+struct ServiceRequest
+{
+  uint32_t magic        = kServiceMagic;
+  uint32_t type         = eServiceAttach;
+  uint32_t width        = 0;
+  uint32_t height       = 0;
+  uint32_t encoding     = eServiceEncodingFloat3;  // eServiceDenoiseFrame, also of the reply
+  uint32_t reserved     = 0;
+  uint64_t payloadBytes = 0;  // eServiceDenoiseFrame with eServiceEncodingHalf: bytes following the request
+  uint64_t memoryBytes  = 0;  // eServiceAttach: size of the exported block
+  uint64_t waitValue    = 0;  // eServiceDenoiseShared: inputs are ready at this value of the semaphore
+  uint64_t signalValue  = 0;  // eServiceDenoiseShared: signaled once the output is written
+};
+
+struct ServiceReply
+{
+  uint32_t magic        = kServiceMagic;
+  int32_t  status       = 0;  // 0: success, the connection is closed otherwise
+  uint64_t payloadBytes = 0;  // eServiceDenoiseFrame: bytes of the output following the reply
+};
+
+// Reading the service arguments; returns false if the service is not requested
+bool parseServiceArgs(int argc, char** argv, ServiceConfig& config);
+
+// Serving the clients until the process is stopped; returns non-zero if the service could not start
+int runDenoiseService(nvvk::Context& context, const ServiceConfig& config);
@@ -20,6 +20,8 @@
 #ifdef NVP_SUPPORTS_OPTIX7
 
 
+#include <algorithm>
+#include <cstring>
 #include <sstream>
 
 #include "vulkan/vulkan.h"
@@ -27,25 +29,29 @@
 #include "optix.h"
 #include "optix_function_table_definition.h"
 #include "optix_stubs.h"
+#include "optix_denoiser_tiling.h"
 
 #include "denoiser.hpp"
 
 #include "imgui/imgui_helper.h"
 #include "nvvk/commands_vk.hpp"
+#include "nvvk/error_vk.hpp"
 #include "stb_image_write.h"
 #include "nvvk/descriptorsets_vk.hpp"
 #include "nvvk/debug_util_vk.hpp"
 #include "nvh/fileoperations.hpp"
 #include "nvvk/shaders_vk.hpp"
+#include "nvvkhl/tonemap_postprocess.hpp"  // Tonemapper settings of the fused copy
 
 
 #include "_autogen/cpy_to_img.comp.h"
 #include "_autogen/cpy_to_buffer.comp.h"
+#include "_autogen/cpy_to_img_tonemap.comp.h"
 
 
 // Choose how to transfer images: 1 for a faster compute shader,
 // or 0 value to use a simpler Vulkan command. The Vulkan way is simpler
-// but about 5 times slower than the compute shader.
+// but about 5 times slower than the compute shader, and only works with OPTIX_PIXEL_FORMAT_FLOAT4.
 #define USE_COMPUTE_SHADER_TO_COPY 1
 
 #define GRID_SIZE 16
@@ -54,6 +60,72 @@ inline VkExtent2D getGridSize(const VkExtent2D& size)
   return VkExtent2D{(size.width + (GRID_SIZE - 1)) / GRID_SIZE, (size.height + (GRID_SIZE - 1)) / GRID_SIZE};
 }
 
+// Pooled allocations: re-allocated only when too small, or much too large (hysteresis), with headroom when growing
+inline bool needsRealloc(size_t capacity, size_t size)
+{
+  return size > capacity || size < capacity / 4;
+}
+inline size_t grownCapacity(size_t size)
+{
+  return size + size / 4;
+}
+
+// Bytes of a pixel of the interop buffers
+static uint32_t sizeofPixel(OptixPixelFormat format)
+{
+  switch(format)
+  {
+    case OPTIX_PIXEL_FORMAT_FLOAT4:
+      return static_cast<uint32_t>(4 * sizeof(float));
+    case OPTIX_PIXEL_FORMAT_FLOAT3:
+      return static_cast<uint32_t>(3 * sizeof(float));
+    case OPTIX_PIXEL_FORMAT_HALF4:
+      return static_cast<uint32_t>(4 * sizeof(uint16_t));
+    case OPTIX_PIXEL_FORMAT_HALF3:
+      return static_cast<uint32_t>(3 * sizeof(uint16_t));
+    case OPTIX_PIXEL_FORMAT_UCHAR4:
+      return static_cast<uint32_t>(4 * sizeof(uint8_t));
+    case OPTIX_PIXEL_FORMAT_UCHAR3:
+      return static_cast<uint32_t>(3 * sizeof(uint8_t));
+    default:
+      return 0;
+  }
+}
+
+// CUDA allocation of at least 'size' bytes, freed when size is 0
+static void reserveDevice(CUdeviceptr& ptr, size_t& capacity, size_t size)
+{
+  if(!needsRealloc(capacity, size))
+    return;
+  if(ptr != 0)
+  {
+    CUDA_CHECK(cudaFree((void*)ptr));
+    ptr = 0;
+  }
+  capacity = size > 0 ? grownCapacity(size) : 0;
+  if(capacity > 0)
+    CUDA_CHECK(cudaMalloc((void**)&ptr, capacity));
+}
+
+// Push constants of cpy_to_img_tonemap.comp: the rectangle read from the denoised buffer, then the tonemapper
+struct TonemapPush
+{
+  std::array<uint32_t, 4>    region;
+  nvvkhl_shaders::Tonemapper tonemapper;
+};
+
+// Making a CUDA device current for the scope (multi-GPU)
+struct ScopedCudaDevice
+{
+  int previous = 0;
+  explicit ScopedCudaDevice(int device)
+  {
+    CUDA_CHECK(cudaGetDevice(&previous));
+    CUDA_CHECK(cudaSetDevice(device));
+  }
+  ~ScopedCudaDevice() { cudaSetDevice(previous); }
+};
+
 
 DenoiserOptix::DenoiserOptix(nvvk::Context* ctx)
 {
@@ -74,17 +146,53 @@ void DenoiserOptix::setup(const VkDevice& device, const VkPhysicalDevice& physic
   m_device         = device;
   m_physicalDevice = physicalDevice;
 
-  m_memAlloc.init(device, physicalDevice);
-  m_allocEx.init(device, physicalDevice, &m_memAlloc);
   m_debug.setup(device);
 }
 
+//--------------------------------------------------------------------------------------------------
+// Making the CUDA device of the denoiser current on the calling thread, needed when initOptiX ran
+// on another thread (the current device is per thread)
+//
+void DenoiserOptix::bindCudaDevice() const
+{
+  CUDA_CHECK(cudaSetDevice(m_cudaDevice));
+}
+
 //--------------------------------------------------------------------------------------------------
 // Initializing OptiX and creating the Denoiser instance
 //
-bool DenoiserOptix::initOptiX(const OptixDenoiserOptions& options, OptixPixelFormat pixelFormat, bool hdr)
+bool DenoiserOptix::initOptiX(const OptixDenoiserOptions& options, OptixPixelFormat pixelFormat, bool /*hdr*/)
 {
+  // The CUDA device of the Vulkan physical device, for the interop, is found by its UUID.
+  // The other CUDA devices can denoise bands of the image (see setDeviceCount)
+  VkPhysicalDeviceIDProperties id_props{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES};
+  VkPhysicalDeviceProperties2  props{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, &id_props};
+  vkGetPhysicalDeviceProperties2(m_physicalDevice, &props);
+
+  int nb_devices = 0;
+  CUDA_CHECK(cudaGetDeviceCount(&nb_devices));
+  m_cudaDevice = -1;
+  for(int d = 0; d < nb_devices; d++)
+  {
+    cudaDeviceProp prop{};
+    CUDA_CHECK(cudaGetDeviceProperties(&prop, d));
+    if(memcmp(prop.uuid.bytes, id_props.deviceUUID, VK_UUID_SIZE) == 0)
+    {
+      m_cudaDevice = d;
+      break;
+    }
+  }
+  if(m_cudaDevice < 0)  // The interop memory and semaphore would be imported in another device
+    throw std::runtime_error(std::string("No CUDA device for the Vulkan device ") + props.properties.deviceName);
+  m_peers.clear();
+  for(int d = 0; d < nb_devices; d++)
+  {
+    if(d != m_cudaDevice)
+      m_peers.push_back({.device = d});
+  }
+
   // Initialize CUDA
+  CUDA_CHECK(cudaSetDevice(m_cudaDevice));
   CUDA_CHECK(cudaFree(nullptr));
 
   CUcontext cu_ctx = nullptr;  // zero means take the current context
@@ -97,6 +205,77 @@ bool DenoiserOptix::initOptiX(const OptixDenoiserOptions& options, OptixPixelFor
   OPTIX_CHECK(optixDeviceContextCreate(cu_ctx, &optixoptions, &m_optixDevice));
   OPTIX_CHECK(optixDeviceContextSetLogCallback(m_optixDevice, contextLogCb, nullptr, 4));
 
+  // All work of the denoiser is enqueued on this stream, it does not synchronize with the legacy default stream
+  CUDA_CHECK(cudaStreamCreateWithFlags(&m_cuStream, cudaStreamNonBlocking));
+  for(auto& te : m_timingEvents)
+    for(auto& ev : te.ev)
+      CUDA_CHECK(cudaEventCreate(&ev));
+  CUDA_CHECK(cudaEventCreateWithFlags(&m_splitReady, cudaEventDisableTiming));
+  CUDA_CHECK(cudaEventCreateWithFlags(&m_readbackReady, cudaEventDisableTiming));
+
+  setPixelFormat(pixelFormat);
+
+  m_denoiserOptions = options;
+  createDenoiser();
+
+  return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Creating the denoiser instance, with or without temporal feedback.
+// This is to use RGB + Albedo + Normal, the AOV model is used instead of the HDR/LDR one
+//
+void DenoiserOptix::createDenoiser()
+{
+  if(m_denoiser != nullptr)
+  {
+    OPTIX_CHECK(optixDenoiserDestroy(m_denoiser));
+    m_denoiser = {};
+  }
+
+  OptixDenoiserModelKind model_kind = OPTIX_DENOISER_MODEL_KIND_AOV;
+#if OPTIX_VERSION >= 70500
+  if(m_temporal)
+    model_kind = OPTIX_DENOISER_MODEL_KIND_TEMPORAL_AOV;  // Adding motion vectors and the previous denoised frame
+#endif
+#if OPTIX_VERSION >= 80000
+  if(m_upscale)
+    model_kind = m_temporal ? OPTIX_DENOISER_MODEL_KIND_TEMPORAL_UPSCALE2X : OPTIX_DENOISER_MODEL_KIND_UPSCALE2X;
+#endif
+  OPTIX_CHECK(optixDenoiserCreate(m_optixDevice, model_kind, &m_denoiserOptions, &m_denoiser));
+  createLadder();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Selecting the denoiser model: AOV or temporal AOV, and optionally upscaling the result 2x.
+// The denoiser is re-created; the buffers must be re-allocated after the call (see allocateBuffers),
+// as the output size depends on the upscale mode.
+//
+void DenoiserOptix::setDenoiserMode(bool temporal, bool upscale)
+{
+#if OPTIX_VERSION < 70500
+  temporal = false;  // Internal guide layers are needed
+#endif
+#if OPTIX_VERSION < 80000
+  upscale = false;  // Upscale models were added in OptiX 8
+#endif
+  if(m_temporal == temporal && m_upscale == upscale)
+    return;
+
+  synchronize();
+
+  m_temporal = temporal;
+  m_upscale  = upscale;
+  createDenoiser();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Setting the format of the interop buffers. The copy pipelines and buffers need to be
+// re-created after changing it (see createCopyPipeline and allocateBuffers).
+//
+void DenoiserOptix::setPixelFormat(OptixPixelFormat pixelFormat)
+{
+  synchronize();  // The worker reads the format when building the layers
   m_pixelFormat = pixelFormat;
   switch(pixelFormat)
   {
@@ -142,330 +321,1513 @@ bool DenoiserOptix::initOptiX(const OptixDenoiserOptions& options, OptixPixelFor
       break;
   }
 
+  // Guides: 16-bit RGB when compact, whatever the format of the color
+  m_guideFormat = m_compactGuides ? OPTIX_PIXEL_FORMAT_HALF3 : m_pixelFormat;
+  m_sizeofGuide = m_compactGuides ? static_cast<uint32_t>(3 * sizeof(uint16_t)) : m_sizeofPixel;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Albedo and normal in HALF3 instead of the format of the color: OptiX accepts a format per layer.
+// Needs createCopyPipeline() and allocateBuffers() to be called after.
+//
+void DenoiserOptix::setCompactGuides(bool compact)
+{
+  synchronize();
+  m_compactGuides = compact;
+  setPixelFormat(m_pixelFormat);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Denoising the image in input and saving the denoised image in the output
+// - All operations (wait, intensity, invoke, signal) are enqueued on m_cuStream and the function
+//   returns immediately, unless hostSync is set, in which case the CPU waits for the denoiser to finish.
+// - On return, fenceValue is the timeline value that will be signaled when the denoised buffer is ready.
+// - With the denoise thread (setWorkerEnabled), the operations are enqueued by the worker, later.
+//
+void DenoiserOptix::denoiseImageBuffer(uint64_t& fenceValue, float blendFactor /*= 0.0f*/, bool hostSync /*= false*/)
+{
+  // Everything the denoise reads which the caller can change before it runs
+  InteropSet& set = m_sets[m_setIdx];
+  DenoiseJob  job{
+      .set           = m_setIdx,
+      .waitValue     = fenceValue,
+      .signalValue   = fenceValue + 1,
+      .blendFactor   = blendFactor,
+      .quality       = m_quality,
+      .region        = clipRegion(m_region),
+      .temporalReset = m_temporalReset,
+      .readback      = set.readback,
+  };
+  m_temporalReset = false;
+  set.readback    = nullptr;
+  set.denoised    = isRegion() ? job.region : VkRect2D{{0, 0}, {m_outputSize.width, m_outputSize.height}};
+  set.fenceValue  = job.signalValue;  // The set can be re-filled once this value is reached
+  m_denoisedSet   = m_setIdx;
+  fenceValue      = job.signalValue;
+
+  if(m_worker.joinable() && !hostSync)
+  {
+    m_nbJobs++;
+    m_jobs.push(job);  // The worker enqueues the CUDA work, the caller goes on
+    return;
+  }
+
+  waitJobs();  // After the jobs already handed to the worker
+  runDenoise(job);
+  if(hostSync)
+  {
+    CUDA_CHECK(cudaStreamSynchronize(m_cuStream));  // Making sure the denoiser is done
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Enqueuing a denoise on m_cuStream, from the worker thread or inline (see denoiseImageBuffer)
+//
+void DenoiserOptix::runDenoise(const DenoiseJob& job)
+{
+  try
+  {
+    OptixPixelFormat pixel_format        = m_pixelFormat;
+    auto             sizeof_pixel        = m_sizeofPixel;
+    uint32_t         row_stride_in_bytes = sizeof_pixel * m_imageSize.width;
+
+    //std::vector<OptixImage2D> inputLayer;  // Order: RGB, Albedo, Normal
+
+    InteropSet& set = m_sets[job.set];
+    m_job           = job;
+
+    // Create and set our OptiX layers
+    OptixDenoiserLayer layer = {};
+    // Input
+    layer.input.data               = (CUdeviceptr)set.in[0].cudaPtr;
+    layer.input.width              = m_imageSize.width;
+    layer.input.height             = m_imageSize.height;
+    layer.input.rowStrideInBytes   = row_stride_in_bytes;
+    layer.input.pixelStrideInBytes = m_sizeofPixel;
+    layer.input.format             = pixel_format;
+
+    // Output
+    layer.output.data               = (CUdeviceptr)set.out.cudaPtr;
+    layer.output.width              = m_outputSize.width;
+    layer.output.height             = m_outputSize.height;
+    layer.output.rowStrideInBytes   = sizeof_pixel * m_outputSize.width;
+    layer.output.pixelStrideInBytes = m_sizeofPixel;
+    layer.output.format             = pixel_format;
+
+
+    OptixDenoiserGuideLayer guide_layer = {};
+    // albedo
+    if(m_denoiserOptions.guideAlbedo != 0u)
+    {
+      guide_layer.albedo.data               = (CUdeviceptr)set.in[1].cudaPtr;
+      guide_layer.albedo.width              = m_imageSize.width;
+      guide_layer.albedo.height             = m_imageSize.height;
+      guide_layer.albedo.rowStrideInBytes   = m_sizeofGuide * m_imageSize.width;
+      guide_layer.albedo.pixelStrideInBytes = m_sizeofGuide;
+      guide_layer.albedo.format             = m_guideFormat;
+    }
+
+    // normal
+    if(m_denoiserOptions.guideNormal != 0u)
+    {
+      guide_layer.normal.data               = (CUdeviceptr)set.in[2].cudaPtr;
+      guide_layer.normal.width              = m_imageSize.width;
+      guide_layer.normal.height             = m_imageSize.height;
+      guide_layer.normal.rowStrideInBytes   = m_sizeofGuide * m_imageSize.width;
+      guide_layer.normal.pixelStrideInBytes = m_sizeofGuide;
+      guide_layer.normal.format             = m_guideFormat;
+    }
+
+#if OPTIX_VERSION >= 70500
+    if(m_temporal)
+    {
+      // Without history, the previous output is the noisy input and the previous internal guide must be zero.
+      // When upscaling, the input does not have the size of the output: starting from a black image instead.
+      // Otherwise the previous output is still in the set denoised before, unless it is this one (single set).
+      const size_t output_bytes = static_cast<size_t>(layer.output.rowStrideInBytes) * m_outputSize.height;
+      bool         own_history  = job.temporalReset || job.set == m_historySet || m_historySet >= m_nbSets;
+      if(job.temporalReset)
+      {
+        CUDA_CHECK(cudaMemsetAsync((void*)m_dInternalGuide[1 - m_internalGuideIdx], 0,
+                                   static_cast<size_t>(m_denoiserSizes.internalGuideLayerPixelSizeInBytes)
+                                       * m_outputSize.width * m_outputSize.height,
+                                   m_cuStream));
+        if(m_upscale)
+          CUDA_CHECK(cudaMemsetAsync((void*)m_dPrevOutput, 0, output_bytes, m_cuStream));
+      }
+      else if(own_history)
+      {
+        CUDA_CHECK(cudaMemcpyAsync((void*)m_dPrevOutput, set.out.cudaPtr, output_bytes, cudaMemcpyDeviceToDevice, m_cuStream));
+      }
+      bool use_input            = job.temporalReset && !m_upscale;
+      layer.previousOutput      = use_input ? layer.input : layer.output;
+      layer.previousOutput.data = use_input ? layer.input.data :
+                                  own_history ? m_dPrevOutput :
+                                                (CUdeviceptr)m_sets[m_historySet].out.cudaPtr;
+
+      // Motion vectors, in pixels
+      guide_layer.flow.data               = (CUdeviceptr)set.flow.cudaPtr;
+      guide_layer.flow.width              = m_imageSize.width;
+      guide_layer.flow.height             = m_imageSize.height;
+      guide_layer.flow.rowStrideInBytes   = m_imageSize.width * 2 * sizeof(float);
+      guide_layer.flow.pixelStrideInBytes = 2 * sizeof(float);
+      guide_layer.flow.format             = OPTIX_PIXEL_FORMAT_FLOAT2;
+
+      // Internal guide layers, written by the denoiser for the next frame (output resolution)
+      OptixImage2D internal_guide{};
+      internal_guide.width              = m_outputSize.width;
+      internal_guide.height             = m_outputSize.height;
+      internal_guide.pixelStrideInBytes = static_cast<unsigned int>(m_denoiserSizes.internalGuideLayerPixelSizeInBytes);
+      internal_guide.rowStrideInBytes   = internal_guide.pixelStrideInBytes * m_outputSize.width;
+      internal_guide.format             = OPTIX_PIXEL_FORMAT_INTERNAL_GUIDE_LAYER;
+
+      guide_layer.outputInternalGuideLayer              = internal_guide;
+      guide_layer.outputInternalGuideLayer.data         = m_dInternalGuide[m_internalGuideIdx];
+      guide_layer.previousOutputInternalGuideLayer      = internal_guide;
+      guide_layer.previousOutputInternalGuideLayer.data = m_dInternalGuide[1 - m_internalGuideIdx];
+    }
+#endif
+
+    // Wait from Vulkan (Copy to Buffer)
+    cudaExternalSemaphoreWaitParams wait_params{};
+    wait_params.flags              = 0;
+    wait_params.params.fence.value = job.waitValue;
+    CUDA_CHECK(cudaWaitExternalSemaphoresAsync(&m_semaphore.cu, &wait_params, 1, m_cuStream));
+
+    // The output of the set may still be read back to the host
+    if(job.readback != nullptr)
+    {
+      CUDA_CHECK(cudaStreamWaitEvent(m_cuStream, job.readback, 0));
+    }
+
+    TimingEvents& timing = m_timingEvents[m_timingIdx];
+    m_timingIdx          = (m_timingIdx + 1) % static_cast<uint32_t>(m_timingEvents.size());
+    timing.fenceValue.store(0, std::memory_order_release);  // The events of the slot are re-recorded, see getTimings
+    timing.graph.store(isGraph(), std::memory_order_relaxed);
+
+    if(isGraph())
+    {
+      // Replaying the sequence captured for the set, the intensity is inside the graph and timed with the invoke
+      if(set.graph == nullptr || set.graphBlend != job.blendFactor)
+        captureGraph(set, layer, guide_layer, job.blendFactor);
+      CUDA_CHECK(cudaEventRecord(timing.ev[0], m_cuStream));
+      CUDA_CHECK(cudaGraphLaunch(set.graph, m_cuStream));
+    }
+    else
+    {
+      CUDA_CHECK(cudaEventRecord(timing.ev[0], m_cuStream));
+      enqueueDenoise(set, layer, guide_layer, job.blendFactor, timing.ev[1]);
+    }
+    CUDA_CHECK(cudaEventRecord(timing.ev[2], m_cuStream));
+
+#if OPTIX_VERSION >= 70500
+    if(m_temporal)
+    {
+      // The denoised image stays in the set and the internal guide in its ping-pong buffer for the next frame
+      m_historySet       = job.set;
+      m_internalGuideIdx = 1 - m_internalGuideIdx;
+    }
+#endif
+
+    // Signal Vulkan (Copy to Image) once the denoiser is done, ordered on the same stream
+    cudaExternalSemaphoreSignalParams sig_params{};
+    sig_params.flags              = 0;
+    sig_params.params.fence.value = job.signalValue;
+    CUDA_CHECK(cudaSignalExternalSemaphoresAsync(&m_semaphore.cu, &sig_params, 1, m_cuStream));
+    timing.fenceValue.store(job.signalValue, std::memory_order_release);  // Events recorded, see getTimings
+  }
+  catch(const std::exception& e)
+  {
+    std::cout << e.what() << std::endl;
+
+    // The caller already waits on job.signalValue: still signaling it, the output keeps its previous content
+    cudaExternalSemaphoreSignalParams sig_params{};
+    sig_params.params.fence.value = job.signalValue;
+    if(cudaSignalExternalSemaphoresAsync(&m_semaphore.cu, &sig_params, 1, m_cuStream) != cudaSuccess)
+      std::cout << "Denoiser: cannot signal the timeline value " << job.signalValue << std::endl;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// The work of a denoise between the wait for Vulkan and the signal: intensity, average color and invoke
+// of the path in use. Enqueued on m_cuStream, or captured in the graph of the set (see captureGraph).
+//
+void DenoiserOptix::enqueueDenoise(InteropSet&                    set,
+                                   const OptixDenoiserLayer&      layer,
+                                   const OptixDenoiserGuideLayer& guideLayer,
+                                   float                          blendFactor,
+                                   cudaEvent_t                    intensityDone)
+{
+  if(m_dIntensity != 0)
+  {
+    OPTIX_CHECK(optixDenoiserComputeIntensity(m_denoiser, m_cuStream, &layer.input, m_dIntensity, m_dScratchBuffer, m_scratchSize));
+  }
+  if(intensityDone != nullptr)
+    CUDA_CHECK(cudaEventRecord(intensityDone, m_cuStream));
+
+  OptixDenoiserParams denoiser_params{};
+#if OPTIX_VERSION < 80000
+  denoiser_params.denoiseAlpha = m_denoiserAlpha;
+#endif
+  denoiser_params.hdrIntensity = m_dIntensity;
+  denoiser_params.blendFactor  = blendFactor;
+
+  // Light-path AOVs: same layout as the beauty, denoised by the same invocation, normalized by the average color
+  std::vector<OptixDenoiserLayer> layers = {layer};
+  if(isAov())
+  {
+    for(uint32_t i = 0; i < m_nbAovs; i++)
+    {
+      OptixDenoiserLayer aov = layer;
+      aov.input.data         = (CUdeviceptr)set.aovIn[i].cudaPtr;
+      aov.output.data        = (CUdeviceptr)set.aovOut[i].cudaPtr;
+      layers.push_back(aov);
+    }
+    OPTIX_CHECK(optixDenoiserComputeAverageColor(m_denoiser, m_cuStream, &layer.input, m_dAvgColor, m_dScratchBuffer, m_scratchSize));
+    denoiser_params.hdrAverageColor = m_dAvgColor;
+  }
+  else if(!m_upscale)
+  {
+    // Only the beauty is denoised, the AOVs are shown noisy
+    for(uint32_t i = 0; i < m_nbAovs; i++)
+      CUDA_CHECK(cudaMemcpyAsync(set.aovOut[i].cudaPtr, set.aovIn[i].cudaPtr, m_inputBytes, cudaMemcpyDeviceToDevice, m_cuStream));
+  }
+  const auto nb_layers = static_cast<unsigned int>(layers.size());
+
+  // Execute the denoiser
+  if(isSplit())
+  {
+    invokeSplit(layer, guideLayer, denoiser_params);
+  }
+  else if(isRegion())
+  {
+    invokeRegion(layer, guideLayer, denoiser_params);
+  }
+  else if(isLadder() && m_job.quality != eQualityFull)
+  {
+    invokeLadder(layer, guideLayer, denoiser_params);
+  }
+  else if(isTiled())
+  {
+    // Denoising tile by tile, each tile is extended by the overlap window to avoid seams
+    OPTIX_CHECK(optixUtilDenoiserInvokeTiled(m_denoiser, m_cuStream, &denoiser_params, m_dStateBuffer,
+                                             m_denoiserSizes.stateSizeInBytes, &guideLayer, layers.data(), nb_layers,
+                                             m_dScratchBuffer, m_scratchSize, m_overlap, m_tileExtent.width, m_tileExtent.height));
+  }
+  else
+  {
+    OPTIX_CHECK(optixDenoiserInvoke(m_denoiser, m_cuStream, &denoiser_params, m_dStateBuffer, m_denoiserSizes.stateSizeInBytes,
+                                    &guideLayer, layers.data(), nb_layers, 0, 0, m_dScratchBuffer, m_scratchSize));
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// CUDA graph of the denoise of a set: the intensity and invoke calls are captured once and replayed at each
+// denoise, saving the launch overhead of the many kernels of the denoiser. The graph holds the pointers of the
+// set and the state, and the blend factor: it is captured again when one of them changes (see destroyGraphs).
+//
+void DenoiserOptix::captureGraph(InteropSet& set, const OptixDenoiserLayer& layer, const OptixDenoiserGuideLayer& guideLayer, float blendFactor)
+{
+  if(set.graph != nullptr)
+    CUDA_CHECK(cudaGraphExecDestroy(set.graph));
+  set.graph = nullptr;
+
+  cudaGraph_t graph = nullptr;
+  CUDA_CHECK(cudaStreamBeginCapture(m_cuStream, cudaStreamCaptureModeThreadLocal));
+  try
+  {
+    enqueueDenoise(set, layer, guideLayer, blendFactor, nullptr);
+  }
+  catch(...)
+  {
+    cudaStreamEndCapture(m_cuStream, &graph);  // Leaving the stream usable
+    if(graph != nullptr)
+      cudaGraphDestroy(graph);
+    throw;
+  }
+  CUDA_CHECK(cudaStreamEndCapture(m_cuStream, &graph));
+  CUDA_CHECK(cudaGraphInstantiateWithFlags(&set.graph, graph, 0));
+  CUDA_CHECK(cudaGraphDestroy(graph));
+  set.graphBlend = blendFactor;
+}
+
+//--------------------------------------------------------------------------------------------------
+// The graphs are captured again at the next denoise of each set, after the buffers or the state changed
+//
+void DenoiserOptix::destroyGraphs()
+{
+  for(auto& set : m_sets)
+  {
+    if(set.graph != nullptr)
+      CUDA_CHECK(cudaGraphExecDestroy(set.graph));
+    set.graph = nullptr;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Replaying the denoise from CUDA graphs (see captureGraph). Only the plain and tiled paths are captured,
+// temporal, split, region of interest and the lower ladder levels change their work at each denoise.
+//
+void DenoiserOptix::setGraphEnabled(bool enabled)
+{
+  synchronize();
+  m_graphEnabled = enabled;
+  destroyGraphs();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Denoise thread: denoiseImageBuffer only pushes a job in a lock-free ring, the worker makes the CUDA
+// and OptiX calls, so that their latency does not hold the caller. The calls changing the buffers or
+// the state wait for the jobs in the ring to be enqueued first (see synchronize).
+//
+void DenoiserOptix::setWorkerEnabled(bool enabled)
+{
+  if(enabled == m_worker.joinable())
+    return;
+  if(enabled)
+  {
+    m_worker = std::thread([this] {
+      bindCudaDevice();  // The device is current per thread
+      DenoiseJob job;
+      while(true)
+      {
+        m_jobs.pop(job);
+        if(job.stop)
+          break;
+        runDenoise(job);
+        m_nbJobsDone.fetch_add(1, std::memory_order_release);
+        m_nbJobsDone.notify_all();
+      }
+    });
+  }
+  else
+  {
+    m_jobs.push(DenoiseJob{.stop = true});
+    m_worker.join();
+    m_nbJobs     = 0;
+    m_nbJobsDone = 0;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Waiting for the worker to have enqueued all the jobs pushed, not for the GPU to execute them
+//
+void DenoiserOptix::waitJobs()
+{
+  uint64_t done = m_nbJobsDone.load(std::memory_order_acquire);
+  while(done != m_nbJobs)
+  {
+    m_nbJobsDone.wait(done, std::memory_order_acquire);
+    done = m_nbJobsDone.load(std::memory_order_acquire);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Waiting for all the work of the denoiser, handed to the worker or already on m_cuStream
+//
+void DenoiserOptix::synchronize()
+{
+  waitJobs();
+  if(m_cuStream != nullptr)
+    CUDA_CHECK(cudaStreamSynchronize(m_cuStream));
+}
+
+//--------------------------------------------------------------------------------------------------
+// The denoiser of the offline modes, without the copy pipelines: the interop buffers are filled by CUDA copies.
+// No Vulkan work signals the semaphore: each denoise waits for the value signaled by the previous one, the
+// caller starts its fence value at 0.
+//
+void DenoiserOptix::initOffline(const nvvk::Context& ctx)
+{
+  setup(ctx.m_device, ctx.m_physicalDevice, ctx.m_queueGCT.familyIndex);
+  OptixDenoiserOptions options{};
+  options.guideAlbedo = 1u;
+  options.guideNormal = 1u;
+  initOptiX(options, OPTIX_PIXEL_FORMAT_FLOAT3, true);
+  createSemaphore();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Offline denoising (see batch.hpp): the images are copied from the host to the inputs of the current set,
+// and the denoised result back. The copies are enqueued on m_cuStream, ordered with denoiseImageBuffer,
+// and are asynchronous when the host memory is pinned.
+//
+void DenoiserOptix::uploadInputs(const std::array<const void*, 3>& host)
+{
+  InteropSet&                       set   = m_sets[m_setIdx];
+  const std::array<VkDeviceSize, 3> bytes = {m_inputBytes, m_guideBytes, m_guideBytes};
+  for(size_t i = 0; i < host.size(); i++)
+  {
+    if(host[i] != nullptr)
+      CUDA_CHECK(cudaMemcpyAsync(set.in[i].cudaPtr, host[i], bytes[i], cudaMemcpyDefault, m_cuStream));
+  }
+}
+
+void DenoiserOptix::downloadOutput(void* host)
+{
+  copyOutputToHost(host, m_sets[m_setIdx], m_cuStream);
+}
+
+void DenoiserOptix::readbackOutput(void* host, CUstream stream, cudaEvent_t done)
+{
+  waitJobs();  // The denoise of the set must be on m_cuStream
+  InteropSet& set = m_sets[m_setIdx];
+  CUDA_CHECK(cudaEventRecord(m_readbackReady, m_cuStream));
+  CUDA_CHECK(cudaStreamWaitEvent(stream, m_readbackReady, 0));
+  copyOutputToHost(host, set, stream);
+  CUDA_CHECK(cudaEventRecord(done, stream));
+  set.readback = done;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Converting all images to buffers used by the denoiser
+//
+void DenoiserOptix::imageToBuffer(const VkCommandBuffer& cmdBuf, const std::vector<nvvk::Texture>& imgIn)
+{
+  LABEL_SCOPE_VK(cmdBuf);
+
+#if USE_COMPUTE_SHADER_TO_COPY
+  copyImageToBuffer(cmdBuf, imgIn);
+#else
+  VkBufferImageCopy region = {
+      .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .layerCount = 1},
+      .imageExtent      = {.width = m_imageSize.width, .height = m_imageSize.height, .depth = 1},
+  };
+
+  const int nb_images = m_sets[m_setIdx].guidesValid ? 1 : static_cast<int>(imgIn.size());  // Only the color if unchanged
+  for(int i = 0; i < nb_images; i++)
+  {
+    nvvk::cmdBarrierImageLayout(cmdBuf, imgIn[i].image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    vkCmdCopyImageToBuffer(cmdBuf, imgIn[i].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           m_sets[m_setIdx].in[i].bufVk.buffer, 1, &region);
+    nvvk::cmdBarrierImageLayout(cmdBuf, imgIn[i].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+  }
+  m_sets[m_setIdx].guidesValid = true;
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------
+// The guides only change with the camera, the scene or the size: while they don't, a denoise only copies the color
+//
+void DenoiserOptix::setGuidesValid(bool valid)
+{
+  for(auto& set : m_sets)
+    set.guidesValid = valid;
+}
+
+bool DenoiserOptix::getGuidesValid() const
+{
+  return std::all_of(m_sets.begin(), m_sets.end(), [](const InteropSet& set) { return set.guidesValid; });
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Converting the output buffer to the image
+//
+void DenoiserOptix::bufferToImage(const VkCommandBuffer& cmdBuf, nvvk::Texture* imgOut)
+{
+  LABEL_SCOPE_VK(cmdBuf);
+
+#if USE_COMPUTE_SHADER_TO_COPY
+  copyBufferToImage(cmdBuf, imgOut);
+#else
+  VkBufferImageCopy region = {
+      .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .layerCount = 1},
+      .imageExtent      = {.width = m_outputSize.width, .height = m_outputSize.height, .depth = 1},
+  };
+
+  nvvk::cmdBarrierImageLayout(cmdBuf, imgOut->image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  const std::array<uint32_t, 4> rect = displayRegion(m_setIdx);
+  if(rect[0] > 0 || rect[1] > 0 || rect[2] < m_outputSize.width || rect[3] < m_outputSize.height)
+  {
+    // Region of interest: the noisy input, then the denoised rectangle over it
+    vkCmdCopyBufferToImage(cmdBuf, m_sets[m_setIdx].in[0].bufVk.buffer, imgOut->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    nvvk::cmdBarrierImageLayout(cmdBuf, imgOut->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    region.bufferOffset    = (static_cast<VkDeviceSize>(rect[1]) * m_outputSize.width + rect[0]) * m_sizeofPixel;
+    region.bufferRowLength = m_outputSize.width;
+    region.imageOffset     = {static_cast<int32_t>(rect[0]), static_cast<int32_t>(rect[1]), 0};
+    region.imageExtent     = {rect[2] - rect[0], rect[3] - rect[1], 1};
+  }
+  if(region.imageExtent.width > 0 && region.imageExtent.height > 0)
+    vkCmdCopyBufferToImage(cmdBuf, displayBuffer(m_setIdx).bufVk.buffer, imgOut->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+  nvvk::cmdBarrierImageLayout(cmdBuf, imgOut->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+#endif
+}
+
+
+//--------------------------------------------------------------------------------------------------
+//
+//
+void DenoiserOptix::destroy()
+{
+  // Cleanup resources
+  setWorkerEnabled(false);
+  destroyPeers();
+  destroyLadder();
+  optixDenoiserDestroy(m_denoiser);
+  optixDeviceContextDestroy(m_optixDevice);
+
+  if(m_cuStream != nullptr)
+  {
+    CUDA_CHECK(cudaStreamSynchronize(m_cuStream));
+    CUDA_CHECK(cudaStreamDestroy(m_cuStream));
+    m_cuStream = nullptr;
+  }
+  for(auto& te : m_timingEvents)
+  {
+    for(auto& ev : te.ev)
+    {
+      if(ev != nullptr)
+        CUDA_CHECK(cudaEventDestroy(ev));
+      ev = nullptr;
+    }
+  }
+  for(cudaEvent_t* ev : {&m_splitReady, &m_readbackReady})
+  {
+    if(*ev != nullptr)
+      CUDA_CHECK(cudaEventDestroy(*ev));
+    *ev = nullptr;
+  }
+
+  if(m_semaphore.cu != nullptr)
+  {
+    CUDA_CHECK(cudaDestroyExternalSemaphore(m_semaphore.cu));
+    m_semaphore.cu = nullptr;
+  }
+  vkDestroySemaphore(m_device, m_semaphore.vk, nullptr);
+  m_semaphore.vk = VK_NULL_HANDLE;
+
+  destroyBuffer();
+  destroyCopyPipeline();
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//
+void DenoiserOptix::destroyCopyPipeline()
+{
+  for(auto& d : m_desc)
+  {
+    vkDestroyDescriptorPool(m_device, d.pool, nullptr);
+    vkDestroyDescriptorSetLayout(m_device, d.layout, nullptr);
+    d.pool   = VK_NULL_HANDLE;
+    d.layout = VK_NULL_HANDLE;
+  }
+  for(auto& p : m_pipelines)
+  {
+    vkDestroyPipeline(m_device, p.p, nullptr);
+    vkDestroyPipelineLayout(m_device, p.layout, nullptr);
+    p.p      = VK_NULL_HANDLE;
+    p.layout = VK_NULL_HANDLE;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//
+void DenoiserOptix::destroyBuffer()
+{
+  // The denoiser, or a readback, may still be using the buffers
+  synchronize();
+  for(auto& set : m_sets)
+  {
+    if(set.readback != nullptr)
+      CUDA_CHECK(cudaEventSynchronize(set.readback));
+    set.readback = nullptr;
+  }
+
+  destroyGraphs();
+  destroyInteropMemory();
+  m_sets.clear();
+
+  destroyState();
+
+  if(m_dIntensity != 0)
+  {
+    CUDA_CHECK(cudaFree((void*)m_dIntensity));
+    m_dIntensity = 0;
+  }
+  if(m_dMinRGB != 0)
+  {
+    CUDA_CHECK(cudaFree((void*)m_dMinRGB));
+    m_dMinRGB = 0;
+  }
+  if(m_dAvgColor != 0)
+  {
+    CUDA_CHECK(cudaFree((void*)m_dAvgColor));
+    m_dAvgColor = 0;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Releasing the memory of the denoiser state and scratch
+//
+void DenoiserOptix::destroyState()
+{
+  reserveDevice(m_dStateBuffer, m_stateCapacity, 0);
+  reserveDevice(m_dScratchBuffer, m_scratchCapacity, 0);
+  reserveDevice(m_dPrevOutput, m_prevOutputCapacity, 0);
+  reserveDevice(m_dInternalGuide[0], m_guideCapacity[0], 0);
+  reserveDevice(m_dInternalGuide[1], m_guideCapacity[1], 0);
+}
+
+//--------------------------------------------------------------------------------------------------
+// UI specific for the denoiser
+//
+bool DenoiserOptix::uiSetup()
+{
+  bool modified = false;
+  if(ImGui::CollapsingHeader("Denoiser", ImGuiTreeNodeFlags_DefaultOpen))
+  {
+    modified |= ImGuiH::Control::Checkbox("Denoise", "", reinterpret_cast<bool*>(&m_denoisedMode));
+    modified |= ImGuiH::Control::Slider("Start Frame", "Frame at which the denoiser starts to be applied",
+                                        &m_startDenoiserFrame, nullptr, ImGuiH::Control::Flags::Normal, 0, 99);
+  }
+  return modified;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Allocating all the buffers in which the images will be transfered.
+// The buffers are shared with Cuda, therefore OptiX can denoised them
+//
+void DenoiserOptix::allocateBuffers(const VkExtent2D& imgSize)
+{
+  m_imageSize  = imgSize;
+  m_outputSize = m_upscale ? VkExtent2D{imgSize.width * 2, imgSize.height * 2} : imgSize;
+
+  // The denoiser, or a readback, may still be using the buffers
+  synchronize();
+  for(auto& set : m_sets)
+  {
+    if(set.readback != nullptr)
+      CUDA_CHECK(cudaEventSynchronize(set.readback));
+    set.readback = nullptr;
+    set.denoised = {{0, 0}, {~0U, ~0U}};  // Rectangle of the previous size
+  }
+  destroyGraphs();
+
+  m_inputBytes  = static_cast<VkDeviceSize>(m_imageSize.width) * m_imageSize.height * m_sizeofPixel;
+  m_guideBytes  = static_cast<VkDeviceSize>(m_imageSize.width) * m_imageSize.height * m_sizeofGuide;
+  m_outputBytes = static_cast<VkDeviceSize>(m_outputSize.width) * m_outputSize.height * m_sizeofPixel;
+
+  // Motion vectors, only used by the temporal denoiser. Otherwise a placeholder keeps the descriptor valid.
+  m_flowBytes = (m_temporal ? static_cast<VkDeviceSize>(m_imageSize.width) * m_imageSize.height : 1) * 2 * sizeof(float);
+
+  // Re-using the memory block if all the buffers still fit in their place
+  bool reuse = m_interopMemory.memory != VK_NULL_HANDLE && m_sets.size() == m_nbSets && m_sets[0].aovIn.size() == m_nbAovs;
+  for(const auto& [buf, size] : interopBuffers())
+    reuse = reuse && !needsRealloc(buf->capacity, size);
+  if(!reuse)
+  {
+    destroyInteropMemory();
+    m_sets.resize(m_nbSets);
+    for(auto& set : m_sets)
+    {
+      set.aovIn.resize(m_nbAovs);
+      set.aovOut.resize(m_nbAovs);
+    }
+    createInteropMemory();
+  }
+  setGuidesValid(false);  // The content of the buffers is undefined
+  m_setIdx      = 0;
+  m_denoisedSet = 0;
+
+  if(m_dMinRGB == 0)
+    CUDA_CHECK(cudaMalloc((void**)&m_dMinRGB, 4 * sizeof(float)));
+  if(m_dIntensity == 0
+     && (m_pixelFormat == OPTIX_PIXEL_FORMAT_FLOAT3 || m_pixelFormat == OPTIX_PIXEL_FORMAT_FLOAT4
+         || m_pixelFormat == OPTIX_PIXEL_FORMAT_HALF3 || m_pixelFormat == OPTIX_PIXEL_FORMAT_HALF4))
+    CUDA_CHECK(cudaMalloc((void**)&m_dIntensity, sizeof(float)));
+  if(m_dAvgColor == 0 && m_nbAovs > 0)
+    CUDA_CHECK(cudaMalloc((void**)&m_dAvgColor, 3 * sizeof(float)));
+
+  setupState();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Allocating the denoiser state and scratch memory, and setting up the denoiser.
+// When tiling, the memory is computed for a single tile (plus overlap), not for the whole image.
+//
+void DenoiserOptix::setupState()
+{
+  destroyGraphs();  // Pointing to the previous state and buffers
+
+  m_tileExtent = m_imageSize;
+  if(isSplit())
+  {
+    m_tileExtent.height = (m_imageSize.height + m_nbPeers) / (m_nbPeers + 1);  // Height of a band
+  }
+  else if(m_tileSize > 0 && !m_temporal && !m_upscale)  // The temporal history is kept for the whole image
+  {
+    m_tileExtent.width  = std::min(m_tileSize, m_imageSize.width);
+    m_tileExtent.height = std::min(m_tileSize, m_imageSize.height);
+  }
+
+  // Computing the amount of memory needed to do the denoiser
+  OPTIX_CHECK(optixDenoiserComputeMemoryResources(m_denoiser, m_tileExtent.width, m_tileExtent.height, &m_denoiserSizes));
+
+  bool with_overlap = isTiled() || isSplit() || isRegion();
+  m_overlap     = with_overlap ? m_denoiserSizes.overlapWindowSizeInPixels : 0;
+  m_scratchSize = with_overlap ? m_denoiserSizes.withOverlapScratchSizeInBytes : m_denoiserSizes.withoutOverlapScratchSizeInBytes;
+  m_scratchSize = std::max(m_scratchSize, m_denoiserSizes.computeIntensitySizeInBytes);  // Scratch is shared with the intensity computation
+  m_scratchSize = std::max(m_scratchSize, m_denoiserSizes.computeAverageColorSizeInBytes);  // and the average color (AOVs)
+
+  // Quality ladder: the motion level denoises the whole image at half resolution (when upscaling), the albedo
+  // level is tiled as the main denoiser. The states are released when the ladder is not used.
+  for(size_t i = 0; i < m_ladder.size(); i++)
+  {
+    LadderLevel& level = m_ladder[i];
+    if(!isLadder())
+    {
+      reserveDevice(level.state, level.stateCapacity, 0);
+      continue;
+    }
+    bool       motion = i == eQualityMotion;
+    VkExtent2D output = motion ? m_imageSize : m_tileExtent;
+#if OPTIX_VERSION >= 80000
+    if(motion)
+      output = {std::max(m_imageSize.width / 2, 1U) * 2, std::max(m_imageSize.height / 2, 1U) * 2};
+#endif
+    OPTIX_CHECK(optixDenoiserComputeMemoryResources(level.denoiser, output.width, output.height, &level.sizes));
+#if OPTIX_VERSION >= 80000
+    level.setupSize = motion ? VkExtent2D{output.width / 2, output.height / 2} :
+                               VkExtent2D{output.width + 2 * m_overlap, output.height + 2 * m_overlap};
+#else
+    level.setupSize = motion ? output : VkExtent2D{output.width + 2 * m_overlap, output.height + 2 * m_overlap};
+#endif
+    size_t scratch = (with_overlap && !motion) ? level.sizes.withOverlapScratchSizeInBytes : level.sizes.withoutOverlapScratchSizeInBytes;
+    m_scratchSize  = std::max({m_scratchSize, scratch, level.sizes.computeIntensitySizeInBytes});
+    reserveDevice(level.state, level.stateCapacity, level.sizes.stateSizeInBytes);
+  }
+
+  reserveDevice(m_dStateBuffer, m_stateCapacity, m_denoiserSizes.stateSizeInBytes);
+  reserveDevice(m_dScratchBuffer, m_scratchCapacity, m_scratchSize);
+
+  OPTIX_CHECK(optixDenoiserSetup(m_denoiser, m_cuStream, m_tileExtent.width + 2 * m_overlap, m_tileExtent.height + 2 * m_overlap,
+                                 m_dStateBuffer, m_denoiserSizes.stateSizeInBytes, m_dScratchBuffer, m_scratchSize));
+  for(LadderLevel& level : m_ladder)
+  {
+    if(level.state != 0)
+      OPTIX_CHECK(optixDenoiserSetup(level.denoiser, m_cuStream, level.setupSize.width, level.setupSize.height, level.state,
+                                     level.sizes.stateSizeInBytes, m_dScratchBuffer, m_scratchSize));
+  }
+
+#if OPTIX_VERSION >= 70500
+  // Released when not temporal
+  size_t nb_pixels   = m_temporal ? static_cast<size_t>(m_outputSize.width) * m_outputSize.height : 0;  // History is at output resolution
+  size_t guide_bytes = nb_pixels * m_denoiserSizes.internalGuideLayerPixelSizeInBytes;
+  reserveDevice(m_dPrevOutput, m_prevOutputCapacity, nb_pixels * m_sizeofPixel);
+  reserveDevice(m_dInternalGuide[0], m_guideCapacity[0], guide_bytes);
+  reserveDevice(m_dInternalGuide[1], m_guideCapacity[1], guide_bytes);
+#endif
+  m_temporalReset = true;
+
+  setupPeers();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Setting the size of the tiles (0: no tiling). Only the denoiser state is re-allocated.
+//
+void DenoiserOptix::setTileSize(uint32_t tileSize)
+{
+  synchronize();
+  m_tileSize = tileSize;
+  if(m_dStateBuffer == 0)
+    return;  // Buffers not allocated yet, will be done in allocateBuffers
+
+  setupState();  // Re-using the allocations if large enough
+}
+
+//--------------------------------------------------------------------------------------------------
+// Number of CUDA devices denoising the image (1: only the device running Vulkan). The image is split in
+// horizontal bands, the peer devices are initialized the first time they are used.
+// Not applied to the temporal and upscale models, which keep a history of the whole image.
+//
+void DenoiserOptix::setDeviceCount(uint32_t count)
+{
+  count = std::clamp(count, 1U, getMaxDeviceCount());
+  synchronize();
+
+  m_nbPeers = count - 1;
+  createPeers();
+  if(m_dStateBuffer == 0)
+    return;  // Buffers not allocated yet, will be done in allocateBuffers
+
+  setupState();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Creating an OptiX context and an AOV denoiser, with the same guides, on each peer device in use
+//
+void DenoiserOptix::createPeers()
+{
+  for(uint32_t i = 0; i < m_nbPeers; i++)
+  {
+    PeerDevice& peer = m_peers[i];
+    if(peer.context != nullptr)
+      continue;
+
+    ScopedCudaDevice scoped(peer.device);
+    CUDA_CHECK(cudaFree(nullptr));
+
+    OptixDeviceContextOptions optixoptions = {};
+    optixoptions.logCallbackFunction       = &contextLogCb;
+    optixoptions.logCallbackLevel          = 4;
+    OPTIX_CHECK(optixDeviceContextCreate(nullptr, &optixoptions, &peer.context));
+    OPTIX_CHECK(optixDenoiserCreate(peer.context, OPTIX_DENOISER_MODEL_KIND_AOV, &m_denoiserOptions, &peer.denoiser));
+
+    CUDA_CHECK(cudaStreamCreateWithFlags(&peer.stream, cudaStreamNonBlocking));
+    CUDA_CHECK(cudaEventCreateWithFlags(&peer.done, cudaEventDisableTiming));
+    CUDA_CHECK(cudaMalloc((void**)&peer.intensity, sizeof(float)));
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Allocating the band buffers, state and scratch of the peers, for bands of m_tileExtent rows.
+// The peers not in use release their memory.
+//
+void DenoiserOptix::setupPeers()
+{
+  const uint32_t band_height = std::min(m_tileExtent.height + 2 * m_overlap, m_imageSize.height);  // With the overlap
+  for(uint32_t i = 0; i < m_peers.size(); i++)
+  {
+    PeerDevice& peer = m_peers[i];
+    if(peer.context == nullptr)
+      continue;
+
+    const bool       used = isSplit() && i < m_nbPeers;
+    ScopedCudaDevice scoped(peer.device);
+    CUDA_CHECK(cudaStreamSynchronize(peer.stream));
+
+    peer.sizes = {};
+    if(used)
+      OPTIX_CHECK(optixDenoiserComputeMemoryResources(peer.denoiser, m_tileExtent.width, m_tileExtent.height, &peer.sizes));
+    reserveDevice(peer.state, peer.stateCapacity, peer.sizes.stateSizeInBytes);
+    reserveDevice(peer.scratch, peer.scratchCapacity, peer.sizes.withOverlapScratchSizeInBytes);
+
+    const size_t nb_in_pixels  = used ? static_cast<size_t>(m_imageSize.width) * band_height : 0;
+    const size_t nb_out_pixels = used ? static_cast<size_t>(m_imageSize.width) * m_tileExtent.height : 0;
+    reserveDevice(peer.buf[0], peer.bufCapacity[0], nb_in_pixels * m_sizeofPixel);
+    reserveDevice(peer.buf[1], peer.bufCapacity[1], nb_in_pixels * m_sizeofGuide);
+    reserveDevice(peer.buf[2], peer.bufCapacity[2], nb_in_pixels * m_sizeofGuide);
+    reserveDevice(peer.buf[3], peer.bufCapacity[3], nb_out_pixels * m_sizeofPixel);
+
+    if(used)
+      OPTIX_CHECK(optixDenoiserSetup(peer.denoiser, peer.stream, m_tileExtent.width + 2 * m_overlap, m_tileExtent.height + 2 * m_overlap,
+                                     peer.state, peer.sizes.stateSizeInBytes, peer.scratch,
+                                     peer.sizes.withOverlapScratchSizeInBytes));
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//
+void DenoiserOptix::destroyPeers()
+{
+  for(PeerDevice& peer : m_peers)
+  {
+    if(peer.context == nullptr)
+      continue;
+
+    ScopedCudaDevice scoped(peer.device);
+    CUDA_CHECK(cudaStreamSynchronize(peer.stream));
+    reserveDevice(peer.state, peer.stateCapacity, 0);
+    reserveDevice(peer.scratch, peer.scratchCapacity, 0);
+    for(size_t b = 0; b < peer.buf.size(); b++)
+      reserveDevice(peer.buf[b], peer.bufCapacity[b], 0);
+    CUDA_CHECK(cudaFree((void*)peer.intensity));
+
+    optixDenoiserDestroy(peer.denoiser);
+    optixDeviceContextDestroy(peer.context);
+    CUDA_CHECK(cudaEventDestroy(peer.done));
+    CUDA_CHECK(cudaStreamDestroy(peer.stream));
+    peer = {.device = peer.device};
+  }
+  m_nbPeers = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Enabling the region of interest: the invocations then have an input offset, which needs the
+// scratch memory with overlap. Only the denoiser state is re-allocated.
+//
+void DenoiserOptix::setRegionEnabled(bool enabled)
+{
+  synchronize();  // Jobs in flight are run with the previous state
+  m_regionEnabled = enabled;
+  if(m_dStateBuffer == 0)
+    return;  // Buffers not allocated yet, will be done in allocateBuffers
+
+  setupState();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Region of interest clipped by the image, and to the size the state was set up for (a single tile).
+// Empty when outside of the image, the offset may be negative.
+//
+VkRect2D DenoiserOptix::clipRegion(const VkRect2D& region) const
+{
+  auto           clip = [](int64_t v, uint32_t size) { return static_cast<uint32_t>(std::clamp<int64_t>(v, 0, size)); };
+  const uint32_t x0   = clip(region.offset.x, m_imageSize.width);
+  const uint32_t y0   = clip(region.offset.y, m_imageSize.height);
+  const int64_t  rx1  = static_cast<int64_t>(region.offset.x) + region.extent.width;
+  const int64_t  ry1  = static_cast<int64_t>(region.offset.y) + region.extent.height;
+  const uint32_t x1   = std::max(x0, std::min(clip(rx1, m_imageSize.width), x0 + m_tileExtent.width));
+  const uint32_t y1   = std::max(y0, std::min(clip(ry1, m_imageSize.height), y0 + m_tileExtent.height));
+  return {{static_cast<int32_t>(x0), static_cast<int32_t>(y0)}, {x1 - x0, y1 - y0}};
+}
+
+//--------------------------------------------------------------------------------------------------
+// Denoising only the region of interest (clipped, see clipRegion). The region is denoised in place with
+// the pixels of the overlap window around it as context (inputOffsetX/Y), like a single tile. The rest
+// of the output is not written: it is read from the input when displayed (see displayRegion).
+// The intensity is still the one of the whole image, the region matching the exposure of the rest.
+//
+void DenoiserOptix::invokeRegion(const OptixDenoiserLayer& layer, const OptixDenoiserGuideLayer& guideLayer, const OptixDenoiserParams& params)
+{
+  // Rectangle [x0, x1) x [y0, y1) of an image
+  auto rect = [](OptixImage2D img, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+    img.data += static_cast<CUdeviceptr>(y0) * img.rowStrideInBytes + static_cast<CUdeviceptr>(x0) * img.pixelStrideInBytes;
+    img.width  = x1 - x0;
+    img.height = y1 - y0;
+    return img;
+  };
+
+  const VkRect2D& region = m_job.region;
+  const auto      x0     = static_cast<uint32_t>(region.offset.x);
+  const auto      y0     = static_cast<uint32_t>(region.offset.y);
+  const uint32_t  x1     = x0 + region.extent.width;
+  const uint32_t  y1     = y0 + region.extent.height;
+  if(x0 >= x1 || y0 >= y1)
+    return;  // Outside of the image
+
+  // Inputs extended by the overlap window to [ex0, ex1) x [ey0, ey1)
+  const uint32_t ex0 = x0 > m_overlap ? x0 - m_overlap : 0;
+  const uint32_t ey0 = y0 > m_overlap ? y0 - m_overlap : 0;
+  const uint32_t ex1 = std::min(x1 + m_overlap, m_imageSize.width);
+  const uint32_t ey1 = std::min(y1 + m_overlap, m_imageSize.height);
+
+  OptixDenoiserLayer      region_layer = layer;
+  OptixDenoiserGuideLayer region_guide = guideLayer;
+  region_layer.input  = rect(layer.input, ex0, ey0, ex1, ey1);
+  region_layer.output = rect(layer.output, x0, y0, x1, y1);
+  if(guideLayer.albedo.data != 0)
+    region_guide.albedo = rect(guideLayer.albedo, ex0, ey0, ex1, ey1);
+  if(guideLayer.normal.data != 0)
+    region_guide.normal = rect(guideLayer.normal, ex0, ey0, ex1, ey1);
+  OPTIX_CHECK(optixDenoiserInvoke(m_denoiser, m_cuStream, &params, m_dStateBuffer, m_denoiserSizes.stateSizeInBytes, &region_guide,
+                                  &region_layer, 1, x0 - ex0, y0 - ey0, m_dScratchBuffer, m_scratchSize));
+}
+
+//--------------------------------------------------------------------------------------------------
+// Quality ladder: creating (or releasing) the denoisers of the levels below eQualityFull. Their state
+// is set up with the one of the main denoiser.
+//
+void DenoiserOptix::setLadderEnabled(bool enabled)
+{
+  if(m_ladderEnabled == enabled)
+    return;
+  synchronize();  // Jobs in flight are run with the previous ladder
+  m_ladderEnabled = enabled;
+  if(m_optixDevice == nullptr)
+    return;  // Created with the denoiser in initOptiX
+
+  createLadder();
+  if(m_dStateBuffer != 0)
+    setupState();
+}
+
+void DenoiserOptix::createLadder()
+{
+  destroyLadder();
+  if(!m_ladderEnabled)
+    return;
 
-  // This is to use RGB + Albedo + Normal
-  m_denoiserOptions                 = options;
-  OptixDenoiserModelKind model_kind = hdr ? OPTIX_DENOISER_MODEL_KIND_HDR : OPTIX_DENOISER_MODEL_KIND_LDR;
-  model_kind                        = OPTIX_DENOISER_MODEL_KIND_AOV;
-  OPTIX_CHECK(optixDenoiserCreate(m_optixDevice, model_kind, &m_denoiserOptions, &m_denoiser));
+  OptixDenoiserOptions options = m_denoiserOptions;
+  options.guideAlbedo          = 0u;
+  options.guideNormal          = 0u;
 
+  OptixDenoiserModelKind motion_kind = OPTIX_DENOISER_MODEL_KIND_AOV;
+#if OPTIX_VERSION >= 80000
+  motion_kind = OPTIX_DENOISER_MODEL_KIND_UPSCALE2X;  // On a half resolution view of the input
+#endif
+  OPTIX_CHECK(optixDenoiserCreate(m_optixDevice, motion_kind, &options, &m_ladder[eQualityMotion].denoiser));
+  options.guideAlbedo = m_denoiserOptions.guideAlbedo;
+  OPTIX_CHECK(optixDenoiserCreate(m_optixDevice, OPTIX_DENOISER_MODEL_KIND_AOV, &options, &m_ladder[eQualityAlbedo].denoiser));
+}
 
-  return true;
+void DenoiserOptix::destroyLadder()
+{
+  for(LadderLevel& level : m_ladder)
+  {
+    if(level.denoiser != nullptr)
+      OPTIX_CHECK(optixDenoiserDestroy(level.denoiser));
+    reserveDevice(level.state, level.stateCapacity, 0);
+    level = {};
+  }
 }
 
 //--------------------------------------------------------------------------------------------------
-// Denoising the image in input and saving the denoised image in the output
+// Denoising with a level of the quality ladder, on the buffers of the main denoiser:
+// - albedo: the same layers without the normal, tiled as the main denoiser
+// - motion: the color of every other pixel of every other row (a strided view, no copy), upscaled 2x
+//   in the output. With an odd size, the last column or row is the noisy input.
 //
-void DenoiserOptix::denoiseImageBuffer(uint64_t& fenceValue, float blendFactor /*= 0.0f*/)
+void DenoiserOptix::invokeLadder(const OptixDenoiserLayer& layer, const OptixDenoiserGuideLayer& guideLayer, const OptixDenoiserParams& params)
 {
-  try
+  const LadderLevel&      level       = m_ladder[m_job.quality];
+  OptixDenoiserLayer      level_layer = layer;
+  OptixDenoiserGuideLayer level_guide = {};
+  if(m_job.quality == eQualityAlbedo)
   {
-    OptixPixelFormat pixel_format        = m_pixelFormat;
-    auto             sizeof_pixel        = m_sizeofPixel;
-    uint32_t         row_stride_in_bytes = sizeof_pixel * m_imageSize.width;
-
-    //std::vector<OptixImage2D> inputLayer;  // Order: RGB, Albedo, Normal
+    level_guide.albedo = guideLayer.albedo;
+    if(isTiled())
+    {
+      OPTIX_CHECK(optixUtilDenoiserInvokeTiled(level.denoiser, m_cuStream, &params, level.state, level.sizes.stateSizeInBytes,
+                                               &level_guide, &level_layer, 1, m_dScratchBuffer, m_scratchSize, m_overlap,
+                                               m_tileExtent.width, m_tileExtent.height));
+    }
+    else
+    {
+      OPTIX_CHECK(optixDenoiserInvoke(level.denoiser, m_cuStream, &params, level.state, level.sizes.stateSizeInBytes,
+                                      &level_guide, &level_layer, 1, 0, 0, m_dScratchBuffer, m_scratchSize));
+    }
+    return;
+  }
 
-    // Create and set our OptiX layers
-    OptixDenoiserLayer layer = {};
-    // Input
-    layer.input.data               = (CUdeviceptr)m_pixelBufferIn[0].cudaPtr;
-    layer.input.width              = m_imageSize.width;
-    layer.input.height             = m_imageSize.height;
-    layer.input.rowStrideInBytes   = row_stride_in_bytes;
-    layer.input.pixelStrideInBytes = m_sizeofPixel;
-    layer.input.format             = pixel_format;
+  OptixDenoiserParams level_params = params;
+#if OPTIX_VERSION >= 80000
+  const VkExtent2D half = level.setupSize;
+  if(2 * half.width != m_imageSize.width || 2 * half.height != m_imageSize.height)
+    CUDA_CHECK(cudaMemcpyAsync((void*)layer.output.data, (void*)layer.input.data,
+                               static_cast<size_t>(layer.input.rowStrideInBytes) * m_imageSize.height,
+                               cudaMemcpyDeviceToDevice, m_cuStream));
+  level_layer.input.width              = half.width;
+  level_layer.input.height             = half.height;
+  level_layer.input.rowStrideInBytes   = 2 * layer.input.rowStrideInBytes;
+  level_layer.input.pixelStrideInBytes = 2 * layer.input.pixelStrideInBytes;
+  level_layer.output.width             = 2 * half.width;
+  level_layer.output.height            = 2 * half.height;
+  level_params.blendFactor             = 0.0f;  // The input does not have the resolution of the output
+#endif
+  OPTIX_CHECK(optixDenoiserInvoke(level.denoiser, m_cuStream, &level_params, level.state, level.sizes.stateSizeInBytes,
+                                  &level_guide, &level_layer, 1, 0, 0, m_dScratchBuffer, m_scratchSize));
+}
 
-    // Output
-    layer.output.data               = (CUdeviceptr)m_pixelBufferOut.cudaPtr;
-    layer.output.width              = m_imageSize.width;
-    layer.output.height             = m_imageSize.height;
-    layer.output.rowStrideInBytes   = row_stride_in_bytes;
-    layer.output.pixelStrideInBytes = sizeof(float) * 4;
-    layer.output.format             = pixel_format;
+//--------------------------------------------------------------------------------------------------
+// Denoising the image in horizontal bands, one per device. Each band is denoised with the rows of
+// the overlap window above and below it (inputOffsetY), so there is no seam between the bands.
+// - The first band is denoised in place on m_cuStream.
+// - The peers copy their rows and the intensity from the interop buffers, denoise them on their own
+//   stream and copy the result back in the output buffer. m_cuStream waits for all of them.
+//
+void DenoiserOptix::invokeSplit(const OptixDenoiserLayer& layer, const OptixDenoiserGuideLayer& guideLayer, const OptixDenoiserParams& params)
+{
+  // Rows [y0, y1) of an image, at 'data' when the rows were copied
+  auto rows = [](OptixImage2D img, uint32_t y0, uint32_t y1, CUdeviceptr data) {
+    img.data   = data != 0 ? data : img.data + static_cast<CUdeviceptr>(y0) * img.rowStrideInBytes;
+    img.height = y1 - y0;
+    return img;
+  };
+  const std::array<const OptixImage2D*, 3> inputs = {&layer.input, &guideLayer.albedo, &guideLayer.normal};
 
+  // Inputs and intensity are ready
+  CUDA_CHECK(cudaEventRecord(m_splitReady, m_cuStream));
 
-    OptixDenoiserGuideLayer guide_layer = {};
-    // albedo
-    if(m_denoiserOptions.guideAlbedo != 0u)
+  const uint32_t nb_bands = m_nbPeers + 1;
+  for(uint32_t b = 0; b < nb_bands; b++)
+  {
+    // Band of rows [y0, y1), the inputs are extended by the overlap window to [ey0, ey1)
+    const uint32_t y0  = std::min(b * m_tileExtent.height, m_imageSize.height);
+    const uint32_t y1  = std::min(y0 + m_tileExtent.height, m_imageSize.height);
+    const uint32_t ey0 = y0 > m_overlap ? y0 - m_overlap : 0;
+    const uint32_t ey1 = std::min(y1 + m_overlap, m_imageSize.height);
+    if(y0 == y1)
+      continue;  // More devices than rows
+
+    OptixDenoiserLayer      band_layer = layer;
+    OptixDenoiserGuideLayer band_guide = guideLayer;
+    if(b == 0)
     {
-      guide_layer.albedo.data               = (CUdeviceptr)m_pixelBufferIn[1].cudaPtr;
-      guide_layer.albedo.width              = m_imageSize.width;
-      guide_layer.albedo.height             = m_imageSize.height;
-      guide_layer.albedo.rowStrideInBytes   = row_stride_in_bytes;
-      guide_layer.albedo.pixelStrideInBytes = m_sizeofPixel;
-      guide_layer.albedo.format             = pixel_format;
+      band_layer.input  = rows(layer.input, ey0, ey1, 0);
+      band_layer.output = rows(layer.output, y0, y1, 0);
+      if(guideLayer.albedo.data != 0)
+        band_guide.albedo = rows(guideLayer.albedo, ey0, ey1, 0);
+      if(guideLayer.normal.data != 0)
+        band_guide.normal = rows(guideLayer.normal, ey0, ey1, 0);
+      OPTIX_CHECK(optixDenoiserInvoke(m_denoiser, m_cuStream, &params, m_dStateBuffer, m_denoiserSizes.stateSizeInBytes,
+                                      &band_guide, &band_layer, 1, 0, y0 - ey0, m_dScratchBuffer, m_scratchSize));
+      continue;
     }
 
-    // normal
-    if(m_denoiserOptions.guideNormal != 0u)
+    PeerDevice&      peer = m_peers[b - 1];
+    ScopedCudaDevice scoped(peer.device);
+    CUDA_CHECK(cudaStreamWaitEvent(peer.stream, m_splitReady, 0));
+
+    // Rows of the band, staged through the host by CUDA if there is no peer access between the devices
+    for(size_t i = 0; i < inputs.size(); i++)
     {
-      guide_layer.normal.data               = (CUdeviceptr)m_pixelBufferIn[2].cudaPtr;
-      guide_layer.normal.width              = m_imageSize.width;
-      guide_layer.normal.height             = m_imageSize.height;
-      guide_layer.normal.rowStrideInBytes   = row_stride_in_bytes;
-      guide_layer.normal.pixelStrideInBytes = m_sizeofPixel;
-      guide_layer.normal.format             = pixel_format;
+      if(inputs[i]->data == 0)
+        continue;
+      const size_t stride = inputs[i]->rowStrideInBytes;
+      CUDA_CHECK(cudaMemcpyPeerAsync((void*)peer.buf[i], peer.device, (void*)(inputs[i]->data + ey0 * stride),
+                                     m_cudaDevice, (ey1 - ey0) * stride, peer.stream));
     }
-
-    // Wait from Vulkan (Copy to Buffer)
-    cudaExternalSemaphoreWaitParams wait_params{};
-    wait_params.flags              = 0;
-    wait_params.params.fence.value = fenceValue;
-    cudaWaitExternalSemaphoresAsync(&m_semaphore.cu, &wait_params, 1, nullptr);
-
-    if(m_dIntensity != 0)
+    OptixDenoiserParams peer_params = params;
+    if(params.hdrIntensity != 0)
     {
-      OPTIX_CHECK(optixDenoiserComputeIntensity(m_denoiser, m_cuStream, &layer.input, m_dIntensity, m_dScratchBuffer,
-                                                m_denoiserSizes.withoutOverlapScratchSizeInBytes));
+      CUDA_CHECK(cudaMemcpyPeerAsync((void*)peer.intensity, peer.device, (void*)params.hdrIntensity, m_cudaDevice,
+                                     sizeof(float), peer.stream));
+      peer_params.hdrIntensity = peer.intensity;
     }
 
-    OptixDenoiserParams denoiser_params{};
-#if OPTIX_VERSION < 80000
-    denoiser_params.denoiseAlpha = m_denoiserAlpha;
-#endif
-    denoiser_params.hdrIntensity = m_dIntensity;
-    denoiser_params.blendFactor  = blendFactor;
-
-
-    // Execute the denoiser
-    OPTIX_CHECK(optixDenoiserInvoke(m_denoiser, m_cuStream, &denoiser_params, m_dStateBuffer,
-                                    m_denoiserSizes.stateSizeInBytes, &guide_layer, &layer, 1, 0, 0, m_dScratchBuffer,
-                                    m_denoiserSizes.withoutOverlapScratchSizeInBytes));
-
+    band_layer.input  = rows(layer.input, ey0, ey1, peer.buf[0]);
+    band_layer.output = rows(layer.output, y0, y1, peer.buf[3]);
+    if(guideLayer.albedo.data != 0)
+      band_guide.albedo = rows(guideLayer.albedo, ey0, ey1, peer.buf[1]);
+    if(guideLayer.normal.data != 0)
+      band_guide.normal = rows(guideLayer.normal, ey0, ey1, peer.buf[2]);
+    OPTIX_CHECK(optixDenoiserInvoke(peer.denoiser, peer.stream, &peer_params, peer.state, peer.sizes.stateSizeInBytes,
+                                    &band_guide, &band_layer, 1, 0, y0 - ey0, peer.scratch,
+                                    peer.sizes.withOverlapScratchSizeInBytes));
+
+    // Denoised rows back in the output buffer
+    const size_t out_stride = layer.output.rowStrideInBytes;
+    CUDA_CHECK(cudaMemcpyPeerAsync((void*)(layer.output.data + y0 * out_stride), m_cudaDevice, (void*)peer.buf[3],
+                                   peer.device, (y1 - y0) * out_stride, peer.stream));
+    CUDA_CHECK(cudaEventRecord(peer.done, peer.stream));
+  }
 
-    CUDA_CHECK(cudaDeviceSynchronize());  // Making sure the denoiser is done
-    CUDA_CHECK(cudaStreamSynchronize(m_cuStream));
+  for(uint32_t i = 0; i < m_nbPeers; i++)
+    CUDA_CHECK(cudaStreamWaitEvent(m_cuStream, m_peers[i].done, 0));
+}
 
-    cudaExternalSemaphoreSignalParams sig_params{};
-    sig_params.flags              = 0;
-    sig_params.params.fence.value = ++fenceValue;
-    cudaSignalExternalSemaphoresAsync(&m_semaphore.cu, &sig_params, 1, m_cuStream);
-  }
-  catch(const std::exception& e)
+//--------------------------------------------------------------------------------------------------
+// Reading the CUDA events of a denoise, if they are still around and completed. The worker may re-record
+// the events of the slot meanwhile: its value is cleared first, so a slot still matching after the reads
+// held the events of this denoise. A read failing, on events re-recorded in between, is no sample.
+// A graph replay has no event between the intensity and the invoke: the intensity is unknown (-1).
+//
+bool DenoiserOptix::getTimings(uint64_t fenceValue, float& intensityMs, float& invokeMs)
+{
+  for(auto& te : m_timingEvents)
   {
-    std::cout << e.what() << std::endl;
+    if(te.fenceValue.load(std::memory_order_acquire) != fenceValue || fenceValue == 0)
+      continue;
+    if(cudaEventQuery(te.ev[2]) != cudaSuccess)
+      return false;  // Not finished (or failed)
+    bool ok;
+    if(te.graph.load(std::memory_order_relaxed))
+    {
+      intensityMs = -1.0F;
+      ok          = cudaEventElapsedTime(&invokeMs, te.ev[0], te.ev[2]) == cudaSuccess;
+    }
+    else
+    {
+      ok = cudaEventElapsedTime(&intensityMs, te.ev[0], te.ev[1]) == cudaSuccess
+           && cudaEventElapsedTime(&invokeMs, te.ev[1], te.ev[2]) == cudaSuccess;
+    }
+    if(!ok)
+    {
+      cudaGetLastError();  // Not leaving the error to the next CUDA_CHECK
+      return false;
+    }
+    return te.fenceValue.load(std::memory_order_acquire) == fenceValue;
   }
+  return false;
 }
 
 //--------------------------------------------------------------------------------------------------
-// Converting all images to buffers used by the denoiser
 //
-void DenoiserOptix::imageToBuffer(const VkCommandBuffer& cmdBuf, const std::vector<nvvk::Texture>& imgIn)
+//
+size_t DenoiserOptix::getCudaMemoryBytes() const
 {
-  LABEL_SCOPE_VK(cmdBuf);
-
-#if USE_COMPUTE_SHADER_TO_COPY
-  copyImageToBuffer(cmdBuf, imgIn);
-#else
-  VkBufferImageCopy region = {
-      .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .layerCount = 1},
-      .imageExtent      = {.width = m_imageSize.width, .height = m_imageSize.height, .depth = 1},
-  };
+  MemoryUsage usage = getMemoryUsage();
+  return usage.state + usage.scratch + usage.history + usage.other;
+}
 
-  for(int i = 0; i < static_cast<int>(imgIn.size()); i++)
+//--------------------------------------------------------------------------------------------------
+//
+//
+DenoiserOptix::MemoryUsage DenoiserOptix::getMemoryUsage() const
+{
+  MemoryUsage usage;
+  usage.interop = m_interopMemory.size;
+  if(m_dStateBuffer == 0)
+    return usage;
+
+  usage.state = m_stateCapacity;
+  for(const LadderLevel& level : m_ladder)
+    usage.state += level.stateCapacity;
+  usage.scratch = m_scratchCapacity;
+  usage.history = m_prevOutputCapacity + m_guideCapacity[0] + m_guideCapacity[1];
+  usage.other   = 4 * sizeof(float);  // m_dMinRGB
+  if(m_dIntensity != 0)
+    usage.other += sizeof(float);
+  if(m_dAvgColor != 0)
+    usage.other += 3 * sizeof(float);
+  for(const PeerDevice& peer : m_peers)
   {
-    nvvk::cmdBarrierImageLayout(cmdBuf, imgIn[i].image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-    vkCmdCopyImageToBuffer(cmdBuf, imgIn[i].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_pixelBufferIn[i].bufVk.buffer, 1, &region);
-    nvvk::cmdBarrierImageLayout(cmdBuf, imgIn[i].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+    usage.peers += peer.stateCapacity + peer.scratchCapacity + (peer.intensity != 0 ? sizeof(float) : 0);
+    for(size_t capacity : peer.bufCapacity)
+      usage.peers += capacity;
   }
-#endif
+  return usage;
 }
 
-
 //--------------------------------------------------------------------------------------------------
-// Converting the output buffer to the image
+// Same layout as allocateBuffers and setupState, with the headroom of the pooled allocations. The state and
+// scratch come from the current model: the upscale one (OptiX 8) may not be created, their sizes are close.
+// The levels of the quality ladder and the multi-GPU split are not counted.
 //
-void DenoiserOptix::bufferToImage(const VkCommandBuffer& cmdBuf, nvvk::Texture* imgOut)
+size_t DenoiserOptix::estimateMemoryBytes(const VkExtent2D& imgSize, OptixPixelFormat pixelFormat, uint32_t tileSize, bool upscale) const
 {
-  LABEL_SCOPE_VK(cmdBuf);
-
-#if USE_COMPUTE_SHADER_TO_COPY
-  copyBufferToImage(cmdBuf, imgOut);
-#else
-  VkBufferImageCopy region = {
-      .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .layerCount = 1},
-      .imageExtent      = {.width = m_imageSize.width, .height = m_imageSize.height, .depth = 1},
-  };
-
-  nvvk::cmdBarrierImageLayout(cmdBuf, imgOut->image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-  vkCmdCopyBufferToImage(cmdBuf, m_pixelBufferOut.bufVk.buffer, imgOut->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-  nvvk::cmdBarrierImageLayout(cmdBuf, imgOut->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+  const size_t nb_inputs   = static_cast<size_t>(imgSize.width) * imgSize.height;
+  const size_t nb_outputs  = upscale ? 4 * nb_inputs : nb_inputs;
+  const size_t pixel_bytes = sizeofPixel(pixelFormat);
+  const size_t guide_bytes = m_compactGuides ? 3 * sizeof(uint16_t) : pixel_bytes;
+
+  size_t interop = m_nbSets * ((1 + m_nbAovs) * (nb_inputs + nb_outputs) * pixel_bytes + 2 * nb_inputs * guide_bytes);
+  interop += m_nbSets * (m_temporal ? nb_inputs : 1) * 2 * sizeof(float);  // Motion vectors
+
+  VkExtent2D tile = imgSize;
+  if(tileSize > 0 && !m_temporal && !upscale)
+    tile = {std::min(tileSize, imgSize.width), std::min(tileSize, imgSize.height)};
+  const bool tiled = tile.width < imgSize.width || tile.height < imgSize.height || isRegion();
+
+  OptixDenoiserSizes sizes{};
+  OPTIX_CHECK(optixDenoiserComputeMemoryResources(m_denoiser, tile.width, tile.height, &sizes));
+  size_t scratch = tiled ? sizes.withOverlapScratchSizeInBytes : sizes.withoutOverlapScratchSizeInBytes;
+  scratch        = std::max({scratch, sizes.computeIntensitySizeInBytes, sizes.computeAverageColorSizeInBytes});
+
+  size_t history = 0;
+#if OPTIX_VERSION >= 70500
+  if(m_temporal)
+    history = nb_outputs * (pixel_bytes + 2 * sizes.internalGuideLayerPixelSizeInBytes);
 #endif
-}
 
+  return grownCapacity(interop) + grownCapacity(sizes.stateSizeInBytes) + grownCapacity(scratch) + grownCapacity(history);
+}
 
 //--------------------------------------------------------------------------------------------------
+// Number of interop buffer sets in the ring (at least one). The buffers must be re-allocated
+// after the call (see allocateBuffers).
 //
-//
-void DenoiserOptix::destroy()
+void DenoiserOptix::setInteropSetCount(uint32_t count)
 {
-  // Cleanup resources
-  optixDenoiserDestroy(m_denoiser);
-  optixDeviceContextDestroy(m_optixDevice);
-
-  vkDestroySemaphore(m_device, m_semaphore.vk, nullptr);
-  m_semaphore.vk = VK_NULL_HANDLE;
+  synchronize();  // The worker reads the sets
+  m_nbSets      = std::max(count, 1U);
+  m_setIdx      = 0;
+  m_denoisedSet = 0;
+}
 
-  destroyBuffer();
-  for(auto& d : m_desc)
-  {
-    vkDestroyDescriptorPool(m_device, d.pool, nullptr);
-    vkDestroyDescriptorSetLayout(m_device, d.layout, nullptr);
-    d.pool   = VK_NULL_HANDLE;
-    d.layout = VK_NULL_HANDLE;
-  }
-  for(auto& p : m_pipelines)
-  {
-    vkDestroyPipeline(m_device, p.p, nullptr);
-    vkDestroyPipelineLayout(m_device, p.layout, nullptr);
-    p.p      = VK_NULL_HANDLE;
-    p.layout = VK_NULL_HANDLE;
-  }
+//--------------------------------------------------------------------------------------------------
+// Number of light-path AOVs denoised with the color, each with an input and an output buffer per set.
+// The buffers must be re-allocated after the call (see allocateBuffers).
+//
+void DenoiserOptix::setAovCount(uint32_t count)
+{
+  synchronize();  // The worker denoises m_nbAovs layers of the sets
+  m_nbAovs = count;
 }
 
 //--------------------------------------------------------------------------------------------------
+// Output buffer of a set holding the layer to display (see setDisplayLayer), the beauty if out of range
 //
+const DenoiserOptix::BufferCuda& DenoiserOptix::displayBuffer(uint32_t set) const
+{
+  const InteropSet& s = m_sets[set];
+  return m_displayIdx > 0 && m_displayIdx <= s.aovOut.size() ? s.aovOut[m_displayIdx - 1] : s.out;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Rectangle [x0, x1) x [y0, y1) of the display buffer written by the last denoise of the set, the pixels
+// around it are read from the color input (region of interest). The whole image for the AOVs.
 //
-void DenoiserOptix::destroyBuffer()
+std::array<uint32_t, 4> DenoiserOptix::displayRegion(uint32_t set) const
 {
-  for(auto& p : m_pixelBufferIn)
-    p.destroy(m_allocEx);
-  m_pixelBufferOut.destroy(m_allocEx);
+  const InteropSet& s = m_sets[set];
+  if(&displayBuffer(set) != &s.out)
+    return {0, 0, m_outputSize.width, m_outputSize.height};
+  const uint32_t x0 = std::min(static_cast<uint32_t>(s.denoised.offset.x), m_outputSize.width);
+  const uint32_t y0 = std::min(static_cast<uint32_t>(s.denoised.offset.y), m_outputSize.height);
+  return {x0, y0, x0 + std::min(s.denoised.extent.width, m_outputSize.width - x0),
+          y0 + std::min(s.denoised.extent.height, m_outputSize.height - y0)};
+}
 
-  if(m_dStateBuffer != 0)
-  {
-    CUDA_CHECK(cudaFree((void*)m_dStateBuffer));
-    m_dStateBuffer = 0;
-  }
-  if(m_dScratchBuffer != 0)
-  {
-    CUDA_CHECK(cudaFree((void*)m_dScratchBuffer));
-    m_dScratchBuffer = 0;
-  }
-  if(m_dIntensity != 0)
-  {
-    CUDA_CHECK(cudaFree((void*)m_dIntensity));
-    m_dIntensity = 0;
-  }
-  if(m_dMinRGB != 0)
+//--------------------------------------------------------------------------------------------------
+// The output of a set to the host: around the region of interest, the pixels are the color input
+//
+void DenoiserOptix::copyOutputToHost(void* host, const InteropSet& set, cudaStream_t stream)
+{
+  const VkRect2D& r = set.denoised;
+  if(r.offset.x == 0 && r.offset.y == 0 && r.extent.width >= m_outputSize.width && r.extent.height >= m_outputSize.height)
   {
-    CUDA_CHECK(cudaFree((void*)m_dMinRGB));
-    m_dMinRGB = 0;
+    CUDA_CHECK(cudaMemcpyAsync(host, set.out.cudaPtr, m_outputBytes, cudaMemcpyDefault, stream));
+    return;
   }
+
+  CUDA_CHECK(cudaMemcpyAsync(host, set.in[0].cudaPtr, m_inputBytes, cudaMemcpyDefault, stream));
+  if(r.extent.width == 0 || r.extent.height == 0)
+    return;
+  const size_t pitch  = static_cast<size_t>(m_outputSize.width) * m_sizeofPixel;
+  const size_t offset = static_cast<size_t>(r.offset.y) * pitch + static_cast<size_t>(r.offset.x) * m_sizeofPixel;
+  CUDA_CHECK(cudaMemcpy2DAsync(static_cast<uint8_t*>(host) + offset, pitch, static_cast<const uint8_t*>(set.out.cudaPtr) + offset,
+                               pitch, static_cast<size_t>(r.extent.width) * m_sizeofPixel, r.extent.height, cudaMemcpyDefault, stream));
 }
 
+
 //--------------------------------------------------------------------------------------------------
-// UI specific for the denoiser
+// All the interop buffers with the size they need: color, albedo, normal, output, AOVs and motion vectors
+// of each set. They are all placed in the same memory block.
 //
-bool DenoiserOptix::uiSetup()
+std::vector<std::pair<DenoiserOptix::BufferCuda*, VkDeviceSize>> DenoiserOptix::interopBuffers()
 {
-  bool modified = false;
-  if(ImGui::CollapsingHeader("Denoiser", ImGuiTreeNodeFlags_DefaultOpen))
+  std::vector<std::pair<BufferCuda*, VkDeviceSize>> buffers;
+  for(auto& set : m_sets)
   {
-    modified |= ImGuiH::Control::Checkbox("Denoise", "", reinterpret_cast<bool*>(&m_denoisedMode));
-    modified |= ImGuiH::Control::Slider("Start Frame", "Frame at which the denoiser starts to be applied",
-                                        &m_startDenoiserFrame, nullptr, ImGuiH::Control::Flags::Normal, 0, 99);
+    buffers.push_back({&set.in[0], m_inputBytes});
+    buffers.push_back({&set.in[1], m_guideBytes});
+    buffers.push_back({&set.in[2], m_guideBytes});
+    buffers.push_back({&set.out, m_outputBytes});
+    for(auto& aov : set.aovIn)
+      buffers.push_back({&aov, m_inputBytes});
+    for(auto& aov : set.aovOut)
+      buffers.push_back({&aov, m_outputBytes});
+    buffers.push_back({&set.flow, m_flowBytes});
   }
-  return modified;
+  return buffers;
 }
 
 //--------------------------------------------------------------------------------------------------
-// Allocating all the buffers in which the images will be transfered.
-// The buffers are shared with Cuda, therefore OptiX can denoised them
+// Create the Vulkan buffers, with some headroom, and a single exportable memory block for all of them,
+// at aligned offsets. The block is imported and mapped only once in CUDA, each buffer points in the mapping.
 //
-void DenoiserOptix::allocateBuffers(const VkExtent2D& imgSize)
+void DenoiserOptix::createInteropMemory()
 {
-  m_imageSize = imgSize;
-
-  destroyBuffer();
-
-  VkDeviceSize buffer_size = static_cast<VkDeviceSize>(m_imageSize.width) * m_imageSize.height * 4 * sizeof(float);
-  VkBufferUsageFlags usage{VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT};
+#ifdef WIN32
+  const VkExternalMemoryHandleTypeFlagBits handle_type = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+#else
+  const VkExternalMemoryHandleTypeFlagBits handle_type = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+#endif
 
-  {  // Color
-    m_pixelBufferIn[0].bufVk = m_allocEx.createBuffer(buffer_size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    createBufferCuda(m_pixelBufferIn[0]);  // Exporting the buffer to Cuda handle and pointers
-    NAME_VK(m_pixelBufferIn[0].bufVk.buffer);
-  }
+  VkExternalMemoryBufferCreateInfo external_info{.sType       = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+                                                 .handleTypes = static_cast<VkExternalMemoryHandleTypeFlags>(handle_type)};
+  VkBufferCreateInfo buffer_info{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = &external_info,
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+  };
 
-  // Albedo
+  // Layout of the buffers in the block
+  VkDeviceSize block_size = 0;
+  uint32_t     type_bits  = ~0U;
+  for(auto& [buf, size] : interopBuffers())
   {
-    m_pixelBufferIn[1].bufVk = m_allocEx.createBuffer(buffer_size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    createBufferCuda(m_pixelBufferIn[1]);
-    NAME_VK(m_pixelBufferIn[1].bufVk.buffer);
+    buf->capacity    = grownCapacity(size);
+    buffer_info.size = buf->capacity;
+    NVVK_CHECK(vkCreateBuffer(m_device, &buffer_info, nullptr, &buf->bufVk.buffer));
+
+    VkMemoryRequirements memory_req{};
+    vkGetBufferMemoryRequirements(m_device, buf->bufVk.buffer, &memory_req);
+    buf->offset = (block_size + memory_req.alignment - 1) / memory_req.alignment * memory_req.alignment;
+    block_size  = buf->offset + memory_req.size;
+    type_bits &= memory_req.memoryTypeBits;
   }
-  // Normal
+
+  VkPhysicalDeviceMemoryProperties memory_props{};
+  vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &memory_props);
+  uint32_t memory_type = ~0U;
+  for(uint32_t i = 0; i < memory_props.memoryTypeCount && memory_type == ~0U; i++)
   {
-    m_pixelBufferIn[2].bufVk = m_allocEx.createBuffer(buffer_size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    createBufferCuda(m_pixelBufferIn[2]);
-    NAME_VK(m_pixelBufferIn[2].bufVk.buffer);
+    if((type_bits & (1U << i)) != 0 && (memory_props.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0)
+      memory_type = i;
   }
-
-  // Output image/buffer
-  m_pixelBufferOut.bufVk = m_allocEx.createBuffer(buffer_size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-  createBufferCuda(m_pixelBufferOut);
-  NAME_VK(m_pixelBufferOut.bufVk.buffer);
-
-
-  // Computing the amount of memory needed to do the denoiser
-  OPTIX_CHECK(optixDenoiserComputeMemoryResources(m_denoiser, m_imageSize.width, m_imageSize.height, &m_denoiserSizes));
-
-  CUDA_CHECK(cudaMalloc((void**)&m_dStateBuffer, m_denoiserSizes.stateSizeInBytes));
-  CUDA_CHECK(cudaMalloc((void**)&m_dScratchBuffer, m_denoiserSizes.withoutOverlapScratchSizeInBytes));
-  CUDA_CHECK(cudaMalloc((void**)&m_dMinRGB, 4 * sizeof(float)));
-  if(m_pixelFormat == OPTIX_PIXEL_FORMAT_FLOAT3 || m_pixelFormat == OPTIX_PIXEL_FORMAT_FLOAT4)
-    CUDA_CHECK(cudaMalloc((void**)&m_dIntensity, sizeof(float)));
-
-  OPTIX_CHECK(optixDenoiserSetup(m_denoiser, m_cuStream, m_imageSize.width, m_imageSize.height, m_dStateBuffer,
-                                 m_denoiserSizes.stateSizeInBytes, m_dScratchBuffer, m_denoiserSizes.withoutOverlapScratchSizeInBytes));
-}
-
-
-//--------------------------------------------------------------------------------------------------
-// Get the Vulkan buffer and create the Cuda equivalent using the memory allocated in Vulkan
-//
-void DenoiserOptix::createBufferCuda(BufferCuda& buf)
-{
-  nvvk::MemAllocator::MemInfo mem_info = m_allocEx.getMemoryAllocator()->getMemoryInfo(buf.bufVk.memHandle);
+  if(memory_type == ~0U)
+    throw std::runtime_error("No device local memory type for the interop buffers");
+
+  VkExportMemoryAllocateInfo export_info{.sType       = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO,
+                                         .handleTypes = static_cast<VkExternalMemoryHandleTypeFlags>(handle_type)};
+  VkMemoryAllocateInfo alloc_info{.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+                                  .pNext           = &export_info,
+                                  .allocationSize  = block_size,
+                                  .memoryTypeIndex = memory_type};
+  NVVK_CHECK(vkAllocateMemory(m_device, &alloc_info, nullptr, &m_interopMemory.memory));
+  m_interopMemory.size = block_size;
+  NAME_VK(m_interopMemory.memory);
+
+  for(auto& [buf, size] : interopBuffers())
+    NVVK_CHECK(vkBindBufferMemory(m_device, buf->bufVk.buffer, m_interopMemory.memory, buf->offset));
+
+  // Exporting the block to a Cuda handle, importing and mapping it
 #ifdef WIN32
   VkMemoryGetWin32HandleInfoKHR info{VK_STRUCTURE_TYPE_MEMORY_GET_WIN32_HANDLE_INFO_KHR};
-  info.memory     = mem_info.memory;
-  info.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT;
-  vkGetMemoryWin32HandleKHR(m_device, &info, &buf.handle);
+  info.memory     = m_interopMemory.memory;
+  info.handleType = handle_type;
+  vkGetMemoryWin32HandleKHR(m_device, &info, &m_interopMemory.handle);
 #else
   VkMemoryGetFdInfoKHR info{VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR};
-  info.memory     = mem_info.memory;
-  info.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
-  vkGetMemoryFdKHR(m_device, &info, &buf.handle);
+  info.memory     = m_interopMemory.memory;
+  info.handleType = handle_type;
+  vkGetMemoryFdKHR(m_device, &info, &m_interopMemory.handle);
 #endif
 
-  VkMemoryRequirements memory_req{};
-  vkGetBufferMemoryRequirements(m_device, buf.bufVk.buffer, &memory_req);
-
   cudaExternalMemoryHandleDesc cuda_ext_mem_handle_desc{};
-  cuda_ext_mem_handle_desc.size = memory_req.size;
+  cuda_ext_mem_handle_desc.size = block_size;
 #ifdef WIN32
   cuda_ext_mem_handle_desc.type                = cudaExternalMemoryHandleTypeOpaqueWin32;
-  cuda_ext_mem_handle_desc.handle.win32.handle = buf.handle;
+  cuda_ext_mem_handle_desc.handle.win32.handle = m_interopMemory.handle;
 #else
   cuda_ext_mem_handle_desc.type      = cudaExternalMemoryHandleTypeOpaqueFd;
-  cuda_ext_mem_handle_desc.handle.fd = buf.handle;
+  cuda_ext_mem_handle_desc.handle.fd = m_interopMemory.handle;
 #endif
-
-  cudaExternalMemory_t cuda_ext_mem_vertex_buffer{};
-  CUDA_CHECK(cudaImportExternalMemory(&cuda_ext_mem_vertex_buffer, &cuda_ext_mem_handle_desc));
+  CUDA_CHECK(cudaImportExternalMemory(&m_interopMemory.cuMem, &cuda_ext_mem_handle_desc));
 
 #ifndef WIN32
   // fd got consumed
-  cuda_ext_mem_handle_desc.handle.fd = -1;
+  m_interopMemory.handle = -1;
 #endif
 
   cudaExternalMemoryBufferDesc cuda_ext_buffer_desc{};
   cuda_ext_buffer_desc.offset = 0;
-  cuda_ext_buffer_desc.size   = memory_req.size;
+  cuda_ext_buffer_desc.size   = block_size;
   cuda_ext_buffer_desc.flags  = 0;
-  CUDA_CHECK(cudaExternalMemoryGetMappedBuffer(&buf.cudaPtr, cuda_ext_mem_vertex_buffer, &cuda_ext_buffer_desc));
+  CUDA_CHECK(cudaExternalMemoryGetMappedBuffer(&m_interopMemory.cudaPtr, m_interopMemory.cuMem, &cuda_ext_buffer_desc));
+
+  for(auto& [buf, size] : interopBuffers())
+    buf->cudaPtr = static_cast<char*>(m_interopMemory.cudaPtr) + buf->offset;
+
+  for(uint32_t i = 0; i < static_cast<uint32_t>(m_sets.size()); i++)
+  {
+    for(auto& buf : m_sets[i].in)
+      NAME_IDX_VK(buf.bufVk.buffer, i);
+    NAME_IDX_VK(m_sets[i].out.bufVk.buffer, i);
+    for(auto& buf : m_sets[i].aovIn)
+      NAME_IDX_VK(buf.bufVk.buffer, i);
+    for(auto& buf : m_sets[i].aovOut)
+      NAME_IDX_VK(buf.bufVk.buffer, i);
+    NAME_IDX_VK(m_sets[i].flow.bufVk.buffer, i);
+  }
+}
+
+void DenoiserOptix::destroyInteropMemory()
+{
+  for(auto& [buf, size] : interopBuffers())
+    buf->destroy(m_device);
+
+  if(m_interopMemory.cuMem != nullptr)
+  {
+    CUDA_CHECK(cudaFree(m_interopMemory.cudaPtr));
+    CUDA_CHECK(cudaDestroyExternalMemory(m_interopMemory.cuMem));
+  }
+#ifdef WIN32
+  if(m_interopMemory.handle != nullptr)
+    CloseHandle(m_interopMemory.handle);
+#else
+  if(m_interopMemory.handle != -1)
+    close(m_interopMemory.handle);
+#endif
+  vkFreeMemory(m_device, m_interopMemory.memory, nullptr);
+  m_interopMemory = {};
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -479,8 +1841,10 @@ void DenoiserOptix::createSemaphore()
   auto handle_type = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT;
 #endif
 
+  // Timeline semaphore: Vulkan and CUDA wait and signal increasing values, which allows
+  // Vulkan to submit work waiting on CUDA before the CUDA signal was even enqueued.
   VkSemaphoreTypeCreateInfo timeline_create_info{.sType         = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
-                                                 .semaphoreType = VK_SEMAPHORE_TYPE_BINARY,
+                                                 .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
                                                  .initialValue  = 0};
 
   VkExportSemaphoreCreateInfo esci{.sType       = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO_KHR,
@@ -508,10 +1872,10 @@ void DenoiserOptix::createSemaphore()
   std::memset(&external_semaphore_handle_desc, 0, sizeof(external_semaphore_handle_desc));
   external_semaphore_handle_desc.flags = 0;
 #ifdef WIN32
-  external_semaphore_handle_desc.type                = cudaExternalSemaphoreHandleTypeOpaqueWin32;
+  external_semaphore_handle_desc.type                = cudaExternalSemaphoreHandleTypeTimelineSemaphoreWin32;
   external_semaphore_handle_desc.handle.win32.handle = static_cast<void*>(m_semaphore.handle);
 #else
-  external_semaphore_handle_desc.type      = cudaExternalSemaphoreHandleTypeOpaqueFd;
+  external_semaphore_handle_desc.type      = cudaExternalSemaphoreHandleTypeTimelineSemaphoreFd;
   external_semaphore_handle_desc.handle.fd = m_semaphore.handle;
 #endif
 
@@ -523,6 +1887,36 @@ void DenoiserOptix::createSemaphore()
 ///
 void DenoiserOptix::createCopyPipeline()
 {
+  destroyCopyPipeline();
+
+  // The shaders are specialized for the format of the buffers
+  struct CopySpecialization
+  {
+    int32_t  nbChannels;
+    VkBool32 useHalf;
+    int32_t  guideNbChannels;  // Albedo and normal
+    VkBool32 guideUseHalf;
+  } spec_data{};
+  spec_data.nbChannels = (m_pixelFormat == OPTIX_PIXEL_FORMAT_FLOAT3 || m_pixelFormat == OPTIX_PIXEL_FORMAT_HALF3) ? 3 : 4;
+  spec_data.useHalf = (m_pixelFormat == OPTIX_PIXEL_FORMAT_HALF3 || m_pixelFormat == OPTIX_PIXEL_FORMAT_HALF4) ? VK_TRUE : VK_FALSE;
+  spec_data.guideNbChannels = (m_guideFormat == OPTIX_PIXEL_FORMAT_FLOAT3 || m_guideFormat == OPTIX_PIXEL_FORMAT_HALF3) ? 3 : 4;
+  spec_data.guideUseHalf =
+      (m_guideFormat == OPTIX_PIXEL_FORMAT_HALF3 || m_guideFormat == OPTIX_PIXEL_FORMAT_HALF4) ? VK_TRUE : VK_FALSE;
+  assert(m_pixelFormat != OPTIX_PIXEL_FORMAT_UCHAR3 && m_pixelFormat != OPTIX_PIXEL_FORMAT_UCHAR4);  // Not supported by the shaders
+
+  std::array<VkSpecializationMapEntry, 4> spec_entries{{
+      {0, offsetof(CopySpecialization, nbChannels), sizeof(int32_t)},
+      {1, offsetof(CopySpecialization, useHalf), sizeof(VkBool32)},
+      {2, offsetof(CopySpecialization, guideNbChannels), sizeof(int32_t)},
+      {3, offsetof(CopySpecialization, guideUseHalf), sizeof(VkBool32)},
+  }};
+  VkSpecializationInfo spec_info{
+      .mapEntryCount = static_cast<uint32_t>(spec_entries.size()),
+      .pMapEntries   = spec_entries.data(),
+      .dataSize      = sizeof(CopySpecialization),
+      .pData         = &spec_data,
+  };
+
   {
     // Descriptor Set
     nvvk::DescriptorSetBindings bind;
@@ -536,11 +1930,14 @@ void DenoiserOptix::createCopyPipeline()
     CREATE_NAMED_VK(m_desc[eCpyToBuffer].pool, bind.createPool(m_device, 1));
     CREATE_NAMED_VK(m_desc[eCpyToBuffer].layout, bind.createLayout(m_device, VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR));
 
-    // Pipeline
+    // Pipeline, pushing whether the guides are copied
+    VkPushConstantRange        push_range{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(int32_t)};
     VkPipelineLayoutCreateInfo pipe_info{
-        .sType          = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 1,
-        .pSetLayouts    = &m_desc[eCpyToBuffer].layout,
+        .sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount         = 1,
+        .pSetLayouts            = &m_desc[eCpyToBuffer].layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges    = &push_range,
     };
     vkCreatePipelineLayout(m_device, &pipe_info, nullptr, &m_pipelines[eCpyToBuffer].layout);
     NAME_VK(m_pipelines[eCpyToBuffer].layout);
@@ -550,6 +1947,7 @@ void DenoiserOptix::createCopyPipeline()
         .stage  = VK_SHADER_STAGE_COMPUTE_BIT,
         .module = nvvk::createShaderModule(m_device, cpy_to_buffer_comp, sizeof(cpy_to_buffer_comp)),
         .pName  = "main",
+        .pSpecializationInfo = &spec_info,
     };
 
     VkComputePipelineCreateInfo comp_info{
@@ -558,26 +1956,30 @@ void DenoiserOptix::createCopyPipeline()
         .layout = m_pipelines[eCpyToBuffer].layout,
     };
 
-    vkCreateComputePipelines(m_device, {}, 1, &comp_info, nullptr, &m_pipelines[eCpyToBuffer].p);
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &comp_info, nullptr, &m_pipelines[eCpyToBuffer].p);
     NAME_VK(m_pipelines[eCpyToBuffer].p);
 
     vkDestroyShaderModule(m_device, comp_info.stage.module, nullptr);
   }
 
   {
-    // Descriptor Set
+    // Descriptor Set: the image, the output and the color input (around the region of interest)
     nvvk::DescriptorSetBindings bind;
     bind.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);
     bind.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    bind.addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
 
     CREATE_NAMED_VK(m_desc[eCpyToImage].pool, bind.createPool(m_device, 1));
     CREATE_NAMED_VK(m_desc[eCpyToImage].layout, bind.createLayout(m_device, VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR));
 
-    // Pipeline
+    // Pipeline, pushing the denoised rectangle (see displayRegion)
+    VkPushConstantRange        push_range{VK_SHADER_STAGE_COMPUTE_BIT, 0, 4 * sizeof(uint32_t)};
     VkPipelineLayoutCreateInfo pipe_info{
-        .sType          = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 1,
-        .pSetLayouts    = &m_desc[eCpyToImage].layout,
+        .sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount         = 1,
+        .pSetLayouts            = &m_desc[eCpyToImage].layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges    = &push_range,
     };
     vkCreatePipelineLayout(m_device, &pipe_info, nullptr, &m_pipelines[eCpyToImage].layout);
     NAME_VK(m_pipelines[eCpyToImage].layout);
@@ -587,6 +1989,7 @@ void DenoiserOptix::createCopyPipeline()
         .stage  = VK_SHADER_STAGE_COMPUTE_BIT,
         .module = nvvk::createShaderModule(m_device, cpy_to_img_comp, sizeof(cpy_to_img_comp)),
         .pName  = "main",
+        .pSpecializationInfo = &spec_info,
     };
 
     VkComputePipelineCreateInfo comp_info{
@@ -594,11 +1997,52 @@ void DenoiserOptix::createCopyPipeline()
         .stage  = stage_info,
         .layout = m_pipelines[eCpyToImage].layout,
     };
-    vkCreateComputePipelines(m_device, {}, 1, &comp_info, nullptr, &m_pipelines[eCpyToImage].p);
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &comp_info, nullptr, &m_pipelines[eCpyToImage].p);
     NAME_VK(m_pipelines[eCpyToImage].p);
 
     vkDestroyShaderModule(m_device, comp_info.stage.module, nullptr);
   }
+
+  {
+    // Descriptor Set: same as eCpyToImage, the image being the LDR one
+    nvvk::DescriptorSetBindings bind;
+    bind.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    bind.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    bind.addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+
+    CREATE_NAMED_VK(m_desc[eCpyToImageTonemap].pool, bind.createPool(m_device, 1));
+    CREATE_NAMED_VK(m_desc[eCpyToImageTonemap].layout, bind.createLayout(m_device, VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR));
+
+    // Pipeline, the denoised rectangle and the tonemapper settings are pushed
+    VkPushConstantRange        push_range{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(TonemapPush)};
+    VkPipelineLayoutCreateInfo pipe_info{
+        .sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount         = 1,
+        .pSetLayouts            = &m_desc[eCpyToImageTonemap].layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges    = &push_range,
+    };
+    vkCreatePipelineLayout(m_device, &pipe_info, nullptr, &m_pipelines[eCpyToImageTonemap].layout);
+    NAME_VK(m_pipelines[eCpyToImageTonemap].layout);
+
+    VkPipelineShaderStageCreateInfo stage_info{
+        .sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage  = VK_SHADER_STAGE_COMPUTE_BIT,
+        .module = nvvk::createShaderModule(m_device, cpy_to_img_tonemap_comp, sizeof(cpy_to_img_tonemap_comp)),
+        .pName  = "main",
+        .pSpecializationInfo = &spec_info,
+    };
+
+    VkComputePipelineCreateInfo comp_info{
+        .sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage  = stage_info,
+        .layout = m_pipelines[eCpyToImageTonemap].layout,
+    };
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &comp_info, nullptr, &m_pipelines[eCpyToImageTonemap].p);
+    NAME_VK(m_pipelines[eCpyToImageTonemap].p);
+
+    vkDestroyShaderModule(m_device, comp_info.stage.module, nullptr);
+  }
 }
 
 VkWriteDescriptorSet makeWrite(const VkDescriptorSet& set, uint32_t bind, const VkDescriptorImageInfo* img)
@@ -639,9 +2083,9 @@ void DenoiserOptix::copyImageToBuffer(const VkCommandBuffer& cmd, const std::vec
   VkDescriptorImageInfo  img0 = imgIn[0].descriptor;
   VkDescriptorImageInfo  img1 = imgIn[1].descriptor;
   VkDescriptorImageInfo  img2 = imgIn[2].descriptor;
-  VkDescriptorBufferInfo buf0 = {.buffer = m_pixelBufferIn[0].bufVk.buffer, .range = VK_WHOLE_SIZE};
-  VkDescriptorBufferInfo buf1 = {.buffer = m_pixelBufferIn[1].bufVk.buffer, .range = VK_WHOLE_SIZE};
-  VkDescriptorBufferInfo buf2 = {.buffer = m_pixelBufferIn[2].bufVk.buffer, .range = VK_WHOLE_SIZE};
+  VkDescriptorBufferInfo buf0 = {.buffer = m_sets[m_setIdx].in[0].bufVk.buffer, .range = m_inputBytes};
+  VkDescriptorBufferInfo buf1 = {.buffer = m_sets[m_setIdx].in[1].bufVk.buffer, .range = m_guideBytes};
+  VkDescriptorBufferInfo buf2 = {.buffer = m_sets[m_setIdx].in[2].bufVk.buffer, .range = m_guideBytes};
 
   std::vector<VkWriteDescriptorSet> writes;
   writes.emplace_back(makeWrite({}, 0, &img0));
@@ -652,9 +2096,12 @@ void DenoiserOptix::copyImageToBuffer(const VkCommandBuffer& cmd, const std::vec
   writes.emplace_back(makeWrite({}, 5, &buf2));
   vkCmdPushDescriptorSetKHR(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines[eCpyToBuffer].layout, 0,
                             static_cast<uint32_t>(writes.size()), writes.data());
+  const int32_t copy_guides = m_sets[m_setIdx].guidesValid ? 0 : 1;  // Only the color when the guides are unchanged
+  vkCmdPushConstants(cmd, m_pipelines[eCpyToBuffer].layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(int32_t), &copy_guides);
   vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines[eCpyToBuffer].p);
   auto grid = getGridSize(m_imageSize);
   vkCmdDispatch(cmd, grid.width, grid.height, 1);
+  m_sets[m_setIdx].guidesValid = true;
 }
 
 
@@ -664,15 +2111,45 @@ void DenoiserOptix::copyImageToBuffer(const VkCommandBuffer& cmd, const std::vec
 void DenoiserOptix::copyBufferToImage(const VkCommandBuffer& cmd, const nvvk::Texture* imgIn)
 {
   VkDescriptorImageInfo  img0 = imgIn->descriptor;
-  VkDescriptorBufferInfo buf0 = {.buffer = m_pixelBufferOut.bufVk.buffer, .range = VK_WHOLE_SIZE};
+  VkDescriptorBufferInfo buf0 = {.buffer = displayBuffer(m_setIdx).bufVk.buffer, .range = m_outputBytes};
+  VkDescriptorBufferInfo buf1 = {.buffer = m_sets[m_setIdx].in[0].bufVk.buffer, .range = m_inputBytes};
 
   std::vector<VkWriteDescriptorSet> writes;
   writes.emplace_back(makeWrite({}, 0, &img0));
   writes.emplace_back(makeWrite({}, 1, &buf0));
+  writes.emplace_back(makeWrite({}, 2, &buf1));
   vkCmdPushDescriptorSetKHR(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines[eCpyToImage].layout, 0,
                             static_cast<uint32_t>(writes.size()), writes.data());
+  const std::array<uint32_t, 4> region = displayRegion(m_setIdx);
+  vkCmdPushConstants(cmd, m_pipelines[eCpyToImage].layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(region), region.data());
   vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines[eCpyToImage].p);
-  auto grid = getGridSize(m_imageSize);
+  auto grid = getGridSize(m_outputSize);
+  vkCmdDispatch(cmd, grid.width, grid.height, 1);
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Fused copy of the denoised buffer and tonemapper, writing the LDR image (see cpy_to_img_tonemap.comp).
+// Reads the set of the last denoise, also when the current set already moved to the next one.
+//
+void DenoiserOptix::tonemapBufferToImage(const VkCommandBuffer& cmd, const nvvk::Texture* ldrOut, const nvvkhl_shaders::Tonemapper& tonemapper)
+{
+  LABEL_SCOPE_VK(cmd);
+
+  VkDescriptorImageInfo  img0 = ldrOut->descriptor;
+  VkDescriptorBufferInfo buf0 = {.buffer = displayBuffer(m_denoisedSet).bufVk.buffer, .range = m_outputBytes};
+  VkDescriptorBufferInfo buf1 = {.buffer = m_sets[m_denoisedSet].in[0].bufVk.buffer, .range = m_inputBytes};
+
+  std::vector<VkWriteDescriptorSet> writes;
+  writes.emplace_back(makeWrite({}, 0, &img0));
+  writes.emplace_back(makeWrite({}, 1, &buf0));
+  writes.emplace_back(makeWrite({}, 2, &buf1));
+  vkCmdPushDescriptorSetKHR(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines[eCpyToImageTonemap].layout, 0,
+                            static_cast<uint32_t>(writes.size()), writes.data());
+  const TonemapPush push{displayRegion(m_denoisedSet), tonemapper};
+  vkCmdPushConstants(cmd, m_pipelines[eCpyToImageTonemap].layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines[eCpyToImageTonemap].p);
+  auto grid = getGridSize(m_outputSize);
   vkCmdDispatch(cmd, grid.width, grid.height, 1);
 }
 
@@ -24,11 +24,16 @@
 
 
 #include <array>
+#include <atomic>
 #include <iomanip>   // cerr
 #include <iostream>  // setw
+#include <thread>
 
 #include "nvvk/resourceallocator_vk.hpp"
-#include "nvvk/memallocator_dedicated_vk.hpp"
+
+namespace nvvkhl_shaders {
+struct Tonemapper;
+}
 
 #ifdef LINUX
 #include <unistd.h>
@@ -39,13 +44,14 @@
 
 #include "imgui.h"
 
-// for interop we use the dedicated allocator as well
 #include "nvvk/debug_util_vk.hpp"
 #include "nvvk/images_vk.hpp"
 #include "nvvk/context_vk.hpp"
 #include "optix_types.h"
 #include <driver_types.h>
 
+#include "spsc_ring.hpp"
+
 
 #define OPTIX_CHECK(call)                                                                                              \
   do                                                                                                                   \
@@ -100,7 +106,11 @@ struct DenoiserOptix
 
   void setup(const VkDevice& device, const VkPhysicalDevice& physicalDevice, uint32_t queueIndex);
   bool initOptiX(const OptixDenoiserOptions& options, OptixPixelFormat pixelFormat, bool hdr);
-  void denoiseImageBuffer(uint64_t& fenceValue, float blendFactor = 0.0f);
+  void bindCudaDevice() const;
+  void setPixelFormat(OptixPixelFormat pixelFormat);
+  void setCompactGuides(bool compact);
+  void setDenoiserMode(bool temporal, bool upscale);
+  void denoiseImageBuffer(uint64_t& fenceValue, float blendFactor = 0.0f, bool hostSync = false);
   void createSemaphore();
 
   void destroy();
@@ -109,50 +119,230 @@ struct DenoiserOptix
   bool uiSetup();
 
   void allocateBuffers(const VkExtent2D& imgSize);
+  void setTileSize(uint32_t tileSize);
+  void setInteropSetCount(uint32_t count);
+  void setDeviceCount(uint32_t count);
+
+  // Region of interest: only the rectangle (input pixels) is denoised, with the overlap window around it as
+  // context, the rest of the output is the noisy input. Enabling it re-creates the state, the rectangle can
+  // change at every denoise. Clamped to the tile when tiling, ignored when temporal, upscaling or split.
+  // The noisy pixels are not copied to the output: the copies to the image and to the host read them from the input.
+  void setRegionEnabled(bool enabled);
+  void setRegion(const VkRect2D& region) { m_region = region; }
+
+  // Quality ladder: cheaper denoisers for the frames where the image changes every frame. All the levels are
+  // created and set up with the state (see setupState), switching between them at each denoise costs nothing.
+  // Ignored when temporal, upscaling, split or with a region of interest.
+  enum Quality
+  {
+    eQualityMotion,  // Color only, half resolution upscaled 2x (OptiX 8, full resolution before)
+    eQualityAlbedo,  // Color and albedo
+    eQualityFull,    // The denoiser of initOptiX, with all its guides
+  };
+  void setLadderEnabled(bool enabled);
+  void setQuality(Quality quality) { m_quality = quality; }
+
+  // Light-path AOVs (e.g. diffuse, specular, emission) in the format of the color, denoised with it in the same
+  // invocation by the AOV model, sharing the guides and the kernel prediction of the beauty. The buffers must be
+  // re-allocated after the call (see allocateBuffers). Only the beauty is denoised when temporal, upscaling, split,
+  // with a region of interest or a ladder level under eQualityFull: the AOV outputs are then the noisy inputs.
+  void     setAovCount(uint32_t count);
+  uint32_t getAovCount() const { return m_nbAovs; }
+  // Layer copied by bufferToImage, copyBufferToImage and tonemapBufferToImage: 0 is the beauty, 1.. the AOVs
+  void setDisplayLayer(uint32_t layer) { m_displayIdx = layer; }
+
+  // CUDA graphs: the intensity and invoke of each set are captured at its first denoise and replayed, the wait
+  // and signal of the timeline semaphore stay on the stream. Captured again after allocateBuffers or a change
+  // of the state or of the blend factor. Ignored when temporal, split, with a region or a lower ladder level.
+  void setGraphEnabled(bool enabled);
+
+  // Denoise thread: denoiseImageBuffer hands the denoise to a worker thread and returns, the CUDA and OptiX calls
+  // are made there (not when hostSync). Everything else stays on the calling thread.
+  void setWorkerEnabled(bool enabled);
   void bufferToImage(const VkCommandBuffer& cmdBuf, nvvk::Texture* imgOut);
   void imageToBuffer(const VkCommandBuffer& cmdBuf, const std::vector<nvvk::Texture>& imgIn);
 
+  // Guides (albedo, normal) in the interop buffers: each set keeps the last ones copied, imageToBuffer and
+  // copyImageToBuffer only copy the color to the sets holding the current guides. Set to false when the guide
+  // images change, to true when they were written directly in all the sets. allocateBuffers makes them stale.
+  void setGuidesValid(bool valid);
+  bool getGuidesValid() const;  // Current in all the sets
+
   void createCopyPipeline();
+  void setPipelineCache(VkPipelineCache cache) { m_pipelineCache = cache; }  // Used by createCopyPipeline
+  void destroyCopyPipeline();
   void copyImageToBuffer(const VkCommandBuffer& cmd, const std::vector<nvvk::Texture>& imgIn);
   void copyBufferToImage(const VkCommandBuffer& cmd, const nvvk::Texture* imgIn);
-
-  VkSemaphore getTLSemaphore() const { return m_semaphore.vk; }
+  // Fused copy and tonemapper: the output of the last denoise is tone mapped directly into the LDR image,
+  // without going through an RGBA32F image. Valid until the set of that denoise is denoised again.
+  void tonemapBufferToImage(const VkCommandBuffer& cmd, const nvvk::Texture* ldrOut, const nvvkhl_shaders::Tonemapper& tonemapper);
+
+  // Offline denoising, without Vulkan rendering: images in the interop formats, to and from the current set.
+  // Pinned host or device memory (unified addressing), see batch.hpp and denoise_service.hpp.
+  // initOffline replaces setup, initOptiX and createSemaphore: FLOAT3 images with the albedo and normal guides.
+  void     initOffline(const nvvk::Context& ctx);
+  void     uploadInputs(const std::array<const void*, 3>& host);  // RGB, Albedo, Normal; nullptr to skip one
+  void     downloadOutput(void* host);
+  CUstream getCudaStream() const { return m_cuStream; }
+
+  // Copying the result of the last denoise of the current set to the host on another stream, not delaying
+  // the denoiser; 'done' is recorded on 'stream' after the copy. The next denoise of the set waits for it.
+  void         readbackOutput(void* host, CUstream stream, cudaEvent_t done);
+  VkDeviceSize getOutputBytes() const { return m_outputBytes; }
+
+  VkSemaphore      getTLSemaphore() const { return m_semaphore.vk; }
+  OptixPixelFormat getPixelFormat() const { return m_pixelFormat; }
+  OptixPixelFormat getGuideFormat() const { return m_guideFormat; }  // Albedo and normal
+  VkExtent2D       getOutputSize() const { return m_outputSize; }  // Twice the input size when upscaling
+
+  // Buffers of the denoiser inputs (RGB, Albedo, Normal) of a set, for writing them directly (zero-copy)
+  std::array<VkDescriptorBufferInfo, 3> getInputBufferInfos(uint32_t set) const
+  {
+    const auto& in = m_sets[set].in;
+    return {VkDescriptorBufferInfo{in[0].bufVk.buffer, 0, m_inputBytes}, VkDescriptorBufferInfo{in[1].bufVk.buffer, 0, m_guideBytes},
+            VkDescriptorBufferInfo{in[2].bufVk.buffer, 0, m_guideBytes}};
+  }
+  // Buffer of an AOV input of a set (format of the color), for writing it directly (zero-copy)
+  VkDescriptorBufferInfo getAovBufferInfo(uint32_t set, uint32_t aov) const
+  {
+    return {m_sets[set].aovIn[aov].bufVk.buffer, 0, m_inputBytes};
+  }
+  // Buffer of the motion vectors (FLOAT2) of a set, written by the ray tracer for the temporal denoiser
+  VkDescriptorBufferInfo getFlowBufferInfo(uint32_t set) const { return {m_sets[set].flow.bufVk.buffer, 0, m_flowBytes}; }
+
+  // Ring of interop buffer sets: Vulkan fills the current set while CUDA may still denoise the previous ones.
+  // The current set is used by imageToBuffer, denoiseImageBuffer and bufferToImage, nextSet() moves to the next one.
+  uint32_t getInteropSetCount() const { return m_nbSets; }
+  uint32_t getCurrentSet() const { return m_setIdx; }
+  uint64_t getCurrentSetFenceValue() const { return m_sets[m_setIdx].fenceValue; }  // CUDA is done with the set
+  void     nextSet() { m_setIdx = (m_setIdx + 1) % m_nbSets; }
+
+  // GPU time (ms) of the intensity computation and of the denoiser invocation, for the denoise which
+  // signaled fenceValue. Returns false if unknown or not finished yet; never waits. With CUDA graphs, the
+  // intensity is not measured (-1) and the invocation time includes it.
+  bool getTimings(uint64_t fenceValue, float& intensityMs, float& invokeMs);
+
+  // Device memory allocated with CUDA (state, scratch, temporal history), the interop buffers are Vulkan allocations
+  size_t getCudaMemoryBytes() const;
+  // Memory of the denoiser by category, the capacities of the pooled allocations
+  struct MemoryUsage
+  {
+    size_t interop = 0;  // Memory block of the interop buffers
+    size_t state   = 0;  // Denoiser states, with the levels of the quality ladder
+    size_t scratch = 0;
+    size_t history = 0;  // Temporal: previous output and internal guide layers
+    size_t other   = 0;  // Intensity, average color
+    size_t peers   = 0;  // Multi-GPU: allocated on the other CUDA devices
+  };
+  MemoryUsage getMemoryUsage() const;
+  // Memory the denoiser would allocate on this device for an input size, format of the interop buffers,
+  // tile size and upscale mode, the other settings unchanged. Nothing is allocated.
+  size_t estimateMemoryBytes(const VkExtent2D& imgSize, OptixPixelFormat pixelFormat, uint32_t tileSize, bool upscale) const;
+  // Size of the memory block holding all the interop buffers
+  size_t getInteropMemoryBytes() const { return m_interopMemory.size; }
+
+  // Multi-GPU: the image is split in horizontal bands, one per CUDA device. The first band is denoised on the
+  // device running Vulkan, the others on the peer devices, which copy their rows from and to the interop buffers.
+  uint32_t getMaxDeviceCount() const { return 1 + static_cast<uint32_t>(m_peers.size()); }  // CUDA devices usable
+  uint32_t getDeviceCount() const { return 1 + m_nbPeers; }
 
   // Ui
   int m_denoisedMode{1};
   int m_startDenoiserFrame{0};
 
 private:
-  // Holding the Buffer for Cuda interop
+  // Holding the Buffer for Cuda interop, placed in the interop memory block
   struct BufferCuda
   {
-    nvvk::Buffer bufVk;  // The Vulkan allocated buffer
+    nvvk::Buffer bufVk;               // The Vulkan buffer, bound to m_interopMemory
+    VkDeviceSize offset   = 0;        // Offset in the memory block
+    VkDeviceSize capacity = 0;        // Size of the buffer, can be larger than the size used
+    void*        cudaPtr  = nullptr;  // Pointer in the CUDA mapping of the block
+
+    void destroy(VkDevice device)
+    {
+      vkDestroyBuffer(device, bufVk.buffer, nullptr);
+      bufVk    = {};
+      offset   = 0;
+      capacity = 0;
+      cudaPtr  = nullptr;
+    }
+  };
 
-    // Extra for Cuda
+  // Single exportable memory block holding all the interop buffers, imported and mapped once in CUDA
+  struct InteropMemory
+  {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize   size   = 0;
 #ifdef WIN32
     HANDLE handle = nullptr;  // The Win32 handle
 #else
     int handle = -1;
 #endif
-    void* cudaPtr = nullptr;
-
-    void destroy(nvvk::ExportResourceAllocator& alloc)
-    {
-      alloc.destroy(bufVk);
-#ifdef WIN32
-      CloseHandle(handle);
-      handle = nullptr;
-#else
-      if(handle != -1)
-      {
-        close(handle);
-        handle = -1;
-      }
-#endif
-    }
+    cudaExternalMemory_t cuMem   = nullptr;
+    void*                cudaPtr = nullptr;  // Mapping of the whole block
+  } m_interopMemory;
+
+  std::vector<std::pair<BufferCuda*, VkDeviceSize>> interopBuffers();  // With the size needed by each
+
+  void createInteropMemory();
+  void destroyInteropMemory();
+  void createDenoiser();
+  void setupState();
+  void destroyState();
+  void createPeers();
+  void setupPeers();
+  void destroyPeers();
+  void invokeSplit(const OptixDenoiserLayer& layer, const OptixDenoiserGuideLayer& guideLayer, const OptixDenoiserParams& params);
+  void invokeRegion(const OptixDenoiserLayer& layer, const OptixDenoiserGuideLayer& guideLayer, const OptixDenoiserParams& params);
+  void createLadder();
+  void destroyLadder();
+  void invokeLadder(const OptixDenoiserLayer& layer, const OptixDenoiserGuideLayer& guideLayer, const OptixDenoiserParams& params);
+  bool isSplit() const { return m_nbPeers > 0 && !m_temporal && !m_upscale; }  // The temporal history is not split
+  bool isTiled() const
+  {
+    return !isSplit() && (m_tileExtent.width < m_imageSize.width || m_tileExtent.height < m_imageSize.height);
+  }
+  bool isRegion() const { return m_regionEnabled && !isSplit() && !m_temporal && !m_upscale; }
+  bool isLadder() const { return m_ladderEnabled && !isSplit() && !isRegion() && !m_temporal && !m_upscale; }
+  bool isGraph() const
+  {
+    return m_graphEnabled && !isSplit() && !isRegion() && !(isLadder() && m_job.quality != eQualityFull) && !m_temporal;
+  }
+  bool isAov() const
+  {
+    return m_nbAovs > 0 && !isSplit() && !isRegion() && !(isLadder() && m_job.quality != eQualityFull) && !m_temporal && !m_upscale;
+  }
+  const BufferCuda&       displayBuffer(uint32_t set) const;
+  std::array<uint32_t, 4> displayRegion(uint32_t set) const;
+  VkRect2D                clipRegion(const VkRect2D& region) const;
+
+  struct InteropSet;
+  void copyOutputToHost(void* host, const InteropSet& set, cudaStream_t stream);
+  void enqueueDenoise(InteropSet&                    set,
+                      const OptixDenoiserLayer&      layer,
+                      const OptixDenoiserGuideLayer& guideLayer,
+                      float                          blendFactor,
+                      cudaEvent_t                    intensityDone);
+  void captureGraph(InteropSet& set, const OptixDenoiserLayer& layer, const OptixDenoiserGuideLayer& guideLayer, float blendFactor);
+  void destroyGraphs();
+
+  // A denoise, with the values read at denoiseImageBuffer which the caller may change before it runs
+  struct DenoiseJob
+  {
+    uint32_t    set           = 0;
+    uint64_t    waitValue     = 0;  // Timeline value of Vulkan done with the set
+    uint64_t    signalValue   = 0;  // Signaled when the denoise is done
+    float       blendFactor   = 0.F;
+    Quality     quality       = eQualityFull;
+    VkRect2D    region        = {};  // Clipped, see clipRegion
+    bool        temporalReset = false;
+    cudaEvent_t readback      = nullptr;  // Pending readback of the previous output of the set
+    bool        stop          = false;    // Ends the worker
   };
-
-  void createBufferCuda(BufferCuda& buf);
+  void runDenoise(const DenoiseJob& job);
+  void waitJobs();
+  void synchronize();
 
 
   // For synchronizing with Vulkan
@@ -173,33 +363,146 @@ private:
   OptixDenoiserSizes     m_denoiserSizes   = {};
   OptixDenoiserAlphaMode m_denoiserAlpha   = {OPTIX_DENOISER_ALPHA_MODE_COPY};
   OptixPixelFormat       m_pixelFormat     = {};
+  OptixPixelFormat       m_guideFormat     = {};  // Albedo and normal: HALF3 when compact, otherwise m_pixelFormat
+  bool                   m_compactGuides   = {false};
+
+  CUdeviceptr m_dStateBuffer    = {};
+  CUdeviceptr m_dScratchBuffer  = {};
+  size_t      m_stateCapacity   = {};  // Allocated sizes, the allocations are reused while large enough
+  size_t      m_scratchCapacity = {};
+  CUdeviceptr m_dIntensity      = {};
+  CUdeviceptr m_dMinRGB         = {};
+  CUdeviceptr m_dAvgColor       = {};  // Average log color of the beauty, for the AOV layers (hdrAverageColor)
+  CUstream    m_cuStream        = {};
+
+  VkExtent2D m_imageSize   = {};  // Size of the inputs (noisy image and guides)
+  VkExtent2D m_outputSize  = {};  // Size of the denoised image
+  uint32_t   m_sizeofPixel = {};
+  uint32_t   m_sizeofGuide = {};
 
-  CUdeviceptr m_dStateBuffer   = {};
-  CUdeviceptr m_dScratchBuffer = {};
-  CUdeviceptr m_dIntensity     = {};
-  CUdeviceptr m_dMinRGB        = {};
-  CUstream    m_cuStream       = {};
+  // Tiling: reduces the memory of the denoiser state and scratch to the size of a tile
+  uint32_t   m_tileSize    = {};  // Requested tile size, 0 means the whole image
+  VkExtent2D m_tileExtent  = {};  // Actual tile size, clamped to the image
+  uint32_t   m_overlap     = {};  // Overlap window in pixels, 0 if not tiled
+  size_t     m_scratchSize = {};
 
-  VkExtent2D m_imageSize   = {};
-  uint32_t   m_sizeofPixel = {};
+  // Region of interest, see setRegion
+  bool     m_regionEnabled = {false};
+  VkRect2D m_region        = {};
+
+  // Quality ladder: the levels below eQualityFull, sharing the scratch memory of the main denoiser
+  struct LadderLevel
+  {
+    OptixDenoiser      denoiser      = {};
+    OptixDenoiserSizes sizes         = {};
+    VkExtent2D         setupSize     = {};  // Input size the state was set up for
+    CUdeviceptr        state         = {};
+    size_t             stateCapacity = {};
+  };
+  std::array<LadderLevel, eQualityFull> m_ladder        = {};
+  bool                                  m_ladderEnabled = {false};
+  Quality                               m_quality       = {eQualityFull};
+
+  // Temporal: the previous denoised image and internal guide layers are fed back to the denoiser.
+  // The previous image is read from the output of the set denoised before, the ring of sets is its ping-pong.
+  bool                       m_temporal           = {false};
+  bool                       m_temporalReset      = {true};  // No history yet
+  uint32_t                   m_historySet         = {};      // Set of the previous temporal denoise (worker)
+  CUdeviceptr                m_dPrevOutput        = {};      // Black image on reset, or copy when the same set is denoised again
+  std::array<CUdeviceptr, 2> m_dInternalGuide     = {};  // Ping-pong: output and previous output
+  uint32_t                   m_internalGuideIdx   = {};  // Index of the output internal guide layer
+  size_t                     m_prevOutputCapacity = {};
+  std::array<size_t, 2>      m_guideCapacity      = {};
+
+  // Upscale: the denoised image is twice the size of the inputs
+  bool m_upscale = {false};
+
+  // CUDA graphs of the denoise, one per interop set (InteropSet::graph)
+  bool m_graphEnabled = {false};
+
+  // Denoise thread, see setWorkerEnabled. The counters tell when the worker has enqueued all the jobs pushed.
+  std::thread             m_worker;
+  SpscRing<DenoiseJob, 8> m_jobs;
+  uint64_t                m_nbJobs     = {};  // Pushed, only used by the calling thread
+  std::atomic<uint64_t>   m_nbJobsDone = {};  // Enqueued by the worker
+  DenoiseJob              m_job;              // Denoise in progress, read by the invoke functions
+
+  // Multi-GPU: an OptiX denoiser on each other CUDA device, denoising a band of m_tileExtent rows (+ overlap)
+  struct PeerDevice
+  {
+    int                        device          = -1;
+    OptixDeviceContext         context         = {};
+    OptixDenoiser              denoiser        = {};
+    OptixDenoiserSizes         sizes           = {};
+    CUstream                   stream          = {};
+    cudaEvent_t                done            = {};  // Band copied back to the output buffer
+    CUdeviceptr                state           = {};
+    CUdeviceptr                scratch         = {};
+    CUdeviceptr                intensity       = {};
+    std::array<CUdeviceptr, 4> buf             = {};  // Copies of the band: RGB, Albedo, Normal and the denoised result
+    std::array<size_t, 4>      bufCapacity     = {};
+    size_t                     stateCapacity   = {};
+    size_t                     scratchCapacity = {};
+  };
+  int                     m_cudaDevice = {};  // CUDA device of the Vulkan physical device
+  std::vector<PeerDevice> m_peers;            // All the other CUDA devices
+  uint32_t                m_nbPeers    = {};  // Peers used, 0 when denoising on a single device
+  cudaEvent_t             m_splitReady = {};  // Inputs and intensity ready on m_cuStream
+
+  cudaEvent_t m_readbackReady = {};  // Output of the current set ready on m_cuStream, for readbackOutput
 
   // Vulkan
   VkDevice         m_device         = {};
   VkPhysicalDevice m_physicalDevice = {};
   uint32_t         m_queueIndex     = {};
 
-  nvvk::DedicatedMemoryAllocator m_memAlloc;  // Using dedicated allocations for simplicity
-  nvvk::ExportResourceAllocator  m_allocEx;   // ResourceAllocator with export flag (interop)
-
-  std::array<BufferCuda, 3> m_pixelBufferIn;  // RGB, Albedo, normal
-  BufferCuda                m_pixelBufferOut; // Result of the denoiser
+  struct InteropSet
+  {
+    std::array<BufferCuda, 3> in;              // RGB, Albedo, normal
+    BufferCuda                out;             // Result of the denoiser
+    std::vector<BufferCuda>   aovIn;           // Light-path AOVs, see setAovCount
+    std::vector<BufferCuda>   aovOut;
+    BufferCuda                flow;                   // Motion vectors (temporal), written with the color of the set
+    bool                      guidesValid = false;    // Albedo and normal are the current guides, see setGuidesValid
+    uint64_t                  fenceValue  = 0;        // Timeline value signaled when the denoiser is done with the set
+    cudaEvent_t               readback    = nullptr;  // Pending copy of the output to the host (readbackOutput)
+    cudaGraphExec_t           graph       = nullptr;  // Denoise of the set, see captureGraph
+    float                     graphBlend  = 0.F;      // Blend factor captured in the graph
+
+    // Part of 'out' written by the last denoise (region of interest, whole by default), the rest is read from in[0]
+    VkRect2D denoised = {{0, 0}, {~0U, ~0U}};
+  };
+  // The interop buffers are pooled: resizing reuses them, and the memory block with its CUDA mapping,
+  // while they are large enough
+  std::vector<InteropSet> m_sets;
+  VkDeviceSize            m_inputBytes  = {};  // Size used in the color input buffer
+  VkDeviceSize            m_guideBytes  = {};  // Size used in the albedo and normal buffers
+  VkDeviceSize            m_outputBytes = {};  // Size used in each output buffer
+  VkDeviceSize            m_flowBytes   = {};
+  uint32_t                m_nbSets      = {2};
+  uint32_t                m_setIdx      = {};  // Set filled by Vulkan for the next denoise
+  uint32_t                m_denoisedSet = {};  // Set of the last denoise, read by tonemapBufferToImage
+  uint32_t                m_nbAovs      = {};
+  uint32_t                m_displayIdx  = {};  // 0: beauty, then the AOVs
+
+  // Timings: events recorded on m_cuStream around the OptiX calls, for the last denoises (more than the frames in flight)
+  struct TimingEvents
+  {
+    std::array<cudaEvent_t, 3> ev{};                 // Start, after intensity (not with a graph), after invoke
+    std::atomic<bool>          graph      = false;  // Replayed from a CUDA graph: no intensity, the invoke starts at ev[0]
+    std::atomic<uint64_t>      fenceValue = 0;      // Denoise measured, stored once the events are recorded
+  };
+  std::array<TimingEvents, 4> m_timingEvents{};
+  uint32_t                    m_timingIdx = {};
 
   nvvk::DebugUtil m_debug;
 
-  enum  // The two compute shaders
+  enum  // The compute shaders
   {
     eCpyToBuffer,
-    eCpyToImage
+    eCpyToImage,
+    eCpyToImageTonemap,
+    eNbCopyPipelines
   };
   struct VulkanDescritors
   {
@@ -207,14 +510,15 @@ private:
     VkDescriptorSetLayout layout;
     VkDescriptorSet       set;
   };
-  std::array<VulkanDescritors, 2> m_desc{};
+  std::array<VulkanDescritors, eNbCopyPipelines> m_desc{};
 
   struct VulkanPipelines
   {
     VkPipeline       p;
     VkPipelineLayout layout;
   };
-  std::array<VulkanPipelines, 2> m_pipelines{};
+  std::array<VulkanPipelines, eNbCopyPipelines> m_pipelines{};
+  VkPipelineCache                               m_pipelineCache{};  // Owned by the application
 };
 
 #endif  // !NVP_SUPPORTS_OPTIX7
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <algorithm>
+#include <bit>
+
+#include <glm/gtc/packing.hpp>
+
+#include "frame_codec.hpp"
+
+namespace {
+
+constexpr uint32_t kBlockSize = 16;  // Residuals sharing a Rice parameter
+constexpr uint32_t kEscape    = 16;  // Quotients from this value are written as 16 raw bits instead
+
+// FP16 bits to a key in the order of the values, the negative ones below the positive ones, and back
+inline uint16_t toKey(uint16_t h)
+{
+  return (h & 0x8000) != 0 ? static_cast<uint16_t>(~h) : static_cast<uint16_t>(h | 0x8000);
+}
+inline uint16_t fromKey(uint16_t key)
+{
+  return (key & 0x8000) != 0 ? static_cast<uint16_t>(key & 0x7FFF) : static_cast<uint16_t>(~key);
+}
+
+// Median edge detector: the left or upper neighbor on an edge, their gradient otherwise
+inline int predict(const uint16_t* keys, uint32_t x, uint32_t y, uint32_t width)
+{
+  const size_t p = static_cast<size_t>(y) * width + x;
+  if(y == 0)
+    return x == 0 ? 0x8000 : keys[p - 1];
+  const int b = keys[p - width];
+  if(x == 0)
+    return b;
+  const int a = keys[p - 1];
+  const int c = keys[p - width - 1];
+  if(c >= std::max(a, b))
+    return std::min(a, b);
+  if(c <= std::min(a, b))
+    return std::max(a, b);
+  return a + b - c;
+}
+
+// Residual modulo 2^16, the small negative and positive values interleaved: 0, -1, 1, -2, ...
+inline uint32_t zigzag(uint16_t key, int prediction)
+{
+  const int d = static_cast<int16_t>(static_cast<uint16_t>(key - prediction));
+  return static_cast<uint16_t>((d << 1) ^ (d >> 15));
+}
+inline uint16_t unzigzag(uint32_t v, int prediction)
+{
+  const int d = static_cast<int>(v >> 1) ^ -static_cast<int>(v & 1);
+  return static_cast<uint16_t>(prediction + d);
+}
+
+// Bits are written and read from the least significant one
+struct BitWriter
+{
+  std::vector<uint8_t>& out;
+  uint64_t              acc   = 0;
+  uint32_t              nbits = 0;
+
+  void put(uint32_t value, uint32_t count)  // At most 32 bits, 'value' has no bit above them
+  {
+    acc |= static_cast<uint64_t>(value) << nbits;
+    nbits += count;
+    for(; nbits >= 8; nbits -= 8, acc >>= 8)
+      out.push_back(static_cast<uint8_t>(acc));
+  }
+  void flush()
+  {
+    if(nbits > 0)
+      out.push_back(static_cast<uint8_t>(acc));
+    acc   = 0;
+    nbits = 0;
+  }
+};
+
+struct BitReader
+{
+  const uint8_t* data;
+  size_t         bytes;
+  size_t         pos   = 0;
+  uint64_t       acc   = 0;
+  uint32_t       nbits = 0;
+
+  void refill()  // At least 57 bits, zeros past the end
+  {
+    for(; nbits <= 56; nbits += 8, pos++)
+      acc |= static_cast<uint64_t>(pos < bytes ? data[pos] : 0) << nbits;
+  }
+  void skip(uint32_t count)
+  {
+    acc >>= count;
+    nbits -= count;
+  }
+  uint32_t get(uint32_t count)
+  {
+    const auto v = static_cast<uint32_t>(acc & ((uint64_t(1) << count) - 1));
+    skip(count);
+    return v;
+  }
+  size_t consumed() const { return pos * 8 - nbits; }  // Bits
+};
+
+}  // namespace
+
+//--------------------------------------------------------------------------------------------------
+// A residual takes at most 32 bits (escape), a block adds the 4 bits of its parameter
+//
+size_t maxEncodedFrameBytes(uint32_t nbImages, uint32_t width, uint32_t height)
+{
+  const size_t samples = static_cast<size_t>(nbImages) * width * height * 3;
+  return samples * 4 + (samples + kBlockSize - 1) / kBlockSize + 3 * nbImages + 8;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Each plane (channel of an image): FP16 keys, residuals to the prediction, then the blocks of Rice codes.
+// A residual v is the quotient v >> k in unary (ones ended by a zero) and the k low bits, k being the
+// parameter of its block, about log2 of the mean of its residuals.
+//
+size_t encodeFrame(const float* images, uint32_t nbImages, uint32_t width, uint32_t height, std::vector<uint8_t>& out)
+{
+  const size_t n = static_cast<size_t>(width) * height;
+  out.clear();
+  out.reserve(n * nbImages * 3 * sizeof(uint16_t));
+
+  std::vector<uint16_t> keys(n);
+  std::vector<uint16_t> residuals(n);
+  BitWriter             bits{out};
+  for(uint32_t plane = 0; plane < 3 * nbImages; plane++)
+  {
+    const float*   image   = images + plane / 3 * n * 3;
+    const uint32_t channel = plane % 3;
+    for(size_t i = 0; i < n; i++)
+      keys[i] = toKey(glm::packHalf1x16(image[i * 3 + channel]));
+    size_t p = 0;
+    for(uint32_t y = 0; y < height; y++)
+      for(uint32_t x = 0; x < width; x++, p++)
+        residuals[p] = static_cast<uint16_t>(zigzag(keys[p], predict(keys.data(), x, y, width)));
+
+    for(size_t b = 0; b < n; b += kBlockSize)
+    {
+      const size_t end = std::min(n, b + kBlockSize);
+      uint64_t     sum = 0;
+      for(size_t i = b; i < end; i++)
+        sum += residuals[i];
+      uint32_t k = 0;
+      while(k < 15 && (static_cast<uint64_t>(end - b) << k) < sum)
+        k++;
+
+      bits.put(k, 4);
+      for(size_t i = b; i < end; i++)
+      {
+        const uint32_t v = residuals[i];
+        const uint32_t q = v >> k;
+        if(q < kEscape)
+        {
+          bits.put((1U << q) - 1, q + 1);
+          bits.put(v & ((1U << k) - 1), k);
+        }
+        else
+        {
+          bits.put((1U << kEscape) - 1, kEscape);
+          bits.put(v, 16);
+        }
+      }
+    }
+  }
+  bits.flush();
+  return out.size();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Same order as encodeFrame, each key is predicted from the ones already decoded
+//
+bool decodeFrame(const uint8_t* data, size_t bytes, uint32_t nbImages, uint32_t width, uint32_t height, float* images)
+{
+  const size_t          n = static_cast<size_t>(width) * height;
+  std::vector<uint16_t> keys(n);
+  BitReader             bits{data, bytes};
+  for(uint32_t plane = 0; plane < 3 * nbImages; plane++)
+  {
+    float*         image   = images + plane / 3 * n * 3;
+    const uint32_t channel = plane % 3;
+    uint32_t       k       = 0;
+    size_t         p       = 0;
+    for(uint32_t y = 0; y < height; y++)
+    {
+      for(uint32_t x = 0; x < width; x++, p++)
+      {
+        bits.refill();
+        if(p % kBlockSize == 0)
+          k = bits.get(4);
+
+        const uint32_t q = std::min<uint32_t>(std::countr_one(bits.acc), kEscape);
+        uint32_t       v = 0;
+        if(q < kEscape)
+        {
+          bits.skip(q + 1);
+          v = (q << k) | bits.get(k);
+        }
+        else
+        {
+          bits.skip(kEscape);
+          v = bits.get(16);
+        }
+        if(v > 0xFFFF)
+          return false;  // Not written by encodeFrame
+
+        keys[p]                = unzigzag(v, predict(keys.data(), x, y, width));
+        image[p * 3 + channel] = glm::unpackHalf1x16(fromKey(keys[p]));
+      }
+    }
+  }
+  return bits.consumed() <= 8 * bytes;
+}
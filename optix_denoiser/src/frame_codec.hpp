@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////
+// Compressed frames of the denoise service (see denoise_service.hpp).
+//
+// The images (FLOAT3) are rounded to FP16, the only loss, then each channel is
+// coded losslessly as a plane: the 16 bits of a value are mapped to an order
+// preserving key, predicted from its neighbors (median edge detector of
+// LOCO-I) and the residual is written with a Rice code, whose parameter is
+// chosen for each block of 16 residuals. FP16 halves the size of FLOAT3, the
+// coding takes the smooth areas (the guides) to a few bits per value, while
+// pure noise stays at about 16 bits.
+//////////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Largest encoding of 'nbImages' consecutive FLOAT3 images of width x height
+size_t maxEncodedFrameBytes(uint32_t nbImages, uint32_t width, uint32_t height);
+
+// Encoding 'nbImages' consecutive FLOAT3 images of width x height; returns the bytes written in 'out'
+size_t encodeFrame(const float* images, uint32_t nbImages, uint32_t width, uint32_t height, std::vector<uint8_t>& out);
+
+// Decoding what encodeFrame wrote for the same number and size of images; returns false if the data is invalid
+bool decodeFrame(const uint8_t* data, size_t bytes, uint32_t nbImages, uint32_t width, uint32_t height, float* images);
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "imgui.h"
+#include "nvh/nvprint.hpp"
+
+#include "memory_budget.hpp"
+
+static constexpr double s_mb = 1024.0 * 1024.0;
+
+size_t MemoryReport::total() const
+{
+  size_t bytes = 0;
+  for(const auto& c : categories)
+    bytes += c.bytes;
+  return bytes;
+}
+
+void MemoryReport::log(const char* title) const
+{
+  LOGI("%s: %.1f MB\n", title, total() / s_mb);
+  for(const auto& c : categories)
+    LOGI("  %-30s %10.1f MB\n", c.name.c_str(), c.bytes / s_mb);
+}
+
+void MemoryReport::onUI() const
+{
+  if(ImGui::BeginTable("memory", 2, ImGuiTableFlags_RowBg))
+  {
+    ImGui::TableSetupColumn("Category");
+    ImGui::TableSetupColumn("MB");
+    ImGui::TableHeadersRow();
+    for(const auto& c : categories)
+    {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(c.name.c_str());
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f", c.bytes / s_mb);
+    }
+    ImGui::TableNextRow();
+    ImGui::TableNextColumn();
+    ImGui::TextUnformatted("Total");
+    ImGui::TableNextColumn();
+    ImGui::Text("%.1f", total() / s_mb);
+    ImGui::EndTable();
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Ignoring the alignment and the padding of the driver: close enough for choosing the settings
+//
+size_t imageBytes(VkFormat format, const VkExtent2D& size)
+{
+  size_t texel = 0;
+  switch(format)
+  {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_D32_SFLOAT:
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+      texel = 4;
+      break;
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+    case VK_FORMAT_R32G32_SFLOAT:
+      texel = 8;
+      break;
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+      texel = 16;
+      break;
+    default:
+      break;
+  }
+  return texel * size.width * size.height;
+}
+
+size_t gbufferBytes(const std::vector<VkFormat>& colors, VkFormat depth, const VkExtent2D& size)
+{
+  size_t bytes = imageBytes(depth, size);
+  for(VkFormat format : colors)
+    bytes += imageBytes(format, size);
+  return bytes;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Tiling only reduces the state and scratch of the denoiser, 16-bit floats halve the interop buffers
+// (RGBA32F -> RGBA16F, RGB32F -> RGB16F), half resolution divides the rendering G-Buffers, the interop
+// inputs and the state by 4, but costs the most in quality.
+//
+std::vector<MemoryOption> makeMemoryOptions(const MemoryOption& current, bool canUpscale)
+{
+  // Tiling combo: Off, 256, 512, 1024, 2048; from the most to the least memory
+  constexpr int tile_order[] = {0, 4, 3, 2, 1};
+  int           first_tile   = 0;
+  while(first_tile < 4 && tile_order[first_tile] != current.tileSize)
+    first_tile++;
+
+  std::vector<int> formats = {current.format};
+  if(current.format == 0 || current.format == 2)
+    formats.push_back(current.format + 1);  // Format combo: RGBA32F, RGBA16F, RGB32F, RGB16F
+
+  std::vector<bool> upscales = {current.upscale};
+  if(!current.upscale && canUpscale)
+    upscales.push_back(true);
+
+  std::vector<MemoryOption> options;
+  for(bool upscale : upscales)
+  {
+    for(int format : formats)
+    {
+      for(int t = first_tile; t < 5; t++)
+        options.push_back({format, tile_order[t], upscale});
+    }
+  }
+  return options;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////
+// Device memory of the sample by category: G-Buffers, interop buffers, denoiser
+// state, scratch and history, and what is left of the Vulkan heaps (scene, TLAS).
+// Shown in the UI and logged, and used to lower the denoiser settings under a budget.
+//
+// Command line (see main()):
+//   -memory_budget <MB>   budget of the device memory, 0: none
+//////////////////////////////////////////////////////////////////////////
+
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+struct MemoryReport
+{
+  struct Category
+  {
+    std::string name;
+    size_t      bytes = 0;
+  };
+  std::vector<Category> categories;
+
+  void   add(const std::string& name, size_t bytes) { categories.push_back({name, bytes}); }
+  size_t total() const;
+  void   log(const char* title) const;  // One line per category
+  void   onUI() const;                  // Table of the categories and the total, in MB
+};
+
+// Bytes of an image of the size, for the color and depth formats of the G-Buffers (0 for the others)
+size_t imageBytes(VkFormat format, const VkExtent2D& size);
+// Bytes of a G-Buffer: the color images and the depth
+size_t gbufferBytes(const std::vector<VkFormat>& colors, VkFormat depth, const VkExtent2D& size);
+
+// Denoiser settings lowered to fit a budget, same values as the UI: format and tile size are the indices of
+// the "Format" and "Tiling" combos
+struct MemoryOption
+{
+  int  format   = 0;
+  int  tileSize = 0;
+  bool upscale  = false;
+};
+
+// The options using less memory than 'current', in the order they are tried: smaller tiles first, then 16-bit
+// interop buffers, then rendering at half resolution and upscaling (only if 'canUpscale'). The first is 'current'.
+std::vector<MemoryOption> makeMemoryOptions(const MemoryOption& current, bool canUpscale);
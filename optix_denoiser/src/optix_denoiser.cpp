@@ -37,12 +37,21 @@
        wait semaphore. Therefore, CPU isn't been blocked and further Vulkan 
        commands can be filled, but the last portion of it, won't be executed 
        until the Cuda denoiser is finished. (See m_app->addWaitSemaphore())
+       All the Cuda work is only enqueued on a stream, the CPU returns right
+       away unless "Asynchronous" is turned off in the UI.
 
 */
 //////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <future>
+#include <limits>
 #include <vulkan/vulkan_core.h>
 
 #define VMA_IMPLEMENTATION
@@ -70,7 +79,13 @@
 #include "nvvkhl/scene_camera.hpp"
 #include "nvvkhl/tonemap_postprocess.hpp"
 
+#include "batch.hpp"
+#include "benchmark.hpp"
+#include "blue_noise.hpp"
+#include "capture.hpp"
+#include "denoise_service.hpp"
 #include "denoiser.hpp"
+#include "memory_budget.hpp"
 
 
 #include "shaders/device_host.h"
@@ -93,19 +108,27 @@ namespace nvvkhl {
 /// </summary> Ray trace multiple primitives
 class OptixDenoiserEngine : public nvvkhl::IAppElement
 {
-  enum GbufferNames
+  enum GbufferNames  // Display resolution
   {
     eGBufLdr,
+    eGbufDenoised,
+    eGBufLdrAsync,  // Second LDR image, written by the compute queue while the other one is displayed
+  };
+  enum RenderbufferNames  // Rendering resolution, half of the display when the denoiser upscales
+  {
     eGBufResult,
     eGBufAlbedo,
     eGBufNormal,
-    eGbufDenoised,
+    eGBufMoments,  // Adaptive sampling: mean squared luminance and number of samples of each pixel
+    eGBufAovs,     // Light-path AOVs (NB_AOVS images), only when denoised with the color
   };
 
   struct Settings
   {
     int       maxFrames{200000};
     int       maxSamples{1};
+    float     adaptiveThreshold{0.0F};       // Adaptive sampling, relative error of a converged pixel, 0: off
+    int       sampler{SAMPLER_WHITE_NOISE};  // Sample generator of the path tracer, see sampler.glsl
     int       maxDepth{5};
     bool      showAxis{true};
     glm::vec4 clearColor{1.F};
@@ -113,9 +136,53 @@ class OptixDenoiserEngine : public nvvkhl::IAppElement
     bool      denoiseApply{true};
     bool      denoiseFirstFrame{false};
     int       denoiseEveryNFrames{100};
+    bool      denoiseAsync{true};           // CPU does not wait for the denoiser to finish
+    bool      denoiseThread{true};          // CUDA calls of the denoise made on a worker thread
+    int       denoiseFormat{0};             // Format of the interop buffers, see denoiserPixelFormat()
+    bool      denoiseCompactGuides{false};  // Albedo and normal in HALF3, whatever the format of the color
+    bool      denoiseZeroCopy{false};       // Ray tracer writes directly in the interop buffers
+    bool      denoiseFusedTonemap{true};    // Denoised buffer tone mapped directly into the LDR image
+    int       denoiseTileSize{0};           // Tiles of 128 << N pixels, 0: whole image at once
+    int       denoiseRoi{0};                // Region of interest: 0: off, 1: around the mouse, 2: picked object
+    int       denoiseRoiSize{256};          // Side of the region around the mouse, in pixels
+    bool      denoiseLadder{false};         // Cheaper denoisers while the image changes, see DenoiserOptix::Quality
+    int       ladderAlbedoFrame{4};         // Ladder: first frame at rest denoised with the albedo guide
+    int       ladderFullFrame{16};          // Ladder: first frame at rest denoised with all the guides
+    bool      denoiseAovs{false};           // Diffuse, specular and emission AOVs denoised with the color
+    int       aovDisplay{0};                // Layer displayed: 0: beauty, then the AOVs
+    bool      denoiseGraph{false};          // Denoise replayed from CUDA graphs, see DenoiserOptix::setGraphEnabled
+    bool      denoiseTemporal{false};       // Temporal denoiser, denoising every frame while moving
+    bool      denoiseUpscale{false};        // Rendering at half resolution, the denoiser upscales 2x
+    int       denoiseSchedule{0};           // 0: every N-frames, 1: adaptive, when the image has changed enough
+    float     denoiseThreshold{0.05F};      // Adaptive: mean relative change of the image triggering a denoise
+    int       denoiseInteropSets{2};        // Ring of interop buffer sets, ray tracing the next while denoising one
+    int       denoiseDevices{1};            // CUDA devices sharing the denoise, each one a band of the image
+    bool      timingsCsv{false};            // Writing the GPU time of each stage, for each frame, to a CSV file
+    bool      computeQueue{false};          // Interop copies and tonemapper submitted on the compute queue
+    bool      capture{false};               // Saving every denoised frame in capture/
+    int       captureFormat{0};             // FrameCapture::Format: PNG or HDR
+    int       memoryBudgetMb{0};            // Device memory budget, the denoiser settings are lowered to fit, 0: none
   } m_settings;
 
 public:
+  // Running the benchmark sweep instead of the interactive session
+  void setBenchmark(const BenchmarkConfig& config)
+  {
+    m_benchConfig = config;
+    m_benchRuns   = makeBenchmarkRuns(config);
+    if(m_benchRuns.empty())
+      LOGE("Benchmark: no run to do\n");
+  }
+
+  // Budget of the device memory in MB (0: none), see applyMemoryBudget. Without VK_EXT_memory_budget, the
+  // memory of the scene is unknown and only the G-Buffers and the denoiser are counted.
+  void setMemoryBudget(int budgetMb, bool hasMemoryBudget)
+  {
+    m_settings.memoryBudgetMb = budgetMb;
+    m_hasMemoryBudget         = hasMemoryBudget;
+    m_budgetDirty             = true;
+  }
+
   OptixDenoiserEngine()
   {
     m_frameInfo.maxLuminance = 10.0F;
@@ -136,11 +203,12 @@ public:
     allocator_info.instance               = app->getInstance();
     allocator_info.flags                  = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
 
-    m_dutil      = std::make_unique<nvvk::DebugUtil>(m_device);                            // Debug utility
-    m_alloc      = std::make_unique<AllocVma>(allocator_info);                             // Allocator
-    m_scene      = std::make_unique<nvh::gltf::Scene>();                                   // GLTF scene
-    m_sceneVk    = std::make_unique<SceneVk>(m_device, m_physicalDevice, m_alloc.get());   // GLTF Scene buffers
-    m_sceneRtx   = std::make_unique<SceneRtx>(m_device, m_physicalDevice, m_alloc.get());  // GLTF Scene BLAS/TLAS
+    m_dutil      = std::make_unique<nvvk::DebugUtil>(m_device);                                // Debug utility
+    m_alloc      = std::make_unique<AllocVma>(allocator_info);                                 // Allocator
+    m_sceneAlloc = std::make_unique<AllocVma>(allocator_info);                                 // Scene upload thread
+    m_scene      = std::make_unique<nvh::gltf::Scene>();                                       // GLTF scene
+    m_sceneVk    = std::make_unique<SceneVk>(m_device, m_physicalDevice, m_sceneAlloc.get());  // GLTF Scene buffers
+    m_sceneRtx   = std::make_unique<SceneRtx>(m_device, m_physicalDevice, m_alloc.get());      // GLTF Scene BLAS/TLAS
     m_tonemapper = std::make_unique<TonemapperPostProcess>(m_device, m_alloc.get());
     m_sbt        = std::make_unique<nvvk::SBTWrapper>();
     m_picker     = std::make_unique<nvvk::RayPickerKHR>(m_device, m_physicalDevice, m_alloc.get());
@@ -151,16 +219,28 @@ public:
     // Override the way benchmark count frames, to only use valid ones
     g_elemBenchmark->setCurrentFrame([&] { return m_frame; });
 
+    createPipelineCache();
+
 #ifdef NVP_SUPPORTS_OPTIX7
     m_denoiser = std::make_unique<DenoiserOptix>();
     m_denoiser->setup(m_device, m_physicalDevice, m_app->getQueue(0).familyIndex);
+    m_denoiser->setPipelineCache(m_pipelineCache);
+    m_denoiser->setInteropSetCount(m_settings.denoiseInteropSets);
 
-    OptixDenoiserOptions d_options;
-    d_options.guideAlbedo = 1u;
-    d_options.guideNormal = 1u;
-    m_denoiser->initOptiX(d_options, OPTIX_PIXEL_FORMAT_FLOAT4, true);
-    m_denoiser->createSemaphore();
-    m_denoiser->createCopyPipeline();
+    // #OPTIX_D
+    // Initializing CUDA and OptiX takes a while: done in the background, while the scene and the HDR are loaded.
+    // The denoiser is used only after waitDenoiser().
+    m_denoiserInit = std::async(std::launch::async, [this] {
+      OptixDenoiserOptions d_options;
+      d_options.guideAlbedo = 1u;
+      d_options.guideNormal = 1u;
+      m_denoiser->initOptiX(d_options, denoiserPixelFormat(), true);
+      m_denoiser->setGraphEnabled(m_settings.denoiseGraph);
+      m_denoiser->setWorkerEnabled(m_settings.denoiseThread);
+      m_denoiser->createSemaphore();
+      m_denoiser->createCopyPipeline();
+      m_capture.init(8, 2);
+    });
 #else
     m_settings.denoiseApply = false;
     LOGE("OptiX is not supported");
@@ -180,6 +260,7 @@ public:
 
     // Create resources
     createCommandBuffers();
+    createTimestampQueries();
     createGbuffers(m_viewSize);
     createVulkanBuffers();
 
@@ -188,15 +269,23 @@ public:
 
   void onDetach() override
   {
+    waitDenoiser();
     vkDeviceWaitIdle(m_device);
     destroyResources();
   }
 
   void onResize(uint32_t width, uint32_t height) override
   {
+    waitDenoiser();
+    if(m_benchSize.width > 0)
+    {  // Benchmark: rendering at the resolution of the run, independently of the viewport
+      width  = m_benchSize.width;
+      height = m_benchSize.height;
+    }
     createGbuffers({width, height});
+    m_budgetDirty = true;
     // Tonemapper is using GBuffer-1 as input and output to GBuffer-0
-    m_tonemapper->updateComputeDescriptorSets(m_gBuffers->getDescriptorImageInfo(eGBufResult),
+    m_tonemapper->updateComputeDescriptorSets(m_gRender->getDescriptorImageInfo(eGBufResult),
                                               m_gBuffers->getDescriptorImageInfo(eGBufLdr));
     writeRtxSet();
   }
@@ -237,22 +326,29 @@ public:
     if(extension == ".gltf" || extension == ".glb")
     {
       createScene(filename);
+      m_budgetDirty = true;
     }
     else if(extension == ".hdr")
     {
       createHdr(filename);
-      resetFrame();
+      resetAccumulation();  // The guides don't see the environment
+      return;
     }
 
-
     resetFrame();
   }
 
   void onUIRender() override
   {
     using namespace ImGuiH;
+    waitDenoiser();
+#ifdef NVP_SUPPORTS_OPTIX7
+    if(m_budgetDirty)
+      applyMemoryBudget();
+#endif
 
     bool reset{false};
+    bool reset_color{false};  // Only the shading changed, see resetAccumulation
     // Pick under mouse cursor
     if(ImGui::IsMouseDoubleClicked(ImGuiMouseButton_Left) || ImGui::IsKeyPressed(ImGuiKey_Space))
     {
@@ -266,6 +362,14 @@ public:
 
     {  // Setting menu
       ImGui::Begin("Settings");
+      if(!m_sceneLoading.empty())
+      {
+        ImGui::Text("Loading %s ...", std::filesystem::path(m_sceneLoading).filename().string().c_str());
+      }
+      else if(m_sceneStep != eSceneIdle)
+      {
+        ImGui::Text("Building %s ...", std::filesystem::path(m_nextSceneFile).filename().string().c_str());
+      }
 
       if(ImGui::CollapsingHeader("Camera"))
       {
@@ -282,6 +386,14 @@ public:
           reset |= PropertyEditor::entry("Samples", [&] { return ImGui::SliderInt("#2", &m_settings.maxSamples, 1, 5); });
           reset |= PropertyEditor::entry("Frames",
                                          [&] { return ImGui::DragInt("#3", &m_settings.maxFrames, 5.0F, 1, 1000000); });
+          // Relative error under which a pixel is not sampled anymore, 0: off
+          reset |= PropertyEditor::entry("Adaptive", [&] {
+            return ImGui::SliderFloat("#5", &m_settings.adaptiveThreshold, 0.0F, 0.1F, "%.3f");
+          });
+          // Low-discrepancy samplers converge faster, the denoiser can start from fewer frames
+          reset |= PropertyEditor::entry("Sampler", [&] {
+            return ImGui::Combo("#6", &m_settings.sampler, "White Noise\0Sobol (Owen)\0Blue Noise\0\0");
+          });
           PropertyEditor::treePop();
         }
         PropertyEditor::entry("Show Axis", [&] { return ImGui::Checkbox("##4", &m_settings.showAxis); });
@@ -293,11 +405,11 @@ public:
         PropertyEditor::begin();
         if(PropertyEditor::treeNode("Hdr"))
         {
-          reset |= PropertyEditor::entry(
+          reset_color |= PropertyEditor::entry(
               "Color", [&] { return ImGui::ColorEdit3("##Color", &m_settings.clearColor.x, ImGuiColorEditFlags_Float); },
               "Color multiplier");
 
-          reset |= PropertyEditor::entry(
+          reset_color |= PropertyEditor::entry(
               "Rotation", [&] { return ImGui::SliderAngle("Rotation", &m_settings.envRotation); }, "Rotating the environment");
           PropertyEditor::treePop();
         }
@@ -314,29 +426,171 @@ public:
       {
         ImGui::Checkbox("Denoise", &m_settings.denoiseApply);
         ImGui::Checkbox("First Frame", &m_settings.denoiseFirstFrame);
+        ImGui::Checkbox("Asynchronous", &m_settings.denoiseAsync);
+        ImGui::BeginDisabled(m_app->getQueue(1).queue == VK_NULL_HANDLE);
+        if(ImGui::Checkbox("Compute Queue", &m_settings.computeQueue))
+        {
+          setComputeQueue();
+        }
+        ImGui::EndDisabled();
+#ifdef NVP_SUPPORTS_OPTIX7
+        if(ImGui::Checkbox("Denoise Thread", &m_settings.denoiseThread))
+        {
+          m_denoiser->setWorkerEnabled(m_settings.denoiseThread);
+        }
+        if(ImGui::Combo("Format", &m_settings.denoiseFormat, "RGBA32F\0RGBA16F\0RGB32F\0RGB16F\0\0"))
+        {
+          setDenoiserPixelFormat();
+        }
+        if(ImGui::Checkbox("Compact Guides", &m_settings.denoiseCompactGuides))
+        {
+          setDenoiserPixelFormat();
+        }
+        if(ImGui::Checkbox("Fused Tonemap", &m_settings.denoiseFusedTonemap))
+          m_copyDenoised = true;  // eGbufDenoised not written when fused: refreshed next frame, the accumulation is kept
+        if(ImGui::Combo("Tiling", &m_settings.denoiseTileSize, "Off\0" "256\0" "512\0" "1024\0" "2048\0\0"))
+        {
+          vkDeviceWaitIdle(m_device);
+          m_denoiser->setTileSize(m_settings.denoiseTileSize == 0 ? 0 : 128U << m_settings.denoiseTileSize);
+        }
+        if(ImGui::Combo("Region", &m_settings.denoiseRoi, "Off\0Mouse\0Picked Object\0\0"))
+        {
+          vkDeviceWaitIdle(m_device);
+          m_denoiser->setRegionEnabled(m_settings.denoiseRoi != 0);
+        }
+        if(m_settings.denoiseRoi == 1)
+        {
+          ImGui::SliderInt("Region Size", &m_settings.denoiseRoiSize, 32, 1024);
+        }
+        if(ImGui::Checkbox("Quality Ladder", &m_settings.denoiseLadder))
+        {
+          vkDeviceWaitIdle(m_device);
+          m_denoiser->setLadderEnabled(m_settings.denoiseLadder);
+        }
+        if(m_settings.denoiseLadder)
+        {
+          ImGui::SliderInt("Albedo From", &m_settings.ladderAlbedoFrame, 1, 64);
+          ImGui::SliderInt("Full From", &m_settings.ladderFullFrame, m_settings.ladderAlbedoFrame, 256);
+        }
+        if(ImGui::Checkbox("CUDA Graph", &m_settings.denoiseGraph))
+        {
+          m_denoiser->setGraphEnabled(m_settings.denoiseGraph);
+        }
+        if(ImGui::Checkbox("Light-Path AOVs", &m_settings.denoiseAovs))
+        {
+          setDenoiserAovs();
+        }
+        if(m_settings.denoiseAovs && ImGui::Combo("Show Layer", &m_settings.aovDisplay, "Beauty\0Diffuse\0Specular\0Emission\0\0"))
+        {
+          m_denoiser->setDisplayLayer(static_cast<uint32_t>(m_settings.aovDisplay));
+          reset = true;  // Copied again from the next denoise
+        }
+        if(ImGui::SliderInt("Interop Sets", &m_settings.denoiseInteropSets, 1, MAX_INTEROP_SETS))
+        {
+          setDenoiserInteropSets();
+        }
+        if(m_denoiser->getMaxDeviceCount() > 1
+           && ImGui::SliderInt("GPUs", &m_settings.denoiseDevices, 1, static_cast<int>(m_denoiser->getMaxDeviceCount())))
+        {
+          vkDeviceWaitIdle(m_device);
+          m_denoiser->setDeviceCount(static_cast<uint32_t>(m_settings.denoiseDevices));
+        }
+        if(ImGui::Checkbox("Capture", &m_settings.capture) && m_settings.capture)
+        {
+          std::filesystem::create_directories("capture");
+        }
+        ImGui::Combo("Capture Format", &m_settings.captureFormat, "PNG\0HDR\0\0");
+        ImGui::Text("Captured: %u frames, %u stalls", m_capture.getSavedCount(), m_capture.getStallCount());
+        if(ImGui::Checkbox("Temporal", &m_settings.denoiseTemporal))
+        {
+          setDenoiserMode();
+        }
+        if(ImGui::Checkbox("Upscale 2x", &m_settings.denoiseUpscale))
+        {
+          setDenoiserMode();
+        }
+#endif
+        reset |= ImGui::Checkbox("Zero-Copy", &m_settings.denoiseZeroCopy);
+        reset |= ImGui::Combo("Schedule", &m_settings.denoiseSchedule, "Every N-frames\0Adaptive\0\0");
         ImGui::SliderInt("N-frames", &m_settings.denoiseEveryNFrames, 1, 500);
+        if(m_settings.denoiseSchedule == 1)
+        {
+          ImGui::SliderFloat("Threshold", &m_settings.denoiseThreshold, 0.001F, 0.5F, "%.3f", ImGuiSliderFlags_Logarithmic);
+        }
         ImGui::SliderFloat("Blend", &m_blendFactor, 0.f, 1.0f);
         int denoised_frame = -1;
         if(m_settings.denoiseApply)
         {
           if(m_frame >= m_settings.maxFrames)
             denoised_frame = m_settings.maxFrames;
+          else if(m_settings.denoiseSchedule == 1)
+            denoised_frame = m_schedule.lastDenoised;
+          else if(m_settings.denoiseTemporal && (m_frame < m_settings.denoiseEveryNFrames))
+            denoised_frame = m_frame;
           else if(m_settings.denoiseFirstFrame && (m_frame < m_settings.denoiseEveryNFrames))
             denoised_frame = 0;
           else if(m_frame >= m_settings.denoiseEveryNFrames)
             denoised_frame = (m_frame / m_settings.denoiseEveryNFrames) * m_settings.denoiseEveryNFrames;
         }
         ImGui::Text("Denoised Frame: %d", denoised_frame);
+        if(m_settings.denoiseSchedule == 1)
+          ImGui::Text("Change: %.4f  Budget: %d frames", m_schedule.changeSinceDenoise, m_schedule.budget);
+
+        if(ImGui::TreeNode("GPU Timings (ms)"))
+        {
+          if(ImGui::Checkbox("Log to CSV", &m_settings.timingsCsv))
+            setTimingsCsv();
+          if(ImGui::BeginTable("timings", 4, ImGuiTableFlags_RowBg))
+          {
+            ImGui::TableSetupColumn("Stage");
+            ImGui::TableSetupColumn("Min");
+            ImGui::TableSetupColumn("Avg");
+            ImGui::TableSetupColumn("Max");
+            ImGui::TableHeadersRow();
+            for(int i = 0; i < eStageCount; i++)
+            {
+              glm::vec3 mam = m_stageTimings[i].minAvgMax();
+              ImGui::TableNextRow();
+              ImGui::TableNextColumn();
+              ImGui::TextUnformatted(s_stageNames[i]);
+              for(int c = 0; c < 3; c++)
+              {
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", mam[c]);
+              }
+            }
+            ImGui::EndTable();
+          }
+          ImGui::TreePop();
+        }
+
+        if(ImGui::TreeNode("Memory"))
+        {
+          MemoryReport report = memoryReport();
+          report.onUI();
+#ifdef NVP_SUPPORTS_OPTIX7
+          if(ImGui::SliderInt("Budget (MB)", &m_settings.memoryBudgetMb, 0, 32768))
+            m_budgetDirty = true;
+          ImGuiH::tooltip("Lowering the tiling, the format and the resolution of the denoiser to fit, 0: no budget");
+#endif
+          if(ImGui::Button("Log"))
+            report.log("Device memory");
+          ImGui::TreePop();
+        }
 
         ImVec2 tumbnailSize = {150 * m_gBuffers->getAspectRatio(), 150};
         ImGui::Text("Albedo");
-        ImGui::Image(m_gBuffers->getDescriptorSet(eGBufAlbedo), tumbnailSize);
+        ImGui::Image(m_gRender->getDescriptorSet(eGBufAlbedo), tumbnailSize);
         ImGui::Text("Normal");
-        ImGui::Image(m_gBuffers->getDescriptorSet(eGBufNormal), tumbnailSize);
+        ImGui::Image(m_gRender->getDescriptorSet(eGBufNormal), tumbnailSize);
         ImGui::Text("Result");
-        ImGui::Image(m_gBuffers->getDescriptorSet(eGBufResult), tumbnailSize);
-        ImGui::Text("Denoised");
-        ImGui::Image(m_gBuffers->getDescriptorSet(eGbufDenoised), tumbnailSize);
+        ImGui::Image(m_gRender->getDescriptorSet(eGBufResult), tumbnailSize);
+        // Otherwise owned and written by the compute queue while the frame is displayed, or not written (fused)
+        if(!useComputeQueue() && !fusedTonemap())
+        {
+          ImGui::Text("Denoised");
+          ImGui::Image(m_gBuffers->getDescriptorSet(eGbufDenoised), tumbnailSize);
+        }
       }
 
       ImGui::End();
@@ -345,18 +599,28 @@ public:
       {
         resetFrame();
       }
+      else if(reset_color)
+      {
+        resetAccumulation();
+      }
     }
 
-    m_tonemapper->updateComputeDescriptorSets(m_gBuffers->getDescriptorImageInfo(showDenoisedImage() ? eGbufDenoised : eGBufResult),
-                                              m_gBuffers->getDescriptorImageInfo(eGBufLdr));
+    m_tonemapDenoised = showDenoisedImage();
+    m_tonemapper->updateComputeDescriptorSets(m_tonemapDenoised ? m_gBuffers->getDescriptorImageInfo(eGbufDenoised) :
+                                                                  m_gRender->getDescriptorImageInfo(eGBufResult),
+                                              m_gBuffers->getDescriptorImageInfo(ldrTarget()));
 
 
     {  // Rendering Viewport
       ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0.0F, 0.0F));
       ImGui::Begin("Viewport");
 
+      // Mouse position in the viewport, for the region of interest of the denoiser
+      if(ImGui::IsWindowHovered())
+        m_mouseUv = (ImGui::GetMousePos() - ImGui::GetCursorScreenPos()) / ImGui::GetContentRegionAvail();
+
       // Display the G-Buffer image
-      ImGui::Image(m_gBuffers->getDescriptorSet(eGBufLdr), ImGui::GetContentRegionAvail());
+      ImGui::Image(m_gBuffers->getDescriptorSet(useComputeQueue() ? m_ldrDisplay : eGBufLdr), ImGui::GetContentRegionAvail());
 
       if(m_settings.showAxis)
       {  // Display orientation axis at the bottom left corner of the window
@@ -374,18 +638,35 @@ public:
 
   void onRender(VkCommandBuffer /*cmd*/) override
   {
+    waitDenoiser();
+    pollSceneLoad(false);
+    if(!m_benchRuns.empty())
+      benchmarkStep();
     if(!m_scene->valid())
+    {
+      acquireDisplayedImage();
       return;
+    }
     // Update the frame only if the scene is valid
     if(!updateFrame())
+    {
+      acquireDisplayedImage();
       return;
+    }
+    if(!m_benchRuns.empty())
+      benchmarkFrame();
+    updateDenoiseSchedule();
+    waitComputeQueue();
+    readTimings();
 
     // Using local command buffer for the frame
-    const CommandFrame& commandFrame = m_commandFrames[m_app->getFrameCycleIndex()];
-    VkCommandBuffer     cmd          = commandFrame.cmdBuffer[0];
+    CommandFrame&   commandFrame = m_commandFrames[m_app->getFrameCycleIndex()];
+    VkCommandBuffer cmd          = commandFrame.cmdBuffer[0];
     vkResetCommandPool(m_device, commandFrame.cmdPool, 0);
     VkCommandBufferBeginInfo begin_info{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, 0, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
     vkBeginCommandBuffer(cmd, &begin_info);
+    vkCmdResetQueryPool(cmd, m_queryPool, m_app->getFrameCycleIndex() * eQueryCount, eQueryCount);
+    m_frameQueries[m_app->getFrameCycleIndex()] = {.frame = m_frame};
 
     // Get camera info
     float     view_aspect_ratio = m_viewSize.x / m_viewSize.y;
@@ -399,28 +680,75 @@ public:
     m_frameInfo.view = CameraManip.getMatrix();
     m_frameInfo.proj = glm::perspectiveRH_ZO(glm::radians(CameraManip.getFov()), view_aspect_ratio, clip.x, clip.y);
     m_frameInfo.proj[1][1] *= -1;
-    m_frameInfo.projInv     = glm::inverse(m_frameInfo.proj);
-    m_frameInfo.viewInv     = glm::inverse(m_frameInfo.view);
+    m_frameInfo.projInv      = glm::inverse(m_frameInfo.proj);
+    m_frameInfo.viewInv      = glm::inverse(m_frameInfo.view);
+    m_frameInfo.prevViewProj = m_prevViewProj;  // For motion vectors
+    m_prevViewProj           = m_frameInfo.proj * m_frameInfo.view;
     m_frameInfo.camPos      = eye;
     m_frameInfo.envRotation = m_settings.envRotation;
     m_frameInfo.clearColor  = m_settings.clearColor;
     vkCmdUpdateBuffer(cmd, m_bFrameInfo.buffer, 0, sizeof(FrameInfo), &m_frameInfo);
 
     // Push constant
-    m_pushConst.maxDepth   = m_settings.maxDepth;
-    m_pushConst.maxSamples = m_settings.maxSamples;
-    m_pushConst.frame      = m_frame;
+    m_pushConst.maxDepth          = m_settings.maxDepth;
+    m_pushConst.maxSamples        = m_settings.maxSamples;
+    m_pushConst.frame             = m_frame;
+    m_pushConst.interopFlags      = interopFlags();
+    m_pushConst.convergenceSlot   = -1;
+    m_pushConst.convergenceScale  = convergenceScale();
+    m_pushConst.adaptiveThreshold = m_settings.adaptiveThreshold;
+    m_pushConst.sampler           = m_settings.sampler;
+    if(m_settings.denoiseSchedule == 1 && m_frame > 0)
+    {
+      m_pushConst.convergenceSlot                     = static_cast<int>(m_app->getFrameCycleIndex());
+      m_convergenceFrame[m_app->getFrameCycleIndex()] = m_frame;
+    }
+#ifdef NVP_SUPPORTS_OPTIX7
+    m_pushConst.interopSet = static_cast<int>(m_denoiser->getCurrentSet());
+#endif
+    if((m_pushConst.interopFlags & INTEROP_TRACE_GUIDES) != 0)
+    {
+      m_guidesValid = true;
+#ifdef NVP_SUPPORTS_OPTIX7
+      // #OPTIX_D
+      // New guides: written in all the sets in zero-copy, otherwise copied again from the images
+      m_denoiser->setGuidesValid((m_pushConst.interopFlags & INTEROP_WRITE_GUIDES) != 0);
+#endif
+    }
 
+    writeTimestamp(cmd, eQueryRaytraceBegin);
     raytraceScene(cmd);
+    writeTimestamp(cmd, eQueryRaytraceEnd);
+
+    if(useComputeQueue())
+    {
+      renderOnComputeQueue(cmd);
+      return;
+    }
 
 #ifdef NVP_SUPPORTS_OPTIX7
     // #OPTIX_D
     if(needToDenoise())
     {
       // Submit raytracing and signal
-      copyImagesToCuda(cmd);
+      if(!m_settings.denoiseZeroCopy)
+      {
+        writeTimestamp(cmd, eQueryCopyToBufferBegin);
+        copyImagesToCuda(cmd);
+        writeTimestamp(cmd, eQueryCopyToBufferEnd);
+      }
       vkEndCommandBuffer(cmd);  // Need to end the command buffer to submit the semaphore
 
+      // The interop buffers of the current set are overwritten by this submit: wait for the denoiser to be done with
+      // them. The guides written in all sets (zero-copy) need all denoises to be done.
+      bool write_shared = (m_pushConst.interopFlags & INTEROP_WRITE_GUIDES) != 0;
+      VkSemaphoreSubmitInfoKHR wait_previous{
+          .sType     = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR,
+          .semaphore = m_denoiser->getTLSemaphore(),
+          .value     = write_shared ? m_fenceValue : m_denoiser->getCurrentSetFenceValue(),
+          .stageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR,
+      };
+
       // Prepare the signal semaphore for the OptiX denoiser
       VkSemaphoreSubmitInfoKHR signal_semaphore{
           .sType     = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR,
@@ -433,6 +761,8 @@ public:
 
       VkSubmitInfo2KHR submits{
           .sType                    = VK_STRUCTURE_TYPE_SUBMIT_INFO_2_KHR,
+          .waitSemaphoreInfoCount   = 1,
+          .pWaitSemaphoreInfos      = &wait_previous,
           .commandBufferInfoCount   = 1,
           .pCommandBufferInfos      = &cmd_buf_info,
           .signalSemaphoreInfoCount = 1,
@@ -445,15 +775,19 @@ public:
       // #OPTIX_D
       // Denoiser waits for signal (Vulkan) and submit (Cuda) new one when done
       denoiseImage();
+      m_frameQueries[m_app->getFrameCycleIndex()].denoiseFence = m_fenceValue;
+      if(m_bench.firstDenoiseFence == 0)
+        m_bench.firstDenoiseFence = m_fenceValue;
 
       // #OPTIX_D
       // Adding a wait semaphore to the application, such that the frame command buffer,
       // will wait for the end of the denoised image before executing the command buffer.
+      // The copy back to image and the tonemapper are compute shaders, this is where the wait must happen.
       VkSemaphoreSubmitInfo wait_semaphore{
           .sType     = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR,
           .semaphore = m_denoiser->getTLSemaphore(),
           .value     = m_fenceValue,
-          .stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+          .stageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
       };
       m_app->addWaitSemaphore(wait_semaphore);
 
@@ -464,12 +798,37 @@ public:
 
       VkCommandBufferBeginInfo begin_info{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, 0, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
       vkBeginCommandBuffer(cmd, &begin_info);
-      copyCudaImagesToVulkan(cmd);
+      if(!fusedTonemap())
+      {
+        writeTimestamp(cmd, eQueryCopyToImageBegin);
+        copyCudaImagesToVulkan(cmd);
+        writeTimestamp(cmd, eQueryCopyToImageEnd);
+      }
+      m_denoiser->nextSet();  // Next frame can be ray traced in another set while this one is denoised
+    }
+    else if((m_pushConst.interopFlags & INTEROP_WRITE_GUIDES) != 0 || fusedTonemap() || (m_copyDenoised && m_tonemapDenoised))
+    {
+      // #OPTIX_D
+      // Zero-copy: the guides are written in the interop buffers of all sets, which the denoiser may still be reading.
+      // Fused tonemapper: the output buffer of the last denoise is read again.
+      // Fused tonemapper just turned off: the last denoise is copied again to eGbufDenoised.
+      VkSemaphoreSubmitInfo wait_semaphore{
+          .sType     = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR,
+          .semaphore = m_denoiser->getTLSemaphore(),
+          .value     = m_fenceValue,
+          .stageMask = VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT
+                       | VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+      };
+      m_app->addWaitSemaphore(wait_semaphore);
+      if(m_copyDenoised && m_tonemapDenoised && !fusedTonemap())
+        copyCudaImagesToVulkan(cmd);
     }
 #endif
 
     // Apply tonemapper - take GBuffer-X and output to GBuffer-0
-    m_tonemapper->runCompute(cmd, m_gBuffers->getSize());
+    writeTimestamp(cmd, eQueryTonemapBegin);
+    runTonemapper(cmd, ldrTarget());
+    writeTimestamp(cmd, eQueryTonemapEnd);
 
     // End of the first or second command buffer
     vkEndCommandBuffer(cmd);
@@ -480,20 +839,156 @@ public:
 
 
 private:
+  // Parsing the glTF file on a worker thread, the application keeps running (with the previous scene)
+  // meanwhile. The Vulkan side of the scene is created once it is parsed, see pollSceneLoad().
   void createScene(const std::string& filename)
   {
-    m_scene->load(filename);
-    nvvkhl::setCamera(filename, m_scene->getRenderCameras(), m_scene->getSceneBounds());  // Camera auto-scene-fitting
-    g_elemCamera->setSceneRadius(m_scene->getSceneBounds().radius());                     // Navigation help
+    m_sceneLoading = filename;
+    m_sceneLoad    = std::async(std::launch::async, [filename] {
+      auto scene = std::make_unique<nvh::gltf::Scene>();
+      scene->load(filename);
+      return scene;
+    });
+  }
+
+  // Building the Vulkan scene once it is parsed, one step per frame: upload, each BLAS batch, its compaction,
+  // then the TLAS. The upload is recorded on a thread, the other steps are small to record. Every step is
+  // submitted with m_sceneFence and the next one recorded when it is done, the current scene keeps rendering
+  // until the new one is swapped in. 'wait' runs all the steps now.
+  void pollSceneLoad(bool wait)
+  {
+    if(m_sceneStep == eSceneIdle)
+    {
+      if(!m_sceneLoad.valid())
+        return;
+      if(!wait && m_sceneLoad.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return;
+
+      m_nextScene     = m_sceneLoad.get();
+      m_nextSceneFile = std::move(m_sceneLoading);
+      m_sceneLoading.clear();
+      if(!m_nextScene->valid())
+      {
+        LOGE("Cannot load %s\n", m_nextSceneFile.c_str());
+        m_nextScene.reset();
+        return;
+      }
+      m_nextSceneVk   = std::make_unique<SceneVk>(m_device, m_physicalDevice, m_sceneAlloc.get());
+      m_nextSceneRtx  = std::make_unique<SceneRtx>(m_device, m_physicalDevice, m_alloc.get());
+      m_sceneStep     = eSceneUpload;
+      m_sceneBlasDone = false;
+      m_sceneUpload   = std::async(std::launch::async, [this] { recordSceneUpload(); });
+    }
+
+    do
+    {
+      if(m_sceneSubmitted)
+      {
+        if(wait)
+          NVVK_CHECK(vkWaitForFences(m_device, 1, &m_sceneFence, VK_TRUE, UINT64_MAX));
+        else if(vkGetFenceStatus(m_device, m_sceneFence) != VK_SUCCESS)
+          return;  // Still building, checked again next frame
+        m_sceneSubmitted = false;
+        if(m_sceneCompacting)  // The compacted copies of the batch are done, the originals can go
+          m_nextSceneRtx->destroyNonCompactedBlas();
+        m_sceneCompacting = false;
+      }
+      if(m_sceneStep == eSceneUpload && !wait && m_sceneUpload.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return;  // Still decoding the images, checked again next frame
+      stepSceneBuild();
+    } while(wait && m_sceneStep != eSceneIdle);
+  }
+
+  // Upload thread: SceneVk decodes the images and fills the staging of the buffers and textures, the longest part
+  // of the build on the CPU. Only this thread uses m_sceneAlloc, m_sceneCmd and m_sceneFence until it returns.
+  void recordSceneUpload()
+  {
+    NVVK_CHECK(vkResetFences(m_device, 1, &m_sceneFence));
+    NVVK_CHECK(vkResetCommandPool(m_device, m_sceneCmdPool, 0));
+    VkCommandBufferBeginInfo begin_info{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, 0, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+    vkBeginCommandBuffer(m_sceneCmd, &begin_info);
+    m_nextSceneVk->create(m_sceneCmd, *m_nextScene);
+    m_sceneAlloc->finalizeStaging(m_sceneFence);  // Staging kept until the upload is done
+    vkEndCommandBuffer(m_sceneCmd);
+  }
+
+  // Recording and submitting the next step of the scene build, or swapping the scene in when all are done
+  void stepSceneBuild()
+  {
+    if(m_sceneStep == eSceneSwap)
+    {
+      swapScene();
+      return;
+    }
 
-    {  // Create the Vulkan side of the scene
-      auto cmd = m_app->createTempCmdBuffer();
-      m_sceneVk->create(cmd, *m_scene);
-      m_sceneRtx->create(cmd, *m_scene, *m_sceneVk, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);  // Create BLAS / TLAS
-      m_app->submitAndWaitTempCmdBuffer(cmd);
+    if(m_sceneStep == eSceneUpload)
+    {
+      m_sceneUpload.get();  // m_sceneCmd recorded by the upload thread
+      m_nextSceneRtx->createBottomLevelAccelerationStructure(*m_nextScene, *m_nextSceneVk,
+                                                             VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+                                                                 | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
+      m_sceneStep = eSceneBlas;
+      submitSceneStep();
+      return;
+    }
 
-      m_picker->setTlas(m_sceneRtx->tlas());
+    NVVK_CHECK(vkResetFences(m_device, 1, &m_sceneFence));
+    NVVK_CHECK(vkResetCommandPool(m_device, m_sceneCmdPool, 0));
+    VkCommandBufferBeginInfo begin_info{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, 0, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+    vkBeginCommandBuffer(m_sceneCmd, &begin_info);
+    switch(m_sceneStep)
+    {
+      case eSceneBlas:  // A batch bounding the scratch memory, compacted before the next one
+        m_sceneBlasDone = m_nextSceneRtx->cmdBuildBottomLevelAccelerationStructure(m_sceneCmd, 512'000'000);
+        m_sceneStep     = eSceneCompact;
+        break;
+      case eSceneCompact:
+        m_nextSceneRtx->cmdCompactBlas(m_sceneCmd);
+        m_sceneCompacting = true;
+        m_sceneStep       = m_sceneBlasDone ? eSceneTlas : eSceneBlas;
+        break;
+      default:  // eSceneTlas
+        m_nextSceneRtx->cmdCreateBuildTopLevelAccelerationStructure(m_sceneCmd, *m_nextScene);
+        m_sceneStep = eSceneSwap;
+        break;
     }
+    vkEndCommandBuffer(m_sceneCmd);
+    submitSceneStep();
+  }
+
+  // The images are transitioned for the shaders and their mipmaps blitted by SceneVk: the upload is on the graphics
+  // queue like the other steps, which need it for the acceleration structures anyway.
+  void submitSceneStep()
+  {
+    VkSubmitInfo submit{.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO, .commandBufferCount = 1, .pCommandBuffers = &m_sceneCmd};
+    NVVK_CHECK(vkQueueSubmit(m_app->getQueue(0).queue, 1, &submit, m_sceneFence));
+    m_sceneSubmitted = true;
+  }
+
+  // The new scene is built: replacing the one in use, the only wait is for the frames still rendering it
+  void swapScene()
+  {
+    waitDenoiser();
+    vkDeviceWaitIdle(m_device);
+    m_alloc->releaseStaging();  // Uploads of the scene are done
+    m_sceneAlloc->releaseStaging();
+    m_sceneVk->destroy();
+    m_sceneRtx->destroy();
+    m_scene      = std::move(m_nextScene);
+    m_sceneVk    = std::move(m_nextSceneVk);
+    m_sceneRtx   = std::move(m_nextSceneRtx);
+    m_sceneStep  = eSceneIdle;
+    m_pickedNode = -1;
+    m_picker->setTlas(m_sceneRtx->tlas());
+    createSceneVk(m_nextSceneFile);
+    resetFrame();
+  }
+
+  // Descriptor sets and pipelines of the scene in use, and its camera
+  void createSceneVk(const std::string& filename)
+  {
+    nvvkhl::setCamera(filename, m_scene->getRenderCameras(), m_scene->getSceneBounds());  // Camera auto-scene-fitting
+    g_elemCamera->setSceneRadius(m_scene->getSceneBounds().radius());                     // Navigation help
 
     m_allNodes      = m_scene->getShadedNodes(nvh::gltf::Scene::PipelineType::eRasterAll);
     m_solidMatNodes = m_scene->getShadedNodes(nvh::gltf::Scene::PipelineType::eRasterSolid);
@@ -508,27 +1003,68 @@ private:
   }
 
 
-  void createGbuffers(const glm::vec2& size)
+  VkFormat depthFormat() const
   {
     static auto depth_format = nvvk::findDepthFormat(m_app->getPhysicalDevice());  // Not all depth are supported
+    return depth_format;
+  }
 
-    m_viewSize = size;
-    VkExtent2D vk_size{static_cast<uint32_t>(m_viewSize.x), static_cast<uint32_t>(m_viewSize.y)};
-
-    // Four GBuffers: RGBA8 and 4x RGBA32F(final,albedo,normal, denoised), rendering to RGBA32F and tone mapped to RGBA8
-    std::vector<VkFormat> color_buffers = {
+  // Display GBuffers: RGBA8 and RGBA32F (denoised), tone mapped to RGBA8
+  static std::vector<VkFormat> displayFormats()
+  {
+    return {
         VK_FORMAT_R8G8B8A8_UNORM,       // LDR
+        VK_FORMAT_R32G32B32A32_SFLOAT,  // Denoised
+        VK_FORMAT_R8G8B8A8_UNORM,       // LDR, compute queue
+    };
+  }
+
+  // Rendering GBuffers: 3x RGBA32F (final, albedo, normal) and RG32F (moments)
+  std::vector<VkFormat> renderFormats() const
+  {
+    std::vector<VkFormat> formats = {
         VK_FORMAT_R32G32B32A32_SFLOAT,  // Result
         VK_FORMAT_R32G32B32A32_SFLOAT,  // Albedo
         VK_FORMAT_R32G32B32A32_SFLOAT,  // Normal
-        VK_FORMAT_R32G32B32A32_SFLOAT,  // Denoised
+        VK_FORMAT_R32G32_SFLOAT,        // Moments
     };
+    if(m_settings.denoiseAovs)
+      formats.insert(formats.end(), NB_AOVS, VK_FORMAT_R32G32B32A32_SFLOAT);  // Diffuse, specular, emission
+    return formats;
+  }
+
+  static VkExtent2D renderExtent(const glm::vec2& viewSize, bool upscale)
+  {
+    VkExtent2D render_size{static_cast<uint32_t>(viewSize.x), static_cast<uint32_t>(viewSize.y)};
+    if(upscale)
+    {
+      // #OPTIX_D
+      // Path tracing a quarter of the pixels, the denoised image is twice the rendering size
+      render_size = {(render_size.width + 1) / 2, (render_size.height + 1) / 2};
+    }
+    return render_size;
+  }
+
+  static VkExtent2D displayExtent(const VkExtent2D& renderSize, bool upscale)
+  {
+    return upscale ? VkExtent2D{renderSize.width * 2, renderSize.height * 2} : renderSize;
+  }
+
+  void createGbuffers(const glm::vec2& size)
+  {
+    m_viewSize              = size;
+    VkExtent2D render_size  = renderExtent(m_viewSize, m_settings.denoiseUpscale);
+    VkExtent2D display_size = displayExtent(render_size, m_settings.denoiseUpscale);
 
     // Creation of the GBuffers
-    m_gBuffers = std::make_unique<nvvkhl::GBuffer>(m_device, m_alloc.get(), vk_size, color_buffers, depth_format);
+    m_gBuffers = std::make_unique<nvvkhl::GBuffer>(m_device, m_alloc.get(), display_size, displayFormats(), depthFormat());
+    m_gRender  = std::make_unique<nvvkhl::GBuffer>(m_device, m_alloc.get(), render_size, renderFormats(), depthFormat());
+    m_ldrDisplay = eGBufLdr;
+    m_ldrAcquire = false;
 
 #ifdef NVP_SUPPORTS_OPTIX7
-    m_denoiser->allocateBuffers(vk_size);
+    if(!m_denoiserInit.valid())  // Otherwise allocated by waitDenoiser()
+      m_denoiser->allocateBuffers(render_size);
 #endif
 
     // Indicate the renderer to reset its frame
@@ -545,6 +1081,19 @@ private:
                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
     m_dutil->DBG_NAME(m_bFrameInfo.buffer);
 
+    // #OPTIX_D
+    // Change of the accumulation, one counter per frame in flight, read back by the CPU
+    m_bConvergence = m_alloc->createBuffer(sizeof(uint32_t) * m_commandFrames.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    m_dutil->DBG_NAME(m_bConvergence.buffer);
+    m_convergence = static_cast<uint32_t*>(m_alloc->map(m_bConvergence));
+    std::fill_n(m_convergence, m_commandFrames.size(), 0U);
+
+    // #OPTIX_D
+    // Blue-noise mask of the sampler, tiled on the image
+    m_bBlueNoise = m_alloc->createBuffer(cmd, makeBlueNoise(BLUE_NOISE_SIZE), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    m_dutil->DBG_NAME(m_bBlueNoise.buffer);
+
     m_app->submitAndWaitTempCmdBuffer(cmd);
   }
 
@@ -560,6 +1109,15 @@ private:
     // #OPTIX_D
     d->addBinding(RtxBindings::eOutAlbedo, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_ALL);
     d->addBinding(RtxBindings::eOutNormal, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_ALL);
+    d->addBinding(RtxBindings::eOutColorBuffer, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, MAX_INTEROP_SETS, VK_SHADER_STAGE_ALL);
+    d->addBinding(RtxBindings::eOutAlbedoBuffer, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, MAX_INTEROP_SETS, VK_SHADER_STAGE_ALL);
+    d->addBinding(RtxBindings::eOutNormalBuffer, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, MAX_INTEROP_SETS, VK_SHADER_STAGE_ALL);
+    d->addBinding(RtxBindings::eOutFlowBuffer, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, MAX_INTEROP_SETS, VK_SHADER_STAGE_ALL);
+    d->addBinding(RtxBindings::eConvergence, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
+    d->addBinding(RtxBindings::eOutMoments, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_ALL);
+    d->addBinding(RtxBindings::eOutAovs, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, NB_AOVS, VK_SHADER_STAGE_ALL);
+    d->addBinding(RtxBindings::eOutAovBuffer, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, MAX_INTEROP_SETS * NB_AOVS, VK_SHADER_STAGE_ALL);
+    d->addBinding(RtxBindings::eBlueNoise, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
     d->initLayout();
     d->initPool(1);
     m_dutil->DBG_NAME(d->getLayout());
@@ -697,7 +1255,7 @@ private:
     ray_pipeline_info.pGroups                      = shader_groups.data();
     ray_pipeline_info.maxPipelineRayRecursionDepth = 2;  // Ray depth
     ray_pipeline_info.layout                       = p.layout;
-    vkCreateRayTracingPipelinesKHR(m_device, {}, {}, 1, &ray_pipeline_info, nullptr, (p.plines).data());
+    vkCreateRayTracingPipelinesKHR(m_device, {}, m_pipelineCache, 1, &ray_pipeline_info, nullptr, (p.plines).data());
     m_dutil->DBG_NAME(p.plines[0]);
 
     // Creating the SBT
@@ -724,10 +1282,21 @@ private:
     VkWriteDescriptorSetAccelerationStructureKHR desc_as_info{VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR};
     desc_as_info.accelerationStructureCount = 1;
     desc_as_info.pAccelerationStructures    = &tlas;
-    VkDescriptorImageInfo image_info{{}, m_gBuffers->getColorImageView(eGBufResult), VK_IMAGE_LAYOUT_GENERAL};
+    VkDescriptorImageInfo image_info{{}, m_gRender->getColorImageView(eGBufResult), VK_IMAGE_LAYOUT_GENERAL};
     // #OPTIX_D
-    VkDescriptorImageInfo albedo_info{{}, m_gBuffers->getColorImageView(eGBufAlbedo), VK_IMAGE_LAYOUT_GENERAL};
-    VkDescriptorImageInfo normal_info{{}, m_gBuffers->getColorImageView(eGBufNormal), VK_IMAGE_LAYOUT_GENERAL};
+    VkDescriptorImageInfo albedo_info{{}, m_gRender->getColorImageView(eGBufAlbedo), VK_IMAGE_LAYOUT_GENERAL};
+    VkDescriptorImageInfo normal_info{{}, m_gRender->getColorImageView(eGBufNormal), VK_IMAGE_LAYOUT_GENERAL};
+    VkDescriptorImageInfo moments_info{{}, m_gRender->getColorImageView(eGBufMoments), VK_IMAGE_LAYOUT_GENERAL};
+    // Light-path AOVs, the result image stands in for them when they are not rendered (never written)
+    std::array<VkDescriptorImageInfo, NB_AOVS> aov_info;
+    for(uint32_t a = 0; a < NB_AOVS; a++)
+    {
+      uint32_t idx = m_settings.denoiseAovs ? eGBufAovs + a : eGBufResult;
+      aov_info[a]  = {{}, m_gRender->getColorImageView(idx), VK_IMAGE_LAYOUT_GENERAL};
+    }
+
+    VkDescriptorBufferInfo convergence_info{m_bConvergence.buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo blue_noise_info{m_bBlueNoise.buffer, 0, VK_WHOLE_SIZE};
 
     std::vector<VkWriteDescriptorSet> writes;
     writes.emplace_back(d->makeWrite(0, RtxBindings::eTlas, &desc_as_info));
@@ -735,6 +1304,42 @@ private:
     // #OPTIX_D
     writes.emplace_back(d->makeWrite(0, RtxBindings::eOutAlbedo, &albedo_info));
     writes.emplace_back(d->makeWrite(0, RtxBindings::eOutNormal, &normal_info));
+    writes.emplace_back(d->makeWrite(0, RtxBindings::eConvergence, &convergence_info));
+    writes.emplace_back(d->makeWrite(0, RtxBindings::eOutMoments, &moments_info));
+    writes.emplace_back(d->makeWriteArray(0, RtxBindings::eOutAovs, aov_info.data()));
+    writes.emplace_back(d->makeWrite(0, RtxBindings::eBlueNoise, &blue_noise_info));
+#ifdef NVP_SUPPORTS_OPTIX7
+    // Zero-copy: the interop buffers are written by the ray tracer, all array elements are written (repeating the sets).
+    // Not allocated yet while the denoiser is initializing, waitDenoiser() writes the set again.
+    std::array<std::array<VkDescriptorBufferInfo, MAX_INTEROP_SETS>, 3> interop_info;
+    std::array<VkDescriptorBufferInfo, MAX_INTEROP_SETS * NB_AOVS>      aov_buffer_info;
+    std::array<VkDescriptorBufferInfo, MAX_INTEROP_SETS>                flow_info;
+    if(!m_denoiserInit.valid())
+    {
+      for(uint32_t s = 0; s < MAX_INTEROP_SETS; s++)
+      {
+        std::array<VkDescriptorBufferInfo, 3> set_info = m_denoiser->getInputBufferInfos(s % m_denoiser->getInteropSetCount());
+        for(size_t b = 0; b < set_info.size(); b++)
+          interop_info[b][s] = set_info[b];
+      }
+      writes.emplace_back(d->makeWriteArray(0, RtxBindings::eOutColorBuffer, interop_info[0].data()));
+      writes.emplace_back(d->makeWriteArray(0, RtxBindings::eOutAlbedoBuffer, interop_info[1].data()));
+      writes.emplace_back(d->makeWriteArray(0, RtxBindings::eOutNormalBuffer, interop_info[2].data()));
+      // AOV buffers of each set, the color buffer of the set when the denoiser has no AOVs (never written)
+      for(uint32_t s = 0; s < MAX_INTEROP_SETS; s++)
+      {
+        for(uint32_t a = 0; a < NB_AOVS; a++)
+        {
+          uint32_t set = s % m_denoiser->getInteropSetCount();
+          aov_buffer_info[s * NB_AOVS + a] = m_denoiser->getAovCount() > a ? m_denoiser->getAovBufferInfo(set, a) : interop_info[0][s];
+        }
+      }
+      writes.emplace_back(d->makeWriteArray(0, RtxBindings::eOutAovBuffer, aov_buffer_info.data()));
+      for(uint32_t s = 0; s < MAX_INTEROP_SETS; s++)
+        flow_info[s] = m_denoiser->getFlowBufferInfo(s % m_denoiser->getInteropSetCount());
+      writes.emplace_back(d->makeWriteArray(0, RtxBindings::eOutFlowBuffer, flow_info.data()));
+    }
+#endif
 
     vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
   }
@@ -778,7 +1383,8 @@ private:
     const auto& m   = CameraManip.getMatrix();
     const auto  fov = CameraManip.getFov();
 
-    if(ref_cam_matrix != m || ref_fov != fov)
+    bool moving = ref_cam_matrix != m || ref_fov != fov;
+    if(moving)
     {
       resetFrame();
       ref_cam_matrix = m;
@@ -790,13 +1396,38 @@ private:
       return false;
     }
     m_frame++;
+
+#ifdef NVP_SUPPORTS_OPTIX7
+    // #OPTIX_D
+    // Quality ladder: color only while the camera moves, then adding the guides as the image converges
+    if(m_settings.denoiseLadder)
+    {
+      DenoiserOptix::Quality quality = DenoiserOptix::eQualityFull;
+      if(moving || m_frame < m_settings.ladderAlbedoFrame)
+        quality = DenoiserOptix::eQualityMotion;
+      else if(m_frame < m_settings.ladderFullFrame)
+        quality = DenoiserOptix::eQualityAlbedo;
+      m_denoiser->setQuality(quality);
+    }
+#endif  // NVP_SUPPORTS_OPTIX7
     return true;
   }
 
   //--------------------------------------------------------------------------------------------------
   // To be call when renderer need to re-start
   //
-  void resetFrame() { m_frame = -1; }
+  void resetFrame()
+  {
+    resetAccumulation();
+    m_guidesValid = false;
+  }
+
+  // Only the shading changed (environment): the G-Buffer guides of the previous image are kept
+  void resetAccumulation()
+  {
+    m_frame = -1;
+    m_convergenceFrame.fill(-1);  // Measures in flight are from the previous image
+  }
 
   void windowTitle()
   {
@@ -858,6 +1489,7 @@ private:
     if(pr.instanceID == ~0)
     {
       LOGI("Nothing Hit\n");
+      m_pickedNode = -1;
       return;
     }
 
@@ -867,6 +1499,8 @@ private:
       return;
     }
 
+    m_pickedNode = static_cast<int>(pr.instanceID);
+
     // Find where the hit point is and set the interest position
     glm::vec3 world_pos = glm::vec3(pr.worldRayOrigin + pr.worldRayDirection * pr.hitT);
     glm::vec3 eye;
@@ -897,7 +1531,7 @@ private:
     vkCmdPushConstants(cmd, m_rtxPipe.layout, VK_SHADER_STAGE_ALL, 0, sizeof(PushConstant), &m_pushConst);
 
     const auto& regions = m_sbt->getRegions();
-    const auto& size    = m_gBuffers->getSize();
+    const auto& size    = m_gRender->getSize();
     vkCmdTraceRaysKHR(cmd, regions.data(), &regions[1], &regions[2], &regions[3], size.width, size.height, 1);
 
     // Making sure the rendered image is ready to be used
@@ -905,7 +1539,7 @@ private:
       auto scope_dbg2 = m_dutil->scopeLabel(cmd, "barrier");
 
       auto image_memory_barrier =
-          nvvk::makeImageMemoryBarrier(m_gBuffers->getColorImage(eGBufResult), VK_ACCESS_SHADER_READ_BIT,
+          nvvk::makeImageMemoryBarrier(m_gRender->getColorImage(eGBufResult), VK_ACCESS_SHADER_READ_BIT,
                                        VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
       vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0,
                            nullptr, 0, nullptr, 1, &image_memory_barrier);
@@ -927,6 +1561,14 @@ private:
     {
       if(m_frame == m_settings.maxFrames)
         return true;
+      if(m_settings.denoiseRoi != 0)
+        return true;  // The cost scales with the region, denoising every frame
+      if(m_settings.denoiseLadder && m_frame <= m_settings.ladderFullFrame)
+        return true;  // Cheaper denoisers until the first full one
+      if(m_settings.denoiseTemporal && m_frame < m_settings.denoiseEveryNFrames)
+        return true;  // Interactive: every frame is denoised until the N-th frame
+      if(m_settings.denoiseSchedule == 1)
+        return m_schedule.denoiseNow;
       if(!m_settings.denoiseFirstFrame && m_frame == 0)
         return false;
       if(m_frame % m_settings.denoiseEveryNFrames == 0)
@@ -935,14 +1577,116 @@ private:
     return false;
   }
 
+  // Pixels measured by the ray tracer, one per CONVERGENCE_STRIDE^2 block
+  double nbConvergencePixels() const
+  {
+    VkExtent2D size = m_gRender->getSize();
+    return static_cast<double>((size.width + CONVERGENCE_STRIDE - 1) / CONVERGENCE_STRIDE)
+           * ((size.height + CONVERGENCE_STRIDE - 1) / CONVERGENCE_STRIDE);
+  }
+
+  // Fixed point scale of the measured change: at most 1.0 per pixel, the sum must not overflow the 32-bit
+  // counter (8K: ~2M pixels measured). An integer, so that the float conversion cannot round it up.
+  float convergenceScale() const
+  {
+    return static_cast<float>(std::floor(std::min(CONVERGENCE_SCALE, 4294967295.0 / std::max(nbConvergencePixels(), 1.0))));
+  }
+
+  // #OPTIX_D
+  // Adaptive denoising: adding the change measured by the ray tracer for the frame which last used this
+  // frame-in-flight slot (its fence was waited on), then deciding if the current frame is denoised.
+  // A denoise happens when the image has changed enough since the last one, or when the latency budget
+  // runs out. The budget doubles each time it runs out, as the image is then converging.
+  void updateDenoiseSchedule()
+  {
+    uint32_t slot = m_app->getFrameCycleIndex();
+    if(m_convergenceFrame[slot] > 0)
+    {
+      m_schedule.changeSinceDenoise += static_cast<float>(m_convergence[slot] / (convergenceScale() * nbConvergencePixels()));
+    }
+    m_convergence[slot]      = 0;
+    m_convergenceFrame[slot] = -1;
+
+    DenoiseSchedule& s = m_schedule;
+    s.denoiseNow       = false;
+    if(m_frame == 0)
+    {
+      s        = {};
+      s.budget = m_settings.denoiseEveryNFrames;
+    }
+    if(m_settings.denoiseSchedule != 1 || !m_settings.denoiseApply)
+      return;
+
+    if(m_frame == 0)
+      s.denoiseNow = m_settings.denoiseFirstFrame;
+    else if(m_frame == m_settings.maxFrames || s.changeSinceDenoise >= m_settings.denoiseThreshold)
+      s.denoiseNow = true;
+    else if(m_frame - std::max(s.lastDenoised, 0) >= s.budget)
+    {
+      s.denoiseNow = true;
+      s.budget     = std::min(s.budget * 2, m_settings.maxFrames);  // Converged: backing off
+    }
+
+    if(s.denoiseNow)
+    {
+      s.lastDenoised       = m_frame;
+      s.changeSinceDenoise = 0.0F;
+    }
+  }
+
+  // #OPTIX_D
+  // Zero-copy: tell the ray tracer which denoiser inputs to write directly in the interop buffers
+  int interopFlags() const
+  {
+    int flags = 0;
+    if(m_frame == 0 && !m_guidesValid)  // Guides are only traced on the first frame, or kept from the previous image
+      flags |= INTEROP_TRACE_GUIDES;
+#ifdef NVP_SUPPORTS_OPTIX7
+    // Motion vectors of the set denoised: the camera motion on the first frame, zero after (camera is not moving)
+    if(m_settings.denoiseTemporal && needToDenoise())
+      flags |= INTEROP_WRITE_FLOW;
+
+    // Light-path AOVs are always written directly, there are no images to copy them from
+    if(m_settings.denoiseAovs)
+    {
+      flags |= INTEROP_AOVS;
+      if(needToDenoise())
+        flags |= INTEROP_WRITE_AOVS;
+    }
+
+    if(!m_settings.denoiseZeroCopy && !m_settings.denoiseAovs)
+      return flags;
+
+    if(m_settings.denoiseZeroCopy)
+    {
+      if(needToDenoise())
+        flags |= INTEROP_WRITE_COLOR;
+      if(m_frame == 0 && (!m_guidesValid || !m_denoiser->getGuidesValid()))  // Sets re-allocated: trace them again
+        flags |= INTEROP_WRITE_GUIDES | INTEROP_TRACE_GUIDES;
+    }
+
+    OptixPixelFormat format = denoiserPixelFormat();
+    if(format == OPTIX_PIXEL_FORMAT_HALF3 || format == OPTIX_PIXEL_FORMAT_HALF4)
+      flags |= INTEROP_HALF;
+    if(format == OPTIX_PIXEL_FORMAT_FLOAT3 || format == OPTIX_PIXEL_FORMAT_HALF3)
+      flags |= INTEROP_RGB;
+    OptixPixelFormat guide_format = m_denoiser->getGuideFormat();
+    if(guide_format == OPTIX_PIXEL_FORMAT_HALF3 || guide_format == OPTIX_PIXEL_FORMAT_HALF4)
+      flags |= INTEROP_GUIDES_HALF;
+    if(guide_format == OPTIX_PIXEL_FORMAT_FLOAT3 || guide_format == OPTIX_PIXEL_FORMAT_HALF3)
+      flags |= INTEROP_GUIDES_RGB;
+#endif  // NVP_SUPPORTS_OPTIX7
+    return flags;
+  }
+
   // #OPTIX_D
   // Will copy the Vulkan images to Cuda buffers
   void copyImagesToCuda(VkCommandBuffer cmd)
   {
 #ifdef NVP_SUPPORTS_OPTIX7
-    nvvk::Texture result{m_gBuffers->getColorImage(eGBufResult), nullptr, m_gBuffers->getDescriptorImageInfo(eGBufResult)};
-    nvvk::Texture albedo{m_gBuffers->getColorImage(eGBufAlbedo), nullptr, m_gBuffers->getDescriptorImageInfo(eGBufAlbedo)};
-    nvvk::Texture normal{m_gBuffers->getColorImage(eGBufNormal), nullptr, m_gBuffers->getDescriptorImageInfo(eGBufNormal)};
+    nvvk::Texture result{m_gRender->getColorImage(eGBufResult), nullptr, m_gRender->getDescriptorImageInfo(eGBufResult)};
+    nvvk::Texture albedo{m_gRender->getColorImage(eGBufAlbedo), nullptr, m_gRender->getDescriptorImageInfo(eGBufAlbedo)};
+    nvvk::Texture normal{m_gRender->getColorImage(eGBufNormal), nullptr, m_gRender->getDescriptorImageInfo(eGBufNormal)};
     m_denoiser->imageToBuffer(cmd, {result, albedo, normal});
 #endif  // NVP_SUPPORTS_OPTIX7
   }
@@ -954,28 +1698,499 @@ private:
 #ifdef NVP_SUPPORTS_OPTIX7
     nvvk::Texture denoised{m_gBuffers->getColorImage(eGbufDenoised), nullptr, m_gBuffers->getDescriptorImageInfo(eGbufDenoised)};
     m_denoiser->bufferToImage(cmd, &denoised);
+    m_copyDenoised = false;
 #endif  // NVP_SUPPORTS_OPTIX7
   }
 
   // #OPTIX_D
-  // Invoke the Optix denoiser
-  void denoiseImage()
+  // Region of interest of the denoiser, in rendered pixels: a square around the mouse, or the screen bounds of
+  // the picked object (the denoiser adds the overlap window around it). The whole image when nothing is picked
+  // or when the object crosses the camera plane.
+  VkRect2D denoiseRegion() const
   {
-#ifdef NVP_SUPPORTS_OPTIX7
-    m_denoiser->denoiseImageBuffer(m_fenceValue, m_blendFactor);
-#endif  // NVP_SUPPORTS_OPTIX7
+    const VkExtent2D size = m_gRender->getSize();
+    VkRect2D         region{{0, 0}, size};
+    if(m_settings.denoiseRoi == 1)
+    {
+      const int half = m_settings.denoiseRoiSize / 2;
+      region.offset  = {static_cast<int32_t>(m_mouseUv.x * size.width) - half, static_cast<int32_t>(m_mouseUv.y * size.height) - half};
+      region.extent  = {static_cast<uint32_t>(m_settings.denoiseRoiSize), static_cast<uint32_t>(m_settings.denoiseRoiSize)};
+      return region;
+    }
+    if(m_pickedNode < 0 || m_pickedNode >= static_cast<int>(m_scene->getRenderNodes().size()))
+      return region;
+
+    // Object bounds, from the min/max of the positions of its primitive, projected with the camera of the frame
+    const nvh::gltf::RenderNode& node = m_scene->getRenderNodes()[m_pickedNode];
+    const tinygltf::Primitive*   prim = m_scene->getRenderPrimitive(node.renderPrimID).pPrimitive;
+    const tinygltf::Accessor&    acc  = m_scene->getModel().accessors[prim->attributes.at("POSITION")];
+    if(acc.minValues.size() < 3 || acc.maxValues.size() < 3)
+      return region;
+    const glm::mat4 mvp = m_frameInfo.proj * m_frameInfo.view * node.worldMatrix;
+    glm::vec2       lo(std::numeric_limits<float>::max());
+    glm::vec2       hi(-std::numeric_limits<float>::max());
+    for(int c = 0; c < 8; c++)
+    {
+      glm::vec4 p = mvp * glm::vec4((c & 1) != 0 ? acc.maxValues[0] : acc.minValues[0], (c & 2) != 0 ? acc.maxValues[1] : acc.minValues[1],
+                                    (c & 4) != 0 ? acc.maxValues[2] : acc.minValues[2], 1.0F);
+      if(p.w <= 0.0F)
+        return region;
+      glm::vec2 uv = (glm::vec2(p) / p.w) * 0.5F + 0.5F;
+      lo           = glm::min(lo, uv);
+      hi           = glm::max(hi, uv);
+    }
+    lo            = glm::clamp(lo, 0.0F, 1.0F) * glm::vec2(size.width, size.height);
+    hi            = glm::clamp(hi, 0.0F, 1.0F) * glm::vec2(size.width, size.height);
+    region.offset = {static_cast<int32_t>(std::floor(lo.x)), static_cast<int32_t>(std::floor(lo.y))};
+    region.extent = {static_cast<uint32_t>(std::ceil(hi.x) - std::floor(lo.x)), static_cast<uint32_t>(std::ceil(hi.y) - std::floor(lo.y))};
+    return region;
   }
 
   // #OPTIX_D
-  // Determine which image will be displayed, the original from ray tracer or the denoised one
-  bool showDenoisedImage() const
-  {
-    return m_settings.denoiseApply
-           && ((m_frame >= m_settings.denoiseEveryNFrames) || m_settings.denoiseFirstFrame || (m_frame >= m_settings.maxFrames));
-  }
-
-
-  void createCommandBuffers()
+  // Tonemapper of the frame: from the denoised buffer directly when fused, otherwise from the image selected
+  // in onUIRender (denoised or rendered)
+  void runTonemapper(VkCommandBuffer cmd, uint32_t ldr)
+  {
+#ifdef NVP_SUPPORTS_OPTIX7
+    if(fusedTonemap())
+    {
+      nvvk::Texture ldr_image{m_gBuffers->getColorImage(ldr), nullptr, m_gBuffers->getDescriptorImageInfo(ldr)};
+      m_denoiser->tonemapBufferToImage(cmd, &ldr_image, m_tonemapper->settings());
+      return;
+    }
+#endif  // NVP_SUPPORTS_OPTIX7
+    m_tonemapper->runCompute(cmd, m_gBuffers->getSize());
+  }
+
+  // The denoised result is tone mapped from the buffer of the last denoise, without the copy to eGbufDenoised
+  bool fusedTonemap() const
+  {
+#ifdef NVP_SUPPORTS_OPTIX7
+    return m_settings.denoiseFusedTonemap && m_tonemapDenoised;
+#else
+    return false;
+#endif
+  }
+
+  // #OPTIX_D
+  // Joining the background initialization of the denoiser (see onAttach), then creating what depends on it
+  void waitDenoiser()
+  {
+#ifdef NVP_SUPPORTS_OPTIX7
+    if(!m_denoiserInit.valid())
+      return;
+    m_denoiserInit.get();
+    m_denoiser->bindCudaDevice();  // Was made current on the initialization thread only
+    m_denoiser->allocateBuffers(m_gRender->getSize());
+    writeRtxSet();
+#endif  // NVP_SUPPORTS_OPTIX7
+  }
+
+  // #OPTIX_D
+  // Invoke the Optix denoiser
+  void denoiseImage()
+  {
+#ifdef NVP_SUPPORTS_OPTIX7
+    if(m_settings.denoiseRoi != 0)
+      m_denoiser->setRegion(denoiseRegion());
+    m_denoiser->denoiseImageBuffer(m_fenceValue, m_blendFactor, !m_settings.denoiseAsync);
+    if(m_settings.capture)
+    {
+      // Read back and encoded in the background, see FrameCapture
+      bool        png  = m_settings.captureFormat == FrameCapture::ePng;
+      std::string file = fmt::format("capture/denoised_{:05}.{}", m_captureIdx++, png ? "png" : "hdr");
+      m_capture.capture(*m_denoiser, file, static_cast<FrameCapture::Format>(m_settings.captureFormat));
+    }
+#endif  // NVP_SUPPORTS_OPTIX7
+  }
+
+#ifdef NVP_SUPPORTS_OPTIX7
+  // #OPTIX_D
+  // Temporal and/or upscale denoiser: re-creates the denoiser, then the G-Buffers and interop buffers,
+  // as the rendering size depends on the upscale mode
+  void setDenoiserMode()
+  {
+    vkDeviceWaitIdle(m_device);
+#if OPTIX_VERSION < 80000
+    m_settings.denoiseUpscale = false;  // Upscale models were added in OptiX 8
+#endif
+    m_denoiser->setDenoiserMode(m_settings.denoiseTemporal, m_settings.denoiseUpscale);
+    onResize(static_cast<uint32_t>(m_viewSize.x), static_cast<uint32_t>(m_viewSize.y));
+  }
+
+  // #OPTIX_D
+  // Format of the buffers shared with the denoiser: 16-bit floats take half the memory and bandwidth
+  OptixPixelFormat denoiserPixelFormat() const { return pixelFormatOf(m_settings.denoiseFormat); }
+  static OptixPixelFormat pixelFormatOf(int format)  // Index of the "Format" combo
+  {
+    constexpr std::array<OptixPixelFormat, 4> formats = {OPTIX_PIXEL_FORMAT_FLOAT4, OPTIX_PIXEL_FORMAT_HALF4,
+                                                         OPTIX_PIXEL_FORMAT_FLOAT3, OPTIX_PIXEL_FORMAT_HALF3};
+    return formats[format];
+  }
+
+  // #OPTIX_D
+  // Light-path AOVs denoised with the color: re-creates the rendering G-Buffers, holding their accumulation,
+  // and the interop buffers
+  void setDenoiserAovs()
+  {
+    vkDeviceWaitIdle(m_device);
+    m_denoiser->setAovCount(m_settings.denoiseAovs ? NB_AOVS : 0);
+    onResize(static_cast<uint32_t>(m_viewSize.x), static_cast<uint32_t>(m_viewSize.y));
+  }
+
+  // #OPTIX_D
+  // Number of interop buffer sets in the ring, the buffers are re-allocated
+  void setDenoiserInteropSets()
+  {
+    vkDeviceWaitIdle(m_device);
+    m_denoiser->setInteropSetCount(static_cast<uint32_t>(m_settings.denoiseInteropSets));
+    m_denoiser->allocateBuffers(m_gRender->getSize());
+    writeRtxSet();  // Interop buffers have changed
+    resetFrame();
+  }
+
+  // #OPTIX_D
+  // Changing the format (of the color or of the guides) re-creates the copy pipelines and the interop buffers
+  void setDenoiserPixelFormat()
+  {
+    vkDeviceWaitIdle(m_device);
+    m_denoiser->setCompactGuides(m_settings.denoiseCompactGuides);
+    m_denoiser->setPixelFormat(denoiserPixelFormat());
+    m_denoiser->createCopyPipeline();
+    m_denoiser->allocateBuffers(m_gRender->getSize());
+    writeRtxSet();  // Interop buffers have changed
+    resetFrame();
+  }
+
+  // #OPTIX_D
+  // Memory budget: the first option (see makeMemoryOptions) whose G-Buffers and denoiser fit in the budget, with
+  // the memory of the scene, is applied. The settings are only lowered, never raised back.
+  // Done after a resize, a scene load or a change of the budget.
+  void applyMemoryBudget()
+  {
+    m_budgetDirty = false;
+    if(m_settings.memoryBudgetMb <= 0 || m_gRender == nullptr)
+      return;
+
+    const size_t       budget = static_cast<size_t>(m_settings.memoryBudgetMb) * 1024 * 1024;
+    const MemoryReport report = memoryReport();
+    const size_t       fixed  = m_hasMemoryBudget ? report.categories.back().bytes : 0;  // Scene, TLAS and other Vulkan
+    const MemoryOption current{m_settings.denoiseFormat, m_settings.denoiseTileSize, m_settings.denoiseUpscale};
+
+    for(const MemoryOption& option : makeMemoryOptions(current, OPTIX_VERSION >= 80000))
+    {
+      VkExtent2D render_size  = renderExtent(m_viewSize, option.upscale);
+      VkExtent2D display_size = displayExtent(render_size, option.upscale);
+      uint32_t   tile_size    = option.tileSize == 0 ? 0 : 128U << option.tileSize;
+      size_t     bytes        = fixed + gbufferBytes(displayFormats(), depthFormat(), display_size)
+                     + gbufferBytes(renderFormats(), depthFormat(), render_size)
+                     + m_denoiser->estimateMemoryBytes(render_size, pixelFormatOf(option.format), tile_size, option.upscale);
+      if(bytes > budget)
+        continue;
+
+      if(option.format == current.format && option.tileSize == current.tileSize && option.upscale == current.upscale)
+        return;  // Already fitting
+      LOGI("Memory budget %d MB: format %d, tiling %d, upscale %d (estimate %.1f MB)\n", m_settings.memoryBudgetMb,
+           option.format, option.tileSize, option.upscale ? 1 : 0, bytes / (1024.0 * 1024.0));
+      report.log("Device memory before the budget");
+      vkDeviceWaitIdle(m_device);
+      if(option.tileSize != current.tileSize)
+      {
+        m_settings.denoiseTileSize = option.tileSize;
+        m_denoiser->setTileSize(tile_size);
+      }
+      if(option.format != current.format)
+      {
+        m_settings.denoiseFormat = option.format;
+        setDenoiserPixelFormat();
+      }
+      if(option.upscale != current.upscale)
+      {
+        m_settings.denoiseUpscale = option.upscale;
+        setDenoiserMode();  // Re-creates the G-Buffers
+      }
+      m_budgetDirty = false;
+      return;
+    }
+    LOGW("Memory budget %d MB: no denoiser setting fits, %.1f MB used\n", m_settings.memoryBudgetMb, report.total() / (1024.0 * 1024.0));
+  }
+#endif  // NVP_SUPPORTS_OPTIX7
+
+  // #OPTIX_D
+  // Determine which image will be displayed, the original from ray tracer or the denoised one
+  bool showDenoisedImage() const
+  {
+    return m_settings.denoiseApply
+           && ((m_frame >= m_settings.denoiseEveryNFrames) || m_settings.denoiseFirstFrame || m_settings.denoiseTemporal
+               || (m_settings.denoiseRoi != 0) || m_settings.denoiseLadder || (m_frame >= m_settings.maxFrames)
+               || (m_settings.denoiseSchedule == 1 && m_schedule.lastDenoised >= 0));
+  }
+
+
+  //--------------------------------------------------------------------------------------------------
+  // Compute queue: the interop copies and the tonemapper are submitted on the compute queue family,
+  // synchronized with timeline semaphores, instead of being serialized behind the ray tracing.
+  //  - graphics: ray tracing, signals m_gfxSemaphore
+  //  - compute:  copy of the images to the interop buffers, signals the denoiser timeline
+  //  - CUDA:     denoiser, signals the denoiser timeline
+  //  - compute:  copy of the denoised buffer to the image and tonemapper, signals m_computeSemaphore
+  // The frame displays the image tone mapped in the previous frame (m_ldrDisplay), the tonemapper writing the other
+  // LDR image, such that the post-processing of a frame overlaps the ray tracing of the next one.
+  // The images are exclusive to a queue family: the rendered images borrowed by the compute queue are released by the
+  // graphics queue and acquired back before the frame is displayed, the LDR image goes from compute to graphics.
+  //
+  bool useComputeQueue() const { return m_settings.computeQueue && m_app->getQueue(1).queue != VK_NULL_HANDLE; }
+
+  // LDR image written by the tonemapper of this frame
+  uint32_t ldrTarget() const
+  {
+    if(!useComputeQueue())
+      return eGBufLdr;
+    return m_ldrDisplay == eGBufLdr ? eGBufLdrAsync : eGBufLdr;
+  }
+
+  void setComputeQueue()
+  {
+    vkDeviceWaitIdle(m_device);
+    m_ldrDisplay = eGBufLdr;
+    m_ldrAcquire = false;
+    resetFrame();  // The images written on the other queue family are undefined
+  }
+
+  // Ownership transfer of images between the graphics and compute queue families, recorded on both queues:
+  // the release on the source queue, then the acquire on the destination queue after waiting the release.
+  // With a single family, only the acquire is recorded, as an execution and memory dependency.
+  void transferImages(VkCommandBuffer cmd, const std::vector<VkImage>& images, bool toCompute, bool acquire)
+  {
+    uint32_t gfx_family     = m_app->getQueue(0).familyIndex;
+    uint32_t compute_family = m_app->getQueue(1).familyIndex;
+    bool     same_family    = gfx_family == compute_family;
+    if(same_family && !acquire)
+      return;
+
+    std::vector<VkImageMemoryBarrier2> barriers;
+    for(VkImage image : images)
+    {
+      VkImageMemoryBarrier2 barrier{
+          .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+          .srcStageMask        = acquire && !same_family ? VK_PIPELINE_STAGE_2_NONE : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+          .srcAccessMask       = acquire && !same_family ? VK_ACCESS_2_NONE : VK_ACCESS_2_MEMORY_WRITE_BIT,
+          .dstStageMask        = acquire ? VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT : VK_PIPELINE_STAGE_2_NONE,
+          .dstAccessMask       = acquire ? VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT : VK_ACCESS_2_NONE,
+          .oldLayout           = VK_IMAGE_LAYOUT_GENERAL,
+          .newLayout           = VK_IMAGE_LAYOUT_GENERAL,
+          .srcQueueFamilyIndex = same_family ? VK_QUEUE_FAMILY_IGNORED : (toCompute ? gfx_family : compute_family),
+          .dstQueueFamilyIndex = same_family ? VK_QUEUE_FAMILY_IGNORED : (toCompute ? compute_family : gfx_family),
+          .image               = image,
+          .subresourceRange    = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+      };
+      barriers.push_back(barrier);
+    }
+    VkDependencyInfo dep_info{.sType                   = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                              .imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size()),
+                              .pImageMemoryBarriers    = barriers.data()};
+    vkCmdPipelineBarrier2(cmd, &dep_info);
+  }
+
+  void submit(uint32_t queue, const std::vector<VkSemaphoreSubmitInfo>& waits, VkCommandBuffer cmd,
+              const std::vector<VkSemaphoreSubmitInfo>& signals)
+  {
+    VkCommandBufferSubmitInfo cmd_buf_info{VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO, 0, cmd};
+    VkSubmitInfo2             submits{
+        .sType                    = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .waitSemaphoreInfoCount   = static_cast<uint32_t>(waits.size()),
+        .pWaitSemaphoreInfos      = waits.data(),
+        .commandBufferInfoCount   = 1,
+        .pCommandBufferInfos      = &cmd_buf_info,
+        .signalSemaphoreInfoCount = static_cast<uint32_t>(signals.size()),
+        .pSignalSemaphoreInfos    = signals.data(),
+    };
+    vkQueueSubmit2(m_app->getQueue(queue).queue, 1, &submits, {});
+  }
+
+  static VkSemaphoreSubmitInfo semaphoreInfo(VkSemaphore semaphore, uint64_t value,
+                                             VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT)
+  {
+    return {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO, .semaphore = semaphore, .value = value, .stageMask = stages};
+  }
+
+  void renderOnComputeQueue(VkCommandBuffer cmd)
+  {
+    CommandFrame&            commandFrame = m_commandFrames[m_app->getFrameCycleIndex()];
+    VkCommandBufferBeginInfo begin_info{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, 0, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+    vkResetCommandPool(m_device, commandFrame.computePool, 0);
+
+    const std::vector<VkImage> render_images = {m_gRender->getColorImage(eGBufResult), m_gRender->getColorImage(eGBufAlbedo),
+                                                m_gRender->getColorImage(eGBufNormal)};
+    const uint32_t             ldr_target    = ldrTarget();
+    const VkImage              ldr_image     = m_gBuffers->getColorImage(ldr_target);
+
+    std::vector<VkSemaphoreSubmitInfo> gfx_waits;
+    bool                               denoise = false;
+    bool                               copy_in = false;
+#ifdef NVP_SUPPORTS_OPTIX7
+    // #OPTIX_D
+    // Same waits on the denoiser as on the graphics queue, see onRender
+    denoise           = needToDenoise();
+    copy_in           = denoise && !m_settings.denoiseZeroCopy;
+    bool write_shared = (m_pushConst.interopFlags & INTEROP_WRITE_GUIDES) != 0;
+    if(denoise)
+      gfx_waits.push_back(semaphoreInfo(m_denoiser->getTLSemaphore(),
+                                        write_shared ? m_fenceValue : m_denoiser->getCurrentSetFenceValue()));
+    else if((m_pushConst.interopFlags & INTEROP_WRITE_GUIDES) != 0)
+      gfx_waits.push_back(semaphoreInfo(m_denoiser->getTLSemaphore(), m_fenceValue));
+#endif
+    const bool read_result   = !m_tonemapDenoised;  // Tonemapper input
+    const bool borrow_render = copy_in || read_result;
+
+    // Graphics: end of the ray tracing
+    if(borrow_render)
+      transferImages(cmd, render_images, true, false);
+    vkEndCommandBuffer(cmd);
+    submit(0, gfx_waits, cmd, {semaphoreInfo(m_gfxSemaphore, ++m_gfxValue)});
+
+#ifdef NVP_SUPPORTS_OPTIX7
+    // #OPTIX_D
+    // Compute: copy to the interop buffers, and signal the denoiser. Also submitted without copy (zero-copy),
+    // the signal then guarantees that the compute queue is done with the buffers of the previous denoises.
+    if(denoise)
+    {
+      VkCommandBuffer ccmd = commandFrame.computeCmd[0];
+      vkBeginCommandBuffer(ccmd, &begin_info);
+      if(copy_in)
+      {
+        transferImages(ccmd, render_images, true, true);
+        writeTimestamp(ccmd, eQueryCopyToBufferBegin);
+        copyImagesToCuda(ccmd);
+        writeTimestamp(ccmd, eQueryCopyToBufferEnd);
+        if(!read_result)
+          transferImages(ccmd, render_images, false, false);
+      }
+      vkEndCommandBuffer(ccmd);
+      submit(1, {semaphoreInfo(m_gfxSemaphore, m_gfxValue)}, ccmd,
+             {semaphoreInfo(m_denoiser->getTLSemaphore(), ++m_fenceValue), semaphoreInfo(m_computeSemaphore, ++m_computeValue)});
+      if(copy_in && !read_result)
+        m_renderComputeValue = m_computeValue;
+
+      denoiseImage();
+      m_frameQueries[m_app->getFrameCycleIndex()].denoiseFence = m_fenceValue;
+      if(m_bench.firstDenoiseFence == 0)
+        m_bench.firstDenoiseFence = m_fenceValue;
+    }
+#endif
+
+    // Compute: copy of the denoised image and tonemapper, writing the LDR image which is not displayed
+    {
+      VkCommandBuffer ccmd = commandFrame.computeCmd[1];
+      vkBeginCommandBuffer(ccmd, &begin_info);
+      if(read_result && !copy_in)
+        transferImages(ccmd, render_images, true, true);
+      if(denoise)
+      {
+        if(!fusedTonemap())
+        {
+          writeTimestamp(ccmd, eQueryCopyToImageBegin);
+          copyCudaImagesToVulkan(ccmd);
+          writeTimestamp(ccmd, eQueryCopyToImageEnd);
+        }
+#ifdef NVP_SUPPORTS_OPTIX7
+        m_denoiser->nextSet();
+#endif
+      }
+      // Previous content is not needed: no ownership transfer from the graphics queue
+      nvvk::cmdBarrierImageLayout(ccmd, ldr_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+      writeTimestamp(ccmd, eQueryTonemapBegin);
+      runTonemapper(ccmd, ldr_target);
+      writeTimestamp(ccmd, eQueryTonemapEnd);
+      if(read_result)
+        transferImages(ccmd, render_images, false, false);
+      transferImages(ccmd, {ldr_image}, false, false);
+      vkEndCommandBuffer(ccmd);
+
+      std::vector<VkSemaphoreSubmitInfo> waits = {semaphoreInfo(m_gfxSemaphore, m_gfxValue)};
+#ifdef NVP_SUPPORTS_OPTIX7
+      if(denoise)
+        waits[0] = semaphoreInfo(m_denoiser->getTLSemaphore(), m_fenceValue);
+      else if(fusedTonemap())  // Reading the output buffer of the last denoise
+        waits.push_back(semaphoreInfo(m_denoiser->getTLSemaphore(), m_fenceValue));
+#endif
+      submit(1, waits, ccmd, {semaphoreInfo(m_computeSemaphore, ++m_computeValue)});
+      if(read_result)
+        m_renderComputeValue = m_computeValue;
+      commandFrame.computeValue = m_computeValue;
+    }
+
+    // Graphics: getting back the rendered images and the LDR image displayed in this frame
+    cmd = commandFrame.cmdBuffer[1];
+    vkBeginCommandBuffer(cmd, &begin_info);
+    if(borrow_render)
+    {
+      transferImages(cmd, render_images, false, true);
+      m_app->addWaitSemaphore(semaphoreInfo(m_computeSemaphore, m_renderComputeValue));
+    }
+    recordDisplayedImageAcquire(cmd);
+    vkEndCommandBuffer(cmd);
+    VkCommandBufferSubmitInfo submit_info{VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO_KHR};
+    submit_info.commandBuffer = cmd;
+    m_app->prependCommandBuffer(submit_info);
+
+    m_ldrDisplay      = ldr_target;  // Displayed in the next frame
+    m_ldrComputeValue = m_computeValue;
+    m_ldrAcquire      = true;
+  }
+
+  // The displayed LDR image was written by the compute queue: acquiring it for the frame
+  void recordDisplayedImageAcquire(VkCommandBuffer cmd)
+  {
+    if(!m_ldrAcquire)
+      return;
+    transferImages(cmd, {m_gBuffers->getColorImage(m_ldrDisplay)}, false, true);
+    m_app->addWaitSemaphore(semaphoreInfo(m_computeSemaphore, m_ldrComputeValue));
+    m_ldrAcquire = false;
+  }
+
+  // Frame not rendered: still acquiring the displayed image, if the compute queue has written it
+  void acquireDisplayedImage()
+  {
+    if(!m_ldrAcquire)
+      return;
+    const CommandFrame& commandFrame = m_commandFrames[m_app->getFrameCycleIndex()];
+    VkCommandBuffer     cmd          = commandFrame.cmdBuffer[1];
+    vkResetCommandPool(m_device, commandFrame.cmdPool, 0);
+    VkCommandBufferBeginInfo begin_info{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, 0, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+    vkBeginCommandBuffer(cmd, &begin_info);
+    recordDisplayedImageAcquire(cmd);
+    vkEndCommandBuffer(cmd);
+    VkCommandBufferSubmitInfo submit_info{VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO_KHR};
+    submit_info.commandBuffer = cmd;
+    m_app->prependCommandBuffer(submit_info);
+  }
+
+  // The fence of the frame does not cover the compute submits of the frame which was recorded in this slot
+  void waitComputeQueue()
+  {
+    const CommandFrame& commandFrame = m_commandFrames[m_app->getFrameCycleIndex()];
+    if(commandFrame.computeValue == 0)
+      return;
+    VkSemaphoreWaitInfo wait_info{.sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+                                  .semaphoreCount = 1,
+                                  .pSemaphores    = &m_computeSemaphore,
+                                  .pValues        = &commandFrame.computeValue};
+    vkWaitSemaphores(m_device, &wait_info, UINT64_MAX);
+  }
+
+  void createComputeQueueSemaphores()
+  {
+    VkSemaphoreTypeCreateInfo timeline_info{.sType         = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+                                            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE};
+    VkSemaphoreCreateInfo     info{.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, .pNext = &timeline_info};
+    NVVK_CHECK(vkCreateSemaphore(m_device, &info, nullptr, &m_gfxSemaphore));
+    NVVK_CHECK(vkCreateSemaphore(m_device, &info, nullptr, &m_computeSemaphore));
+    m_dutil->DBG_NAME(m_gfxSemaphore);
+    m_dutil->DBG_NAME(m_computeSemaphore);
+  }
+
+  void createCommandBuffers()
   {
     // Max 3 frames in flight
     for(uint32_t i = 0; i < 3; i++)
@@ -997,19 +2212,385 @@ private:
         m_dutil->setObjectName(cf->cmdBuffer[0], fmt::format("Cmd[{}][0]", i));
         m_dutil->setObjectName(cf->cmdBuffer[1], fmt::format("Cmd[{}][1]", i));
       }
+      if(m_app->getQueue(1).queue != VK_NULL_HANDLE)
+      {  // Compute queue, see renderOnComputeQueue()
+        VkCommandPoolCreateInfo info = {.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                                        .flags            = 0,
+                                        .queueFamilyIndex = m_app->getQueue(1).familyIndex};
+        NVVK_CHECK(vkCreateCommandPool(m_device, &info, nullptr, &cf->computePool));
+        m_dutil->setObjectName(cf->computePool, "ComputePool" + std::to_string(i));
+
+        VkCommandBufferAllocateInfo alloc_info = {.sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                                  .commandPool        = cf->computePool,
+                                                  .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                                                  .commandBufferCount = 2};
+        NVVK_CHECK(vkAllocateCommandBuffers(m_device, &alloc_info, cf->computeCmd));
+        m_dutil->setObjectName(cf->computeCmd[0], fmt::format("ComputeCmd[{}][0]", i));
+        m_dutil->setObjectName(cf->computeCmd[1], fmt::format("ComputeCmd[{}][1]", i));
+      }
+    }
+    createComputeQueueSemaphores();
+
+    {  // Steps of the scene build, see pollSceneLoad()
+      VkCommandPoolCreateInfo info = {.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                                      .flags            = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                                      .queueFamilyIndex = m_app->getQueue(0).familyIndex};
+      NVVK_CHECK(vkCreateCommandPool(m_device, &info, nullptr, &m_sceneCmdPool));
+      VkCommandBufferAllocateInfo alloc_info = {.sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                                .commandPool        = m_sceneCmdPool,
+                                                .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                                                .commandBufferCount = 1};
+      NVVK_CHECK(vkAllocateCommandBuffers(m_device, &alloc_info, &m_sceneCmd));
+      VkFenceCreateInfo fence_info{.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+      NVVK_CHECK(vkCreateFence(m_device, &fence_info, nullptr, &m_sceneFence));
+      m_dutil->DBG_NAME(m_sceneCmdPool);
+      m_dutil->DBG_NAME(m_sceneFence);
+    }
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // GPU timings: timestamps around the Vulkan passes, one range of queries per frame in flight.
+  // The queries of a frame are read when its command buffers are reused (the fence was waited on),
+  // with the CUDA timings of the denoise done in that frame.
+  //
+  void createTimestampQueries()
+  {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &props);
+    m_timestampPeriod = props.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo info{.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                               .queryType  = VK_QUERY_TYPE_TIMESTAMP,
+                               .queryCount = static_cast<uint32_t>(m_commandFrames.size()) * eQueryCount};
+    NVVK_CHECK(vkCreateQueryPool(m_device, &info, nullptr, &m_queryPool));
+    m_dutil->DBG_NAME(m_queryPool);
+    vkResetQueryPool(m_device, m_queryPool, 0, info.queryCount);
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Pipeline cache persisted next to the executable: the ray tracing and copy pipelines are not
+  // compiled again at the next launch. A cache from another device or driver is discarded.
+  //
+  static std::string pipelineCacheFile()
+  {
+    return (std::filesystem::path(NVPSystem::exePath()) / PROJECT_NAME "_pipeline.cache").string();
+  }
+
+  void createPipelineCache()
+  {
+    std::vector<char> data;
+    std::ifstream     file(pipelineCacheFile(), std::ios::binary);
+    if(file)
+      data.assign(std::istreambuf_iterator<char>(file), {});
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &props);
+    VkPipelineCacheHeaderVersionOne header{};
+    if(data.size() >= sizeof(header))
+      memcpy(&header, data.data(), sizeof(header));
+    if(header.vendorID != props.vendorID || header.deviceID != props.deviceID
+       || memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+      data.clear();
+
+    VkPipelineCacheCreateInfo info{.sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+                                   .initialDataSize = data.size(),
+                                   .pInitialData    = data.data()};
+    NVVK_CHECK(vkCreatePipelineCache(m_device, &info, nullptr, &m_pipelineCache));
+    m_dutil->DBG_NAME(m_pipelineCache);
+  }
+
+  void savePipelineCache()
+  {
+    size_t size = 0;
+    vkGetPipelineCacheData(m_device, m_pipelineCache, &size, nullptr);
+    std::vector<char> data(size);
+    if(size > 0 && vkGetPipelineCacheData(m_device, m_pipelineCache, &size, data.data()) == VK_SUCCESS)
+    {
+      std::ofstream file(pipelineCacheFile(), std::ios::binary);
+      file.write(data.data(), static_cast<std::streamsize>(size));
+    }
+    vkDestroyPipelineCache(m_device, m_pipelineCache, nullptr);
+    m_pipelineCache = VK_NULL_HANDLE;
+  }
+
+  void writeTimestamp(VkCommandBuffer cmd, uint32_t query)
+  {
+    uint32_t slot = m_app->getFrameCycleIndex();
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_queryPool, slot * eQueryCount + query);
+    m_frameQueries[slot].written |= 1U << query;
+  }
+
+  void readTimings()
+  {
+    uint32_t      slot = m_app->getFrameCycleIndex();
+    FrameQueries& fq   = m_frameQueries[slot];
+    if(fq.written == 0)
+      return;
+
+    std::array<uint64_t, eQueryCount> ticks{};
+    vkGetQueryPoolResults(m_device, m_queryPool, slot * eQueryCount, eQueryCount, sizeof(ticks), ticks.data(),
+                          sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    auto elapsed = [&](uint32_t begin, uint32_t end) {
+      uint32_t mask = (1U << begin) | (1U << end);
+      return (fq.written & mask) == mask ? static_cast<float>((ticks[end] - ticks[begin]) * m_timestampPeriod * 1e-6) : -1.0F;
+    };
+
+    std::array<float, eStageCount> ms{};
+    ms.fill(-1.0F);  // Stage not executed in this frame
+    ms[eStageRaytrace]     = elapsed(eQueryRaytraceBegin, eQueryRaytraceEnd);
+    ms[eStageCopyToBuffer] = elapsed(eQueryCopyToBufferBegin, eQueryCopyToBufferEnd);
+    ms[eStageCopyToImage]  = elapsed(eQueryCopyToImageBegin, eQueryCopyToImageEnd);
+    ms[eStageTonemap]      = elapsed(eQueryTonemapBegin, eQueryTonemapEnd);
+#ifdef NVP_SUPPORTS_OPTIX7
+    float intensity_ms{};
+    float invoke_ms{};
+    if(m_denoiser->getTimings(fq.denoiseFence, intensity_ms, invoke_ms))
+    {
+      ms[eStageIntensity] = intensity_ms;  // -1 with CUDA graphs, timed with the invoke
+      ms[eStageInvoke]    = invoke_ms;
+      m_bench.denoiserMsSum += std::max(intensity_ms, 0.0F) + invoke_ms;
+      m_bench.denoiserSamples++;
+    }
+#endif
+
+    for(int i = 0; i < eStageCount; i++)
+    {
+      if(ms[i] >= 0.0F)
+        m_stageTimings[i].add(ms[i]);
+    }
+
+    if(m_timingsCsv.is_open())
+    {
+      m_timingsCsv << fq.frame;
+      for(float t : ms)
+      {
+        m_timingsCsv << ",";
+        if(t >= 0.0F)
+          m_timingsCsv << t;
+      }
+      m_timingsCsv << "\n";
+    }
+    fq = {};
+  }
+
+  void setTimingsCsv()
+  {
+    if(m_timingsCsv.is_open())
+      m_timingsCsv.close();
+    if(!m_settings.timingsCsv)
+      return;
+
+    const char* filename = "denoiser_timings.csv";
+    m_timingsCsv.open(filename);
+    if(!m_timingsCsv.is_open())
+    {
+      LOGE("Cannot open %s\n", filename);
+      m_settings.timingsCsv = false;
+      return;
+    }
+    LOGI("Writing timings to %s\n", filename);
+    m_timingsCsv << "frame";
+    for(const char* name : s_stageNames)
+      m_timingsCsv << "," << name << "_ms";
+    m_timingsCsv << "\n";
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Benchmark: the runs are done one after the other, each for a fixed number of frames.
+  // See benchmark.hpp
+  //
+  void benchmarkStep()
+  {
+    if(m_benchIdx >= 0 && m_bench.frames < m_benchConfig.framesPerRun)
+      return;  // Current run is not finished
+
+    if(m_benchIdx >= 0)
+      finishBenchmarkRun();
+
+    if(++m_benchIdx >= static_cast<int>(m_benchRuns.size()))
+    {
+      if(writeBenchmarkReport(m_benchConfig.jsonFile, m_benchConfig, m_benchRuns))
+        LOGI("Benchmark report written to %s\n", m_benchConfig.jsonFile.c_str());
+      else
+        LOGE("Cannot write the benchmark report to %s\n", m_benchConfig.jsonFile.c_str());
+      m_benchRuns.clear();
+      m_app->close();
+      return;
+    }
+
+    startBenchmarkRun();
+  }
+
+  void startBenchmarkRun()
+  {
+    const BenchmarkRun& run = m_benchRuns[m_benchIdx];
+    LOGI("Benchmark %d/%d: %s %dx%d, format %d, denoise every %d frames\n", m_benchIdx + 1,
+         static_cast<int>(m_benchRuns.size()), run.scene.c_str(), run.resolution.width, run.resolution.height,
+         run.format, run.interval);
+
+    vkDeviceWaitIdle(m_device);
+    if(run.scene != m_benchScene)
+    {
+      onFileDrop(run.scene.c_str());
+      pollSceneLoad(true);  // The run starts with the scene
+      m_benchScene = run.scene;
+    }
+    m_settings.denoiseEveryNFrames = run.interval;
+#ifdef NVP_SUPPORTS_OPTIX7
+    if(m_settings.denoiseFormat != run.format)
+    {
+      m_settings.denoiseFormat = run.format;
+      m_denoiser->setPixelFormat(denoiserPixelFormat());
+      m_denoiser->createCopyPipeline();
+    }
+#endif
+    m_benchSize = run.resolution;
+    onResize(run.resolution.width, run.resolution.height);  // G-Buffers and interop buffers
+
+    m_frameQueries    = {};  // Measures of the previous run
+    m_bench           = {};
+    m_bench.lastFrame = std::chrono::steady_clock::now();
+    m_bench.start     = m_bench.lastFrame;
+    resetFrame();
+  }
+
+  // Called for each rendered frame of the run
+  void benchmarkFrame()
+  {
+    auto   now = std::chrono::steady_clock::now();
+    double ms  = std::chrono::duration<double, std::milli>(now - m_bench.lastFrame).count();
+    m_bench.lastFrame = now;
+    if(++m_bench.frames > m_benchConfig.framesPerRun / 2)
+    {  // Steady state
+      m_bench.steadyMs += ms;
+      m_bench.steadyFrames++;
+    }
+    m_bench.peakBytes = std::max(m_bench.peakBytes, vramUsage());
+
+#ifdef NVP_SUPPORTS_OPTIX7
+    BenchmarkRun& run = m_benchRuns[m_benchIdx];
+    if(m_bench.firstDenoiseFence > 0 && run.timeToFirstDenoisedMs < 0.0)
+    {
+      uint64_t value{0};
+      vkGetSemaphoreCounterValue(m_device, m_denoiser->getTLSemaphore(), &value);
+      if(value >= m_bench.firstDenoiseFence)
+        run.timeToFirstDenoisedMs = std::chrono::duration<double, std::milli>(now - m_bench.start).count();
+    }
+#endif
+  }
+
+  void finishBenchmarkRun()
+  {
+    BenchmarkRun& run = m_benchRuns[m_benchIdx];
+#ifdef NVP_SUPPORTS_OPTIX7
+    if(m_bench.firstDenoiseFence > 0 && run.timeToFirstDenoisedMs < 0.0)
+    {  // The first denoised image was not ready yet
+      VkSemaphore         semaphore = m_denoiser->getTLSemaphore();
+      VkSemaphoreWaitInfo wait_info{.sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+                                    .semaphoreCount = 1,
+                                    .pSemaphores    = &semaphore,
+                                    .pValues        = &m_bench.firstDenoiseFence};
+      vkWaitSemaphores(m_device, &wait_info, UINT64_MAX);
+      run.timeToFirstDenoisedMs =
+          std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_bench.start).count();
+    }
+#endif
+    if(m_bench.steadyFrames > 0)
+      run.msPerFrame = m_bench.steadyMs / m_bench.steadyFrames;
+    if(m_bench.denoiserSamples > 0)
+      run.denoiserMs = m_bench.denoiserMsSum / m_bench.denoiserSamples;
+    run.peakVramMb = static_cast<double>(m_bench.peakBytes) / (1024.0 * 1024.0);
+  }
+
+  // Device memory used: Vulkan heaps (VK_EXT_memory_budget) and the memory allocated by the denoiser with CUDA
+  size_t vramUsage() const
+  {
+    size_t bytes = heapUsage();
+#ifdef NVP_SUPPORTS_OPTIX7
+    bytes += m_denoiser->getCudaMemoryBytes();
+#endif
+    return bytes;
+  }
+
+  // Usage of the device local Vulkan heaps, 0 without VK_EXT_memory_budget
+  size_t heapUsage() const
+  {
+    size_t bytes = 0;
+    if(m_hasMemoryBudget)
+    {
+      VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT};
+      VkPhysicalDeviceMemoryProperties2 props{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2, &budget};
+      vkGetPhysicalDeviceMemoryProperties2(m_physicalDevice, &props);
+      for(uint32_t i = 0; i < props.memoryProperties.memoryHeapCount; i++)
+      {
+        if((props.memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0)
+          bytes += budget.heapUsage[i];
+      }
+    }
+    return bytes;
+  }
+
+  // Device memory by category. The Vulkan allocations not tracked here (scene, TLAS, environment, ...) are what
+  // is left of the heap usage.
+  MemoryReport memoryReport() const
+  {
+    MemoryReport report;
+    size_t       tracked = gbufferBytes(displayFormats(), depthFormat(), m_gBuffers->getSize());
+    report.add("Display G-Buffers", tracked);
+    report.add("Render G-Buffers", gbufferBytes(renderFormats(), depthFormat(), m_gRender->getSize()));
+    tracked += report.categories.back().bytes;
+#ifdef NVP_SUPPORTS_OPTIX7
+    if(!m_denoiserInit.valid())
+    {
+      DenoiserOptix::MemoryUsage usage = m_denoiser->getMemoryUsage();
+      report.add("Interop buffers", usage.interop);
+      report.add("Denoiser state", usage.state);
+      report.add("Denoiser scratch", usage.scratch);
+      report.add("Denoiser history", usage.history);
+      report.add("Denoiser other", usage.other);
+      if(usage.peers > 0)
+        report.add("Denoiser peer GPUs", usage.peers);
+      tracked += usage.interop;
     }
+#endif
+    if(m_hasMemoryBudget)
+      report.add("Scene, TLAS and other Vulkan", heapUsage() - std::min(heapUsage(), tracked));
+    return report;
   }
 
   void destroyResources()
   {
     m_alloc->destroy(m_bFrameInfo);
+    vkDestroyQueryPool(m_device, m_queryPool, nullptr);
+    m_timingsCsv.close();
+    m_alloc->unmap(m_bConvergence);
+    m_alloc->destroy(m_bConvergence);
+    m_alloc->destroy(m_bBlueNoise);
 
     for(auto& f : m_commandFrames)
     {
       vkFreeCommandBuffers(m_device, f.cmdPool, 2, f.cmdBuffer);
       vkDestroyCommandPool(m_device, f.cmdPool, nullptr);
+      if(f.computePool != VK_NULL_HANDLE)
+      {
+        vkFreeCommandBuffers(m_device, f.computePool, 2, f.computeCmd);
+        vkDestroyCommandPool(m_device, f.computePool, nullptr);
+      }
+    }
+    vkDestroySemaphore(m_device, m_gfxSemaphore, nullptr);
+    vkDestroySemaphore(m_device, m_computeSemaphore, nullptr);
+    if(m_sceneUpload.valid())
+      m_sceneUpload.wait();  // Still recording in m_sceneCmd
+    vkFreeCommandBuffers(m_device, m_sceneCmdPool, 1, &m_sceneCmd);
+    vkDestroyCommandPool(m_device, m_sceneCmdPool, nullptr);
+    vkDestroyFence(m_device, m_sceneFence, nullptr);
+    if(m_nextSceneVk)
+    {  // Scene still being built
+      m_nextSceneVk->destroy();
+      m_nextSceneRtx->destroy();
     }
     m_gBuffers.reset();
+    m_gRender.reset();
 
     m_rasterPipe.destroy(m_device);
     m_rtxPipe.destroy(m_device);
@@ -1019,7 +2600,9 @@ private:
     m_picker->destroy();
 #ifdef NVP_SUPPORTS_OPTIX7
     m_denoiser->destroy();
+    m_capture.destroy();  // After the denoiser, which may wait on the pending readbacks
 #endif
+    savePipelineCache();
   }
 
   //--------------------------------------------------------------------------------------------------
@@ -1028,17 +2611,21 @@ private:
   nvvkhl::Application*             m_app{nullptr};
   std::unique_ptr<nvvk::DebugUtil> m_dutil;
   std::unique_ptr<AllocVma>        m_alloc;
+  std::unique_ptr<AllocVma>        m_sceneAlloc;  // Buffers and textures of SceneVk, created on the upload thread
 
   glm::vec2                                     m_viewSize       = {1, 1};
   VkClearColorValue                             m_clearColor     = {{0.3F, 0.3F, 0.3F, 1.0F}};  // Clear color
   VkDevice                                      m_device         = VK_NULL_HANDLE;              // Convenient
   VkPhysicalDevice                              m_physicalDevice = VK_NULL_HANDLE;              // Convenient
   std::unique_ptr<nvvkhl::GBuffer>              m_gBuffers;  // G-Buffers: color + depth
+  std::unique_ptr<nvvkhl::GBuffer>              m_gRender;   // Ray traced images, at rendering resolution
   std::unique_ptr<nvvk::DescriptorSetContainer> m_rtxSet;    // Descriptor set
   std::unique_ptr<nvvk::DescriptorSetContainer> m_sceneSet;  // Descriptor set
 
   // Resources
   nvvk::Buffer m_bFrameInfo;
+  nvvk::Buffer m_bConvergence;  // Adaptive denoising, see updateDenoiseSchedule()
+  nvvk::Buffer m_bBlueNoise;    // Mask of the blue-noise sampler, BLUE_NOISE_SIZE^2 floats
 
   // Pipeline
   PushConstant      m_pushConst{};  // Information sent to the shader
@@ -1055,6 +2642,31 @@ private:
   std::unique_ptr<nvvk::RayPickerKHR>    m_picker;  // For ray picking info
   std::unique_ptr<HdrEnv>                m_hdrEnv;
 
+  // Scene parsed in the background, see createScene(), then built over several frames, see pollSceneLoad()
+  enum SceneStep
+  {
+    eSceneIdle,
+    eSceneUpload,   // Buffers and textures, recorded on the upload thread
+    eSceneBlas,     // A batch of BLAS
+    eSceneCompact,  // Compaction of the batch
+    eSceneTlas,
+    eSceneSwap,  // Built, replacing the scene in use
+  };
+  std::future<std::unique_ptr<nvh::gltf::Scene>> m_sceneLoad;
+  std::string                                    m_sceneLoading;  // File being parsed
+  std::unique_ptr<nvh::gltf::Scene>              m_nextScene;     // Being built, m_scene renders meanwhile
+  std::unique_ptr<SceneVk>                       m_nextSceneVk;
+  std::unique_ptr<SceneRtx>                      m_nextSceneRtx;
+  std::future<void>                              m_sceneUpload;  // Recording of eSceneUpload, see recordSceneUpload()
+  std::string                                    m_nextSceneFile;
+  SceneStep                                      m_sceneStep{eSceneIdle};
+  bool                                           m_sceneBlasDone{false};    // Last batch of BLAS recorded
+  bool                                           m_sceneCompacting{false};  // The submitted step compacts a batch
+  bool                                           m_sceneSubmitted{false};   // Step in flight, see m_sceneFence
+  VkCommandPool                                  m_sceneCmdPool{VK_NULL_HANDLE};
+  VkCommandBuffer                                m_sceneCmd{VK_NULL_HANDLE};
+  VkFence                                        m_sceneFence{VK_NULL_HANDLE};
+
   // For rendering all nodes
   std::vector<uint32_t> m_solidMatNodes;
   std::vector<uint32_t> m_blendMatNodes;
@@ -1063,16 +2675,133 @@ private:
 #ifdef NVP_SUPPORTS_OPTIX7
   std::unique_ptr<DenoiserOptix> m_denoiser;
   uint64_t                       m_fenceValue{0U};
+  FrameCapture                   m_capture;       // Saving the denoised frames
+  uint32_t                       m_captureIdx{0U};
+  std::future<void>              m_denoiserInit;  // Background initialization, see waitDenoiser()
 #endif  // NVP_SUPPORTS_OPTIX7
-  float m_blendFactor = 0.0f;
+  float     m_blendFactor = 0.0f;
+  glm::mat4 m_prevViewProj{1.0F};  // Camera of the previously rendered frame
+  glm::vec2 m_mouseUv{0.5F};       // Last mouse position over the viewport, [0,1]
+  int       m_pickedNode{-1};      // Render node picked with screenPicking(), -1: none
+
+  // Adaptive denoising
+  struct DenoiseSchedule
+  {
+    float changeSinceDenoise{0.0F};  // Sum of the mean relative change of each frame since the last denoise
+    int   lastDenoised{-1};          // Frame of the last denoise
+    int   budget{0};                 // Maximum number of frames between two denoises
+    bool  denoiseNow{false};         // The current frame is denoised
+  } m_schedule;
+  uint32_t*          m_convergence{nullptr};            // Mapped m_bConvergence
+  std::array<int, 3> m_convergenceFrame{-1, -1, -1};  // Frame measured in each slot, -1: none
 
   // Command buffers for rendering
   struct CommandFrame
   {
-    VkCommandPool   cmdPool      = VK_NULL_HANDLE;
-    VkCommandBuffer cmdBuffer[2] = {VK_NULL_HANDLE, VK_NULL_HANDLE};
+    VkCommandPool   cmdPool       = VK_NULL_HANDLE;
+    VkCommandBuffer cmdBuffer[2]  = {VK_NULL_HANDLE, VK_NULL_HANDLE};
+    VkCommandPool   computePool   = VK_NULL_HANDLE;                   // Compute queue family
+    VkCommandBuffer computeCmd[2] = {VK_NULL_HANDLE, VK_NULL_HANDLE};  // Copy to the interop buffers, post-process
+    uint64_t        computeValue  = 0;                                // Signaled by the last compute submit
   };
   std::array<CommandFrame, 3> m_commandFrames;
+
+  // Compute queue, see renderOnComputeQueue()
+  VkSemaphore m_gfxSemaphore{};          // Timeline: ray tracing done
+  VkSemaphore m_computeSemaphore{};      // Timeline: compute submits done
+  uint64_t    m_gfxValue{0};             // Last value signaled on m_gfxSemaphore
+  uint64_t    m_computeValue{0};         // Last value signaled on m_computeSemaphore
+  uint64_t    m_renderComputeValue{0};   // Compute queue done with the rendered images
+  uint32_t    m_ldrDisplay{eGBufLdr};    // LDR image displayed, the tonemapper writes the other one
+  uint64_t    m_ldrComputeValue{0};      // Compute queue done with m_ldrDisplay
+  bool        m_ldrAcquire{false};       // m_ldrDisplay is released by the compute queue, not acquired yet
+  bool        m_tonemapDenoised{false};  // Input of the tonemapper for this frame
+  bool        m_copyDenoised{false};     // eGbufDenoised to be written again from the last denoise, see onRender
+
+  // GPU timings
+  enum TimestampQueries
+  {
+    eQueryRaytraceBegin,
+    eQueryRaytraceEnd,
+    eQueryCopyToBufferBegin,
+    eQueryCopyToBufferEnd,
+    eQueryCopyToImageBegin,
+    eQueryCopyToImageEnd,
+    eQueryTonemapBegin,
+    eQueryTonemapEnd,
+    eQueryCount
+  };
+  enum Stages
+  {
+    eStageRaytrace,
+    eStageCopyToBuffer,
+    eStageIntensity,
+    eStageInvoke,
+    eStageCopyToImage,
+    eStageTonemap,
+    eStageCount
+  };
+  static constexpr std::array<const char*, eStageCount> s_stageNames = {"raytrace", "copy_to_buffer", "intensity",
+                                                                         "invoke",   "copy_to_image",  "tonemap"};
+  struct FrameQueries
+  {
+    int      frame{-1};
+    uint32_t written{0};       // Bit mask of the queries written in this frame
+    uint64_t denoiseFence{0};  // Timeline value of the denoise, 0: none
+  };
+  // Rolling window of the last samples
+  struct StageTiming
+  {
+    std::array<float, 128> samples{};
+    uint32_t               count{0};
+    uint32_t               next{0};
+
+    void add(float ms)
+    {
+      samples[next] = ms;
+      next          = (next + 1) % static_cast<uint32_t>(samples.size());
+      count         = std::min(count + 1, static_cast<uint32_t>(samples.size()));
+    }
+    glm::vec3 minAvgMax() const
+    {
+      if(count == 0)
+        return glm::vec3(0.0F);
+      auto      first = samples.begin();
+      glm::vec3 mam{*std::min_element(first, first + count), 0.0F, *std::max_element(first, first + count)};
+      for(uint32_t i = 0; i < count; i++)
+        mam.y += samples[i];
+      mam.y /= static_cast<float>(count);
+      return mam;
+    }
+  };
+  VkPipelineCache                      m_pipelineCache{VK_NULL_HANDLE};  // Persisted, see createPipelineCache()
+  VkQueryPool                          m_queryPool{VK_NULL_HANDLE};
+  float                                m_timestampPeriod{1.0F};  // Nanoseconds per tick
+  std::array<FrameQueries, 3>          m_frameQueries{};
+  std::array<StageTiming, eStageCount> m_stageTimings{};
+  std::ofstream                        m_timingsCsv;
+
+  // Benchmark
+  struct BenchmarkState
+  {
+    int                                   frames{0};
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point lastFrame;
+    double                                steadyMs{0.0};  // Sum of the frame times of the second half of the run
+    int                                   steadyFrames{0};
+    uint64_t                              firstDenoiseFence{0};
+    double                                denoiserMsSum{0.0};
+    int                                   denoiserSamples{0};
+    size_t                                peakBytes{0};
+  } m_bench;
+  BenchmarkConfig           m_benchConfig;
+  std::vector<BenchmarkRun> m_benchRuns;  // Empty: no benchmark running
+  int                       m_benchIdx{-1};
+  std::string               m_benchScene;
+  VkExtent2D                m_benchSize{0, 0};  // Resolution of the run, 0: size of the viewport
+  bool                      m_hasMemoryBudget{false};
+  bool                      m_budgetDirty{false};  // Memory budget to be applied again, see applyMemoryBudget
+  bool                      m_guidesValid{false};  // Albedo, normal in the G-Buffer are of the current image, see resetFrame
 };
 
 }  // namespace nvvkhl
@@ -1102,6 +2831,7 @@ auto main(int argc, char** argv) -> int
   VkPhysicalDeviceRayQueryFeaturesKHR ray_query_features{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR};
   vkSetup.addDeviceExtension(VK_KHR_RAY_QUERY_EXTENSION_NAME, false, &ray_query_features);  // Used for picking
   vkSetup.addDeviceExtension(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+  vkSetup.addDeviceExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME, true);  // VRAM usage reported by the benchmark
 
   // #OPTIX_D
   // Semaphores - interop Vulkan/Cuda
@@ -1124,6 +2854,27 @@ auto main(int argc, char** argv) -> int
   vkSetup.addDeviceExtension(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME);
   vkSetup.addDeviceExtension(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME);
 
+  // Batch denoising of images on disk, without window and renderer (see batch.hpp)
+  BatchConfig batch_config;
+  if(parseBatchArgs(argc, argv, batch_config))
+  {
+    nvvk::Context batch_context;
+    batch_context.init(vkSetup);
+    int result = runBatchDenoise(batch_context, batch_config);
+    batch_context.deinit();
+    return result;
+  }
+
+  // Denoise service shared by other renderers, without window and renderer (see denoise_service.hpp)
+  ServiceConfig service_config;
+  if(parseServiceArgs(argc, argv, service_config))
+  {
+    nvvk::Context service_context;
+    service_context.init(vkSetup);
+    int result = runDenoiseService(service_context, service_config);
+    service_context.deinit();
+    return result;
+  }
 
   // Display extension
   vkSetup.deviceExtensions.emplace_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
@@ -1150,6 +2901,17 @@ auto main(int argc, char** argv) -> int
   g_elemCamera       = std::make_shared<nvvkhl::ElementCamera>();        // Create the camera to be used
   auto optixDenoiser = std::make_shared<nvvkhl::OptixDenoiserEngine>();  // Create application elements
 
+  // Benchmark sweep, see benchmark.hpp (parsed when the benchmark element is attached)
+  BenchmarkConfig bench_config;
+  auto&           bench_params = g_elemBenchmark->parameterLists();
+  bench_params.add("benchmark_json|Run the benchmark sweep and write the report to this file", &bench_config.jsonFile);
+  bench_params.add("benchmark_frames|Frames rendered by each benchmark run", &bench_config.framesPerRun);
+  bench_params.add("benchmark_resolutions|Heights of the 16:9 resolutions, ex: 1080,2160", &bench_config.resolutions);
+  bench_params.add("benchmark_formats|Interop pixel formats (0:RGBA32F 1:RGBA16F 2:RGB32F 3:RGB16F)", &bench_config.formats);
+  bench_params.add("benchmark_intervals|Denoise every N frames, ex: 1,10,100", &bench_config.intervals);
+  int memory_budget = 0;  // See memory_budget.hpp
+  bench_params.add("memory_budget|Budget of the device memory in MB, the denoiser settings are lowered to fit", &memory_budget);
+
   app->addElement(g_elemCamera);
   app->addElement(g_elemBenchmark);
   app->addElement(optixDenoiser);
@@ -1166,6 +2928,20 @@ auto main(int argc, char** argv) -> int
   std::string hdr_file = nvh::findFile(R"(media/spruit_sunrise_1k.hdr)", default_search_paths, true);
   optixDenoiser->onFileDrop(hdr_file.c_str());
 
+  if(!bench_config.jsonFile.empty())
+  {
+    // All glTF scenes of the media directory, with the default environment
+    for(const auto& entry : std::filesystem::directory_iterator(std::filesystem::path(scn_file).parent_path()))
+    {
+      if(entry.path().extension() == ".gltf")
+        bench_config.scenes.push_back(entry.path().string());
+    }
+    std::sort(bench_config.scenes.begin(), bench_config.scenes.end());
+    bench_config.hdr = hdr_file;
+    optixDenoiser->setBenchmark(bench_config);
+  }
+  optixDenoiser->setMemoryBudget(memory_budget, m_context->hasDeviceExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME));
+
   // Run as fast as possible
   app->setVsync(false);
 
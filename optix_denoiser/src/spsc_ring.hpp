@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2019-2025, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2025 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Lock-free ring for one producer thread and one consumer thread. The indices only grow, the slot is the index
+// modulo the capacity (a power of two). push and pop wait on the index of the other side when full or empty.
+template <typename T, size_t N>
+class SpscRing
+{
+  static_assert(N > 0 && (N & (N - 1)) == 0, "The capacity must be a power of two");
+
+public:
+  // Producer: false if the ring is full
+  bool tryPush(const T& value)
+  {
+    const size_t head = m_head.load(std::memory_order_relaxed);
+    if(head - m_tail.load(std::memory_order_acquire) == N)
+      return false;
+    m_items[head & (N - 1)] = value;
+    m_head.store(head + 1, std::memory_order_release);
+    m_head.notify_one();
+    return true;
+  }
+
+  // Producer: waits while the ring is full
+  void push(const T& value)
+  {
+    while(!tryPush(value))
+      m_tail.wait(m_head.load(std::memory_order_relaxed) - N, std::memory_order_acquire);
+  }
+
+  // Consumer: false if the ring is empty
+  bool tryPop(T& value)
+  {
+    const size_t tail = m_tail.load(std::memory_order_relaxed);
+    if(tail == m_head.load(std::memory_order_acquire))
+      return false;
+    value = m_items[tail & (N - 1)];
+    m_tail.store(tail + 1, std::memory_order_release);
+    m_tail.notify_one();
+    return true;
+  }
+
+  // Consumer: waits while the ring is empty
+  void pop(T& value)
+  {
+    while(!tryPop(value))
+      m_head.wait(m_tail.load(std::memory_order_relaxed), std::memory_order_acquire);
+  }
+
+private:
+  std::array<T, N>                m_items{};
+  alignas(64) std::atomic<size_t> m_head{0};  // Next slot written, only stored by the producer
+  alignas(64) std::atomic<size_t> m_tail{0};  // Next slot read, only stored by the consumer
+};
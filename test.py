@@ -12,6 +12,7 @@ build_dir = "build/"
 install_dir = "_install/"
 build_commands = ["cmake", "--build", ".", "--config", "Release", "--parallel"]
 test_arguments = ["-test-frames", "100"]
+benchmark_arguments = ["-benchmark_frames", "200"]
 
 def header(name):
     """Print a header with a given name."""
@@ -109,6 +110,40 @@ def test():
     if returncode != 0:
         sys.exit(1)
 
+def benchmark():
+    """Run the benchmark sweep of each executable, writing a JSON report per executable."""
+    header("BENCHMARK")
+    test_dir = os.path.join(install_dir, "bin_x64/")
+
+    if not os.path.exists(test_dir):
+        print(f"Test directory '{test_dir}' does not exist.")
+        return
+
+    current_dir = os.getcwd()
+    os.chdir(test_dir)
+
+    executables = [
+        f
+        for f in os.listdir(".")
+        if os.path.isfile(os.path.join(".", f)) and (f.endswith(".exe") or f.endswith("_app"))
+    ]
+
+    returncode = 0
+    for executable in executables:
+        report = "benchmark_" + executable[:-4] + "_" + datetime.datetime.now().strftime("%Y%m%d_%H%M%S") + ".json"
+        args = [os.path.join(".", executable), "-benchmark_json", report] + benchmark_arguments
+        try:
+            header(f"Benchmarking '{executable}'")
+            subprocess.run(args, check=True)
+            print(f"Report: {os.path.join(test_dir, report)}")
+        except subprocess.CalledProcessError as e:
+            print(f"Error occurred while benchmarking: {e}")
+            returncode = e.returncode
+
+    os.chdir(current_dir)
+    if returncode != 0:
+        sys.exit(1)
+
 if __name__ == "__main__":
     # Create the parser
     parser = argparse.ArgumentParser()
@@ -116,6 +151,7 @@ if __name__ == "__main__":
     # Add the command line options
     parser.add_argument("--build", action="store_true", help="Execute build function")
     parser.add_argument("--test", action="store_true", help="Execute test function")
+    parser.add_argument("--benchmark", action="store_true", help="Execute the benchmark sweep")
 
     # Parse the command line arguments
     args = parser.parse_args()
@@ -126,6 +162,9 @@ if __name__ == "__main__":
     if args.test:
         test()
 
+    if args.benchmark:
+        benchmark()
+
     # If no arguments provided, call all functions
     if not any(vars(args).values()):
         build()